@@ -0,0 +1,52 @@
+/*
+ *  Assembler driver that turns a venus assembly file into an RV32 ELF
+ *  object, mainly so the cgen-lib files can be linked with the objects
+ *  61ccc writes with --elf.
+ *
+ *    ./61cas cgen-lib/print.s -o cgen-lib/print.o
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "elf-object.h"
+#include "rv-assembler.h"
+
+int main(int argc, char** argv) {
+  char* outputFile = NULL;
+  char* inputFile = NULL;
+  ObjectCode* code;
+  FILE* out;
+  int written;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      outputFile = argv[++i];
+    } else if (inputFile == NULL) {
+      inputFile = argv[i];
+    } else {
+      inputFile = NULL;
+      break;
+    }
+  }
+  if (inputFile == NULL || outputFile == NULL) {
+    fprintf(stderr, "Usage: %s file.s -o file.o\n", argv[0]);
+    return 1;
+  }
+  code = AssembleFile(inputFile);
+  if (code == NULL) {
+    return 1;
+  }
+  out = fopen(outputFile, "wb");
+  if (out == NULL) {
+    fprintf(stderr, "Error: Could not open %s for writing.\n", outputFile);
+    FreeObjectCode(code);
+    return 1;
+  }
+  written = WriteElfObject(code, out);
+  written = fclose(out) == 0 && written;
+  FreeObjectCode(code);
+  if (!written) {
+    fprintf(stderr, "Error: Could not write %s.\n", outputFile);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,109 @@
+/*
+ *  Simulator driver that runs assembly written by 61ccc natively, in place
+ *  of venus. Every file is assembled on its own and linked the way venus
+ *  links the files it is given, so the compiler output and the cgen-lib
+ *  files can be passed separately or already joined into one file.
+ *
+ *    ./61csim tests/part1/outputs/part1-basic-div-output.S
+ *    ./61csim --count out.S cgen-lib/print.s
+ *    ./61csim --profile profile.txt --folded stacks.txt out.S
+ *
+ *  The output matches venus. --profile and --folded write the profile
+ *  described in sim-profile.h to the files they are given, with its lines
+ *  in the .61c source when the assembly was compiled with --line-info and
+ *  in the assembly otherwise. Exits with 0 once the program exits, whatever
+ *  code it exits with, and with 1 if it could not be assembled, faulted or
+ *  its profile could not be written.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rv-assembler.h"
+#include "rv-simulator.h"
+#include "sim-profile.h"
+#include "utils.h"
+
+/*
+ *  Writes the profile to the file called name with write, returning 0 if
+ *  it could not be written.
+ */
+static int WriteProfileFile(const char* name, const SimProfile* profile,
+                            void (*write)(const SimProfile*, FILE*)) {
+  FILE* out = fopen(name, "w");
+  if (out == NULL) {
+    fprintf(stderr, "Error: Could not open %s for writing.\n", name);
+    return 0;
+  }
+  write(profile, out);
+  if (fclose(out) != 0) {
+    fprintf(stderr, "Error: Could not write %s.\n", name);
+    return 0;
+  }
+  return 1;
+}
+
+int main(int argc, char** argv) {
+  ObjectCode** objects;
+  const char** names;
+  size_t total = 0;
+  int count = 0;
+  int failed = 0;
+  char* profileFile = NULL;
+  char* foldedFile = NULL;
+  SimProgram* program;
+  SimProfile* profile = NULL;
+  SimResult result;
+  objects = calloc(argc, sizeof(ObjectCode*));
+  names = calloc(argc, sizeof(char*));
+  if (objects == NULL || names == NULL) {
+    AllocationFailed();
+  }
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--count") == 0) {
+      count = 1;
+    } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+      profileFile = argv[++i];
+    } else if (strcmp(argv[i], "--folded") == 0 && i + 1 < argc) {
+      foldedFile = argv[++i];
+    } else {
+      names[total] = argv[i];
+      objects[total] = AssembleFile(argv[i]);
+      failed |= objects[total++] == NULL;
+    }
+  }
+  if (total == 0) {
+    fprintf(stderr, "Usage: %s [--count] [--profile file] [--folded file] file.S...\n", argv[0]);
+    return 1;
+  }
+  program = failed ? NULL : LinkProgram(objects, names, total);
+  for (size_t i = 0; i < total; i++) {
+    if (objects[i] != NULL) {
+      FreeObjectCode(objects[i]);
+    }
+  }
+  free(objects);
+  free(names);
+  if (program == NULL) {
+    return 1;
+  }
+  if (profileFile != NULL || foldedFile != NULL) {
+    profile = NewSimProfile(program);
+  }
+  RunProgram(program, stdout, profile, &result);
+  if (count) {
+    fprintf(stderr, "Instructions: %" PRIu64 "\n", result.instrTotal);
+  }
+  if (profileFile != NULL) {
+    failed |= !WriteProfileFile(profileFile, profile, WriteFlatProfile);
+  }
+  if (foldedFile != NULL) {
+    failed |= !WriteProfileFile(foldedFile, profile, WriteFoldedStacks);
+  }
+  if (profile != NULL) {
+    FreeSimProfile(profile);
+  }
+  FreeSimProgram(program);
+  return result.status == SIM_EXITED && !failed ? 0 : 1;
+}
@@ -1,11 +1,83 @@
 #include <stdio.h>
 #include "additional-instructions.h"
+#include "asm-output.h"
+
+const char* argRegNames[] = {"a0", "a1", "a2", "a3", "a4", "a5", "a6", "a7"};
+
+/*
+ *  Writes op followed by up to three register or label operands. Unused
+ *  operands are NULL.
+ */
+static void EmitOperands(const char* op, const char* first, const char* second, const char* third) {
+  const char* operands[] = {first, second, third};
+  WriteAsmString(op);
+  for (int i = 0; i < 3 && operands[i] != NULL; i++) {
+    WriteAsmChar(' ');
+    WriteAsmString(operands[i]);
+  }
+  WriteAsmChar('\n');
+}
+
+/*
+ *  Writes op rd rs imm.
+ */
+static void EmitImmediate(const char* op, const char* rd, const char* rs, int imm) {
+  WriteAsmString(op);
+  WriteAsmChar(' ');
+  WriteAsmString(rd);
+  WriteAsmChar(' ');
+  WriteAsmString(rs);
+  WriteAsmChar(' ');
+  WriteAsmInt(imm);
+  WriteAsmChar('\n');
+}
+
+/*
+ *  Writes op rd imm(rs).
+ */
+static void EmitMemory(const char* op, const char* rd, int imm, const char* rs) {
+  WriteAsmString(op);
+  WriteAsmChar(' ');
+  WriteAsmString(rd);
+  WriteAsmChar(' ');
+  WriteAsmInt(imm);
+  WriteAsmChar('(');
+  WriteAsmString(rs);
+  WriteAsmString(")\n");
+}
+
+void EmitArgMV(int arg, enum reg rs) {
+  EmitOperands("mv", argRegNames[arg], regNames[rs], NULL);
+}
+
+void EmitArgLW(int arg, int imm, enum reg rs) {
+  EmitMemory("lw", argRegNames[arg], imm, regNames[rs]);
+}
+
+void EmitArgLB(int arg, int imm, enum reg rs) {
+  EmitMemory("lb", argRegNames[arg], imm, regNames[rs]);
+}
 
 void EmitMULH(enum reg rd, enum reg rs1, enum reg rs2) {
-  printf("mulh %s %s %s\n", regNames[rd], regNames[rs1], regNames[rs2]);
+  EmitOperands("mulh", regNames[rd], regNames[rs1], regNames[rs2]);
 }
 
 void EmitORI(enum reg rd, enum reg rs1, int imm) {
-  printf("ori %s %s %d\n", regNames[rd], regNames[rs1], imm);
+  EmitImmediate("ori", regNames[rd], regNames[rs1], imm);
+}
+
+void EmitBLT(enum reg rs1, enum reg rs2, char* label) {
+  EmitOperands("blt", regNames[rs1], regNames[rs2], label);
 }
 
+void EmitBGE(enum reg rs1, enum reg rs2, char* label) {
+  EmitOperands("bge", regNames[rs1], regNames[rs2], label);
+}
+
+void EmitBLTU(enum reg rs1, enum reg rs2, char* label) {
+  EmitOperands("bltu", regNames[rs1], regNames[rs2], label);
+}
+
+void EmitBGEU(enum reg rs1, enum reg rs2, char* label) {
+  EmitOperands("bgeu", regNames[rs1], regNames[rs2], label);
+}
@@ -12,9 +12,32 @@
 #include <stddef.h>
 #include "instructions.h"
 
+/*
+ *  Number of registers used to pass arguments with --register-args. Only a0
+ *  and a1 are part of enum reg, so argument n is named by argRegNames[n] and
+ *  is written with the EmitArg* functions below.
+ */
+#define ARG_REG_TOTAL 8
+
+extern const char* argRegNames[];
+
+void EmitArgMV(int arg, enum reg rs);
+
+void EmitArgLW(int arg, int imm, enum reg rs);
+
+void EmitArgLB(int arg, int imm, enum reg rs);
+
 void EmitMULH(enum reg rd, enum reg rs1, enum reg rs2);
 
 void EmitORI(enum reg rd, enum reg rs1, int imm);
 
+void EmitBLT(enum reg rs1, enum reg rs2, char* label);
+
+void EmitBGE(enum reg rs1, enum reg rs2, char* label);
+
+void EmitBLTU(enum reg rs1, enum reg rs2, char* label);
+
+void EmitBGEU(enum reg rs1, enum reg rs2, char* label);
+
 #endif
 
@@ -0,0 +1,167 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "asm-output.h"
+#include "cgen-options.h"
+#include "compile-stats.h"
+#include "elf-object.h"
+#include "rv-assembler.h"
+#include "string-pool.h"
+#include "utils.h"
+
+/* The real stdout and the stream that fills the buffer in its place. */
+static FILE* standardOutput = NULL;
+static FILE* bufferStream = NULL;
+static char* buffer = NULL;
+static size_t bufferSize = 0;
+/* File the -o output is written to before it is renamed into place. */
+static char* tempFile = NULL;
+
+void WriteAsmString(const char* str) {
+  fputs(str, stdout);
+}
+
+void WriteAsmChar(char c) {
+  putc(c, stdout);
+}
+
+void WriteAsmInt(int value) {
+  char digits[12];
+  size_t start = sizeof(digits);
+  /* Works on the negative value so the smallest int does not overflow. */
+  int negative = value < 0;
+  if (!negative) {
+    value = -value;
+  }
+  do {
+    digits[--start] = (char) ('0' - value % 10);
+    value /= 10;
+  } while (value != 0);
+  if (negative) {
+    digits[--start] = '-';
+  }
+  fwrite(digits + start, 1, sizeof(digits) - start, stdout);
+}
+
+/*
+ *  Ends the process after a failed write, removing the unfinished -o file
+ *  so the one it would have replaced is left as it was.
+ */
+static void AbortOutput() {
+  if (tempFile != NULL) {
+    remove(tempFile);
+  }
+  _Exit(1);
+}
+
+/*
+ *  Assembles the buffer and writes it out as an ELF object. The exit status
+ *  has already been chosen by now, so a failure to assemble or write ends
+ *  the process here to report it.
+ */
+static void WriteObject(FILE* destination) {
+  ObjectCode* code = AssembleText(buffer, bufferSize, "generated assembly");
+  if (code == NULL) {
+    AbortOutput();
+  }
+  if (!WriteElfObject(code, destination) || fflush(destination) != 0) {
+    fprintf(stderr, "Error: Could not write the generated object.\n");
+    AbortOutput();
+  }
+  FreeObjectCode(code);
+}
+
+static void WriteBuffer(FILE* destination) {
+  if (GetCGenOptions()->elfObject) {
+    WriteObject(destination);
+  } else if (fwrite(buffer, 1, bufferSize, destination) != bufferSize || fflush(destination) != 0) {
+    fprintf(stderr, "Error: Could not write the generated assembly.\n");
+    AbortOutput();
+  }
+}
+
+/*
+ *  Writes the buffer to outputFile.tmp and renames it over outputFile once
+ *  all of it is written, so outputFile is never left half written. Anything
+ *  other than a regular file, such as /dev/stdout, is written in place.
+ */
+static void WriteOutputFile(const char* outputFile) {
+  struct stat existing;
+  const char* path = outputFile;
+  FILE* destination;
+  if (stat(outputFile, &existing) != 0 || S_ISREG(existing.st_mode)) {
+    tempFile = malloc(strlen(outputFile) + sizeof(".tmp"));
+    if (tempFile == NULL) {
+      AllocationFailed();
+    }
+    strcpy(tempFile, outputFile);
+    strcat(tempFile, ".tmp");
+    path = tempFile;
+  }
+  destination = fopen(path, "w");
+  if (destination == NULL) {
+    fprintf(stderr, "Error: Could not open %s for writing.\n", path);
+    _Exit(1);
+  }
+  WriteBuffer(destination);
+  if (fclose(destination) != 0 || (tempFile != NULL && rename(tempFile, outputFile) != 0)) {
+    fprintf(stderr, "Error: Could not write %s.\n", outputFile);
+    AbortOutput();
+  }
+  free(tempFile);
+  tempFile = NULL;
+}
+
+/*
+ *  Writes out everything printed during the run with a single write. When
+ *  the compile failed, the -o file is not touched, while the partial output
+ *  still goes to stdout as it would without the buffer.
+ */
+static void FlushAsmOutput(int status, void* unused) {
+  const char* outputFile = GetCGenOptions()->outputFile;
+  char* pooled;
+  (void) unused;
+  stdout = standardOutput;
+  fclose(bufferStream);
+  if (status != 0 && outputFile != NULL) {
+    free(buffer);
+    return;
+  }
+  BeginPhase(PHASE_STRING_POOL);
+  pooled = PoolStringLiterals(buffer, &bufferSize);
+  if (pooled != NULL) {
+    free(buffer);
+    buffer = pooled;
+  }
+  EndPhase(PHASE_STRING_POOL);
+  BeginPhase(PHASE_OUTPUT);
+  AddStat(STAT_OUTPUT_BYTES, bufferSize);
+  if (outputFile != NULL) {
+    WriteOutputFile(outputFile);
+  } else {
+    WriteBuffer(stdout);
+  }
+  free(buffer);
+  EndPhase(PHASE_OUTPUT);
+  if (StatsEnabled()) {
+    PrintCompileStats(stderr);
+  }
+}
+
+/*
+ *  Runs before main, because the library starts printing before any code
+ *  in this directory is called. on_exit rather than atexit passes the exit
+ *  status to FlushAsmOutput.
+ */
+static void __attribute__((constructor)) CaptureAsmOutput() {
+  standardOutput = stdout;
+  bufferStream = open_memstream(&buffer, &bufferSize);
+  if (bufferStream == NULL) {
+    AllocationFailed();
+  }
+  stdout = bufferStream;
+  on_exit(FlushAsmOutput, NULL);
+}
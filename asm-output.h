@@ -0,0 +1,30 @@
+/*
+ *  File that holds the buffer all of the compiler's output is written to.
+ *  The library prints the assembly it generates with printf, so before main
+ *  runs stdout is pointed at a growable stream in memory. When the compiler
+ *  exits the whole buffer is written at once, to the real stdout or to the
+ *  file given with -o in CGENFLAGS. For example
+ *
+ *    CGENFLAGS="-o file.S" ./61ccc -c file.61c
+ *
+ *  The -o file is only replaced when the compile succeeds and all of the
+ *  output could be written.
+ *
+ *  With --elf the buffer is assembled on the way out and written as an RV32
+ *  ELF object instead, which can be linked with objects of the cgen-lib
+ *  files built by 61cas.
+ *
+ *  The Write* functions format straight into the buffer without going
+ *  through a printf format, for code that prints an instruction at a time.
+ */
+
+#ifndef ASM_OUTPUT_H
+#define ASM_OUTPUT_H
+
+void WriteAsmString(const char* str);
+
+void WriteAsmChar(char c);
+
+void WriteAsmInt(int value);
+
+#endif
@@ -0,0 +1,7 @@
+# Variant of allocs.s for code compiled with CGENFLAGS=--register-args.
+alloca:
+  slli t0 a0 2
+  srli t0 t0 2
+  addi a0 sp 4
+  sub sp sp t0
+  jr ra
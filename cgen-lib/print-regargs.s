@@ -0,0 +1,104 @@
+# Variant of print.s for code compiled with CGENFLAGS=--register-args, which
+# passes the first eight arguments in a0-a7 instead of on the stack.
+
+PrintString:
+  addi sp sp -4
+  sw ra 0(sp)
+  mv a1 a0
+  addi a0 x0 4
+  ecall
+  jal PrintNewline
+  lw ra 0(sp)
+  addi sp sp 4
+  jr ra
+
+PrintInt:
+  addi sp sp -4
+  sw ra 0(sp)
+  mv a1 a0
+  addi a0 x0 1
+  ecall
+  jal PrintNewline
+  lw ra 0(sp)
+  addi sp sp 4
+  jr ra
+
+PrintChar:
+  addi sp sp -4
+  sw ra 0(sp)
+  andi a1 a0 0xff
+  addi a0 x0 11
+  ecall
+  jal PrintNewline
+  lw ra 0(sp)
+  addi sp sp 4
+  jr ra
+
+PrintBool:
+  addi sp sp -4
+  sw ra 0(sp)
+  mv a1 a0
+  addi a0 x0 1
+  ecall
+  jal PrintNewline
+  lw ra 0(sp)
+  addi sp sp 4
+  jr ra
+
+PrintNewline:
+  addi a1 x0 10 #Load newline char
+  addi a0 x0 11
+  ecall
+  mv a0 x0
+  jr ra
+
+PrintInts:
+  addi sp sp -12
+  sw ra 8(sp)
+  sw a1 0(sp)
+  sw a2 4(sp)
+  jal PrintInt
+  lw a0 0(sp)
+  jal PrintInt
+  lw a0 4(sp)
+  jal PrintInt
+  lw ra 8(sp)
+  addi sp sp 12
+  jr ra
+
+PrintChars:
+  addi sp sp -12
+  sw ra 8(sp)
+  sw a1 0(sp)
+  sw a2 4(sp)
+  jal PrintChar
+  lw a0 0(sp)
+  jal PrintChar
+  lw a0 4(sp)
+  jal PrintChar
+  lw ra 8(sp)
+  addi sp sp 12
+  jr ra
+
+PrintMixed:
+  addi sp sp -24
+  sw ra 20(sp)
+  sw a1 0(sp)
+  sw a2 4(sp)
+  sw a3 8(sp)
+  sw a4 12(sp)
+  sw a5 16(sp)
+  jal PrintChar
+  lw a0 0(sp)
+  jal PrintChar
+  lw a0 4(sp)
+  jal PrintInt
+  lw a0 8(sp)
+  jal PrintInt
+  lw a0 12(sp)
+  jal PrintChar
+  lw a0 16(sp)
+  jal PrintInt
+  lw ra 20(sp)
+  addi sp sp 24
+  jr ra
@@ -0,0 +1,106 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cgen-options.h"
+#include "utils.h"
+
+/*
+ *  A flag that turns on an option, given as the offset of its field, and
+ *  the line describing it in the usage.
+ */
+typedef struct cgenFlag {
+  char* name;
+  size_t field;
+  char* help;
+} CGenFlag;
+
+static const CGenFlag cgenFlags[] = {
+  {"--register-args", offsetof(CGenOptions, registerArgs),
+   "Pass the first eight arguments in a0-a7. Link with cgen-lib/print-regargs.s."},
+  {"--no-peephole", offsetof(CGenOptions, noPeephole), "Skip the peephole optimizer."},
+  {"--peephole-stats", offsetof(CGenOptions, peepholeStats),
+   "Report how often each peephole rule fired to stderr."},
+  {"--elf", offsetof(CGenOptions, elfObject), "Write an RV32 ELF object instead of assembly."},
+  {"--stats", offsetof(CGenOptions, stats), "Report time, memory and counts for each phase to stderr."},
+  {"--stats-json", offsetof(CGenOptions, statsJson), "The same report as JSON."},
+  {"--line-info", offsetof(CGenOptions, lineInfo), "Mark the code of each source line for 61csim --profile."},
+};
+
+#define CGEN_FLAG_TOTAL (sizeof(cgenFlags) / sizeof(cgenFlags[0]))
+
+static CGenOptions options;
+static int optionsParsed = 0;
+
+/*
+ *  Writes the flags CGENFLAGS may hold to out.
+ */
+static void PrintUsage(FILE* out) {
+  fprintf(out, "Usage: %s=\"flags\" ./61ccc -c file.61c\n", CGEN_FLAGS_VARIABLE);
+  fprintf(out, "61ccc only accepts its own arguments, so code generation is set through %s:\n",
+          CGEN_FLAGS_VARIABLE);
+  for (size_t i = 0; i < CGEN_FLAG_TOTAL; i++) {
+    fprintf(out, "  %-18s %s\n", cgenFlags[i].name, cgenFlags[i].help);
+  }
+  fprintf(out, "  %-18s %s\n", OUTPUT_FLAG " file", "Write the output to file instead of stdout.");
+  fprintf(out, "  %-18s %s\n", HELP_FLAG, "Print this message and exit.");
+}
+
+/*
+ *  Sets the option named by flag, exiting if there is none.
+ */
+static void ParseFlag(char* flag) {
+  for (size_t i = 0; i < CGEN_FLAG_TOTAL; i++) {
+    if (strcmp(cgenFlags[i].name, flag) == 0) {
+      *(int*) ((char*) &options + cgenFlags[i].field) = 1;
+      return;
+    }
+  }
+  if (strcmp(flag, HELP_FLAG) == 0) {
+    PrintUsage(stdout);
+    exit(0);
+  }
+  fprintf(stderr, "Error: Unknown flag %s in %s.\n", flag, CGEN_FLAGS_VARIABLE);
+  PrintUsage(stderr);
+  exit(1);
+}
+
+/*
+ *  Keeps a copy of the file named after -o, exiting if there is none.
+ */
+static void ParseOutputFile(char* file) {
+  if (file == NULL) {
+    fprintf(stderr, "Error: %s in %s needs a file name.\n", OUTPUT_FLAG, CGEN_FLAGS_VARIABLE);
+    exit(1);
+  }
+  free(options.outputFile);
+  options.outputFile = malloc(strlen(file) + 1);
+  if (options.outputFile == NULL) {
+    AllocationFailed();
+  }
+  strcpy(options.outputFile, file);
+}
+
+const CGenOptions* GetCGenOptions() {
+  if (!optionsParsed) {
+    char* value = getenv(CGEN_FLAGS_VARIABLE);
+    optionsParsed = 1;
+    if (value != NULL) {
+      size_t length = strlen(value);
+      char* copy = malloc(length + 1);
+      if (copy == NULL) {
+        AllocationFailed();
+      }
+      memcpy(copy, value, length + 1);
+      for (char* flag = strtok(copy, " \t"); flag != NULL; flag = strtok(NULL, " \t")) {
+        if (strcmp(flag, OUTPUT_FLAG) == 0) {
+          ParseOutputFile(strtok(NULL, " \t"));
+        } else {
+          ParseFlag(flag);
+        }
+      }
+      free(copy);
+    }
+  }
+  return &options;
+}
@@ -0,0 +1,49 @@
+/*
+ *  File that holds the options controlling code generation. The compiler
+ *  driver only accepts its own flags, so these are read from the CGENFLAGS
+ *  environment variable the first time they are needed. For example
+ *
+ *    CGENFLAGS="--register-args" ./61ccc -c file.61c
+ *
+ *  CGENFLAGS=--help lists every flag, and the README describes them.
+ */
+
+#ifndef CGEN_OPTIONS_H
+#define CGEN_OPTIONS_H
+
+#define CGEN_FLAGS_VARIABLE "CGENFLAGS"
+
+typedef struct cgenOptions {
+  int registerArgs;   /* Pass the first arguments in a0-a7.              */
+  int noPeephole;     /* Skip the peephole optimizer.                    */
+  int peepholeStats;  /* Report how often each peephole rule fired.      */
+  int elfObject;      /* Write an RV32 ELF object instead of assembly.   */
+  int stats;          /* Report time, memory and counts for each phase.  */
+  int statsJson;      /* The same report as JSON.                        */
+  int lineInfo;       /* Mark the code of each source line, see below.   */
+  char* outputFile;   /* Write the assembly here instead of stdout.      */
+} CGenOptions;
+
+/*
+ *  With --line-info the code generated from each line of the source is
+ *  preceded by a comment holding the file and line, in the format the
+ *  assembler reads into its line table (LINE_MARKER in rv-assembler.h), so
+ *  61csim can profile the program by source line. The comments only cover
+ *  code the backend generates itself. Statements the library generates
+ *  whole, like a return of a constant, count towards the line before them.
+ */
+
+/* Flag followed by the file to write the assembly to. */
+#define OUTPUT_FLAG "-o"
+
+/* Flag that prints the usage. */
+#define HELP_FLAG "--help"
+
+/*
+ *  Returns the options for this run, parsing CGENFLAGS on the first call.
+ *  Exits with an error if CGENFLAGS holds an unknown flag or -o without a
+ *  file.
+ */
+const CGenOptions* GetCGenOptions();
+
+#endif
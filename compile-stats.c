@@ -0,0 +1,217 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <time.h>
+#include "cgen-options.h"
+#include "compile-stats.h"
+#include "intern-pool.h"
+
+typedef struct phaseStats {
+  double wallStart;
+  double cpuStart;
+  int running;
+  double wall;
+  double cpu;
+  long peakRss;       /* In kilobytes, when the phase last ended.         */
+  size_t allocations;
+  size_t allocatedBytes;
+  size_t frees;
+} PhaseStats;
+
+static const char* phaseNames[PHASE_TOTAL] = {
+  [PHASE_TOKENIZE] = "tokenize",
+  [PHASE_PARSE] = "parse",
+  [PHASE_DECORATE] = "decorate",
+  [PHASE_FOLD] = "fold constants",
+  [PHASE_GENERATE] = "generate code",
+  [PHASE_CODEGEN] = "function bodies",
+  [PHASE_REGISTER_ALLOC] = "register allocation",
+  [PHASE_PEEPHOLE] = "peephole",
+  [PHASE_PRINT] = "printing",
+  [PHASE_STRING_POOL] = "string pooling",
+  [PHASE_OUTPUT] = "output",
+};
+
+static const char* counterNames[STAT_TOTAL] = {
+  [STAT_TOKENS] = "tokens",
+  [STAT_AST_NODES] = "ast nodes",
+  [STAT_DAST_NODES] = "dast nodes",
+  [STAT_FUNCTIONS] = "functions",
+  [STAT_DECLS] = "declarations",
+  [STAT_IR_PARSED] = "instructions parsed",
+  [STAT_IR_EMITTED] = "instructions emitted",
+  [STAT_LARGEST_BODY] = "largest body",
+  [STAT_INTERNED_STRINGS] = "strings interned",
+  [STAT_INTERNED_BYTES] = "interned bytes",
+  [STAT_STRINGS_MERGED] = "strings merged",
+  [STAT_OUTPUT_BYTES] = "output bytes",
+};
+
+static PhaseStats phases[PHASE_TOTAL];
+/* Every allocation, including those made outside of any phase. */
+static PhaseStats totals;
+/* Running phases, innermost last. A phase is never in it twice. */
+static enum statPhase running[PHASE_TOTAL];
+static int runningSize = 0;
+static size_t counters[STAT_TOTAL];
+
+static double ReadClock(clockid_t clock) {
+  struct timespec now;
+  clock_gettime(clock, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static long PeakRss() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+int StatsEnabled() {
+  return GetCGenOptions()->stats || GetCGenOptions()->statsJson;
+}
+
+static void StartClock(PhaseStats* stats) {
+  if (StatsEnabled()) {
+    stats->wallStart = ReadClock(CLOCK_MONOTONIC);
+    stats->cpuStart = ReadClock(CLOCK_PROCESS_CPUTIME_ID);
+  }
+}
+
+static void StopClock(PhaseStats* stats) {
+  if (StatsEnabled()) {
+    stats->wall += ReadClock(CLOCK_MONOTONIC) - stats->wallStart;
+    stats->cpu += ReadClock(CLOCK_PROCESS_CPUTIME_ID) - stats->cpuStart;
+  }
+}
+
+void BeginPhase(enum statPhase phase) {
+  if (phases[phase].running) {
+    return;
+  }
+  if (runningSize > 0) {
+    StopClock(&phases[running[runningSize - 1]]);
+  }
+  running[runningSize++] = phase;
+  phases[phase].running = 1;
+  StartClock(&phases[phase]);
+}
+
+void EndPhase(enum statPhase phase) {
+  PhaseStats* stats = &phases[phase];
+  int innermost;
+  int i = 0;
+  if (!stats->running) {
+    return;
+  }
+  /* Only the innermost phase has its clock running. */
+  innermost = running[runningSize - 1] == phase;
+  if (innermost) {
+    StopClock(stats);
+  }
+  while (running[i] != phase) {
+    i++;
+  }
+  for (runningSize--; i < runningSize; i++) {
+    running[i] = running[i + 1];
+  }
+  stats->running = 0;
+  if (StatsEnabled()) {
+    stats->peakRss = PeakRss();
+  }
+  if (innermost && runningSize > 0) {
+    StartClock(&phases[running[runningSize - 1]]);
+  }
+}
+
+void AddAllocation(size_t bytes) {
+  totals.allocations++;
+  totals.allocatedBytes += bytes;
+  if (runningSize > 0) {
+    phases[running[runningSize - 1]].allocations++;
+    phases[running[runningSize - 1]].allocatedBytes += bytes;
+  }
+}
+
+void AddFree() {
+  totals.frees++;
+  if (runningSize > 0) {
+    phases[running[runningSize - 1]].frees++;
+  }
+}
+
+void AddStat(enum statCounter counter, size_t amount) {
+  counters[counter] += amount;
+}
+
+void MaxStat(enum statCounter counter, size_t value) {
+  if (counters[counter] < value) {
+    counters[counter] = value;
+  }
+}
+
+static void PrintTextRow(FILE* out, const char* name, const PhaseStats* stats, long peakRss) {
+  fprintf(out, "%-20s %10.3f %10.3f %12ld %10zu %12zu %10zu\n", name, stats->wall * 1e3, stats->cpu * 1e3,
+          peakRss, stats->allocations, stats->allocatedBytes, stats->frees);
+}
+
+static void PrintText(FILE* out) {
+  fprintf(out, "%-20s %10s %10s %12s %10s %12s %10s\n", "phase", "wall ms", "cpu ms", "peak rss kb", "allocs",
+          "alloc bytes", "frees");
+  for (int i = 0; i < PHASE_TOTAL; i++) {
+    PrintTextRow(out, phaseNames[i], &phases[i], phases[i].peakRss);
+  }
+  PrintTextRow(out, "total", &totals, PeakRss());
+  for (int i = 0; i < STAT_TOTAL; i++) {
+    fprintf(out, "%-20s %10zu\n", counterNames[i], counters[i]);
+  }
+}
+
+static void PrintJsonObject(FILE* out, const PhaseStats* stats, long peakRss) {
+  fprintf(out, "{\"wallMs\": %.3f, \"cpuMs\": %.3f, \"peakRssKb\": %ld, \"allocations\": %zu, "
+          "\"allocatedBytes\": %zu, \"frees\": %zu}", stats->wall * 1e3, stats->cpu * 1e3, peakRss,
+          stats->allocations, stats->allocatedBytes, stats->frees);
+}
+
+/*
+ *  Writes the same as PrintText as a single JSON object.
+ */
+static void PrintJson(FILE* out) {
+  fprintf(out, "{\"phases\": {");
+  for (int i = 0; i < PHASE_TOTAL; i++) {
+    fprintf(out, "%s\"%s\": ", i ? ", " : "", phaseNames[i]);
+    PrintJsonObject(out, &phases[i], phases[i].peakRss);
+  }
+  fprintf(out, "}, \"total\": ");
+  PrintJsonObject(out, &totals, PeakRss());
+  fprintf(out, ", \"counters\": {");
+  for (int i = 0; i < STAT_TOTAL; i++) {
+    fprintf(out, "%s\"%s\": %zu", i ? ", " : "", counterNames[i], counters[i]);
+  }
+  fprintf(out, "}}\n");
+}
+
+void PrintCompileStats(FILE* out) {
+  totals.wall = ReadClock(CLOCK_MONOTONIC) - totals.wallStart;
+  totals.cpu = ReadClock(CLOCK_PROCESS_CPUTIME_ID) - totals.cpuStart;
+  while (runningSize > 0) {
+    EndPhase(running[runningSize - 1]);
+  }
+  InternPoolUsage(&counters[STAT_INTERNED_STRINGS], &counters[STAT_INTERNED_BYTES]);
+  if (GetCGenOptions()->stats) {
+    PrintText(out);
+  }
+  if (GetCGenOptions()->statsJson) {
+    PrintJson(out);
+  }
+}
+
+/*
+ *  Runs before main so the total covers the whole run.
+ */
+static void __attribute__((constructor)) StartCompileStats() {
+  totals.wallStart = ReadClock(CLOCK_MONOTONIC);
+  totals.cpuStart = ReadClock(CLOCK_PROCESS_CPUTIME_ID);
+}
@@ -0,0 +1,91 @@
+/*
+ *  File that holds the timing and counters reported with --stats or
+ *  --stats-json in CGENFLAGS. The compiler is split into phases, each timed
+ *  in wall and CPU time along with the peak resident set size when it last
+ *  ended, and counters record how much work each part of the compiler did.
+ *  For example
+ *
+ *    CGENFLAGS="--stats" ./61ccc -c file.61c
+ *
+ *  The front end runs in the prebuilt library. 61ccc is linked with
+ *  --wrap for its entry points and for malloc, calloc, realloc and free,
+ *  and the wrappers in stats-wraps.c time its phases and count what they
+ *  allocate. Phases run inside each other, such as constant folding during
+ *  decoration and the backend's phases during code generation. The time
+ *  and allocations of an inner phase are not counted in the outer one.
+ */
+
+#ifndef COMPILE_STATS_H
+#define COMPILE_STATS_H
+
+#include <stdio.h>
+
+enum statPhase {
+  PHASE_TOKENIZE,
+  PHASE_PARSE,
+  PHASE_DECORATE,
+  PHASE_FOLD,           /* Constant folding, called during decoration.    */
+  PHASE_GENERATE,       /* The library's code generation outside bodies.  */
+  PHASE_CODEGEN,        /* Generating and parsing function bodies.        */
+  PHASE_REGISTER_ALLOC,
+  PHASE_PEEPHOLE,
+  PHASE_PRINT,          /* Printing the optimized bodies.                 */
+  PHASE_STRING_POOL,
+  PHASE_OUTPUT,         /* Assembling and writing the output.             */
+  PHASE_TOTAL
+};
+
+enum statCounter {
+  STAT_TOKENS,
+  STAT_AST_NODES,
+  STAT_DAST_NODES,
+  STAT_FUNCTIONS,
+  STAT_DECLS,           /* Declarations in every scope after decoration.  */
+  STAT_IR_PARSED,       /* Instructions parsed from generated code.       */
+  STAT_IR_EMITTED,      /* Instructions left after every pass.            */
+  STAT_LARGEST_BODY,    /* Most instructions parsed for one function.     */
+  STAT_INTERNED_STRINGS,
+  STAT_INTERNED_BYTES,
+  STAT_STRINGS_MERGED,
+  STAT_OUTPUT_BYTES,
+  STAT_TOTAL
+};
+
+/*
+ *  Returns if statistics were asked for, in which case the functions below
+ *  record them. Otherwise they do nothing.
+ */
+int StatsEnabled();
+
+/*
+ *  Starts phase, pausing the phase it runs inside of.
+ */
+void BeginPhase(enum statPhase phase);
+
+/*
+ *  Ends phase, doing nothing if it is not running.
+ */
+void EndPhase(enum statPhase phase);
+
+/*
+ *  Counts an allocation of bytes, or a free, against the innermost running
+ *  phase. These are counted even without --stats, as they are called from
+ *  malloc and free, before the options may have been read.
+ */
+void AddAllocation(size_t bytes);
+
+void AddFree();
+
+void AddStat(enum statCounter counter, size_t amount);
+
+/*
+ *  Raises counter to value if it is lower.
+ */
+void MaxStat(enum statCounter counter, size_t value);
+
+/*
+ *  Writes everything recorded to out, in the format that was asked for.
+ */
+void PrintCompileStats(FILE* out);
+
+#endif
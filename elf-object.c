@@ -0,0 +1,278 @@
+#include <stdlib.h>
+#include <string.h>
+#include "elf-object.h"
+#include "utils.h"
+
+/* Values from the ELF specification and the RISC-V psABI. */
+#define ELF_HEADER_SIZE 52
+#define ELF_SECTION_HEADER_SIZE 40
+#define ELF_SYMBOL_SIZE 16
+#define ELF_RELA_SIZE 12
+#define ELFCLASS32 1
+#define ELFDATA2LSB 1
+#define EV_CURRENT 1
+#define ET_REL 1
+#define EM_RISCV 243
+#define SHT_PROGBITS 1
+#define SHT_SYMTAB 2
+#define SHT_STRTAB 3
+#define SHT_RELA 4
+#define SHF_WRITE 0x1
+#define SHF_ALLOC 0x2
+#define SHF_EXECINSTR 0x4
+#define SHF_INFO_LINK 0x40
+#define STB_LOCAL 0
+#define STB_GLOBAL 1
+#define STT_NOTYPE 0
+#define SHN_UNDEF 0
+
+/*
+ *  Sections of the object, in the order they are written. The code sections
+ *  and their relocations are in the order of enum objSection.
+ */
+enum elfSection {
+  SEC_NULL,
+  SEC_TEXT,
+  SEC_DATA,
+  SEC_RELA_TEXT,
+  SEC_RELA_DATA,
+  SEC_SYMTAB,
+  SEC_STRTAB,
+  SEC_SHSTRTAB,
+  SEC_TOTAL
+};
+
+#define CODE_SECTION(objSection) (SEC_TEXT + (objSection))
+#define RELA_SECTION(objSection) (SEC_RELA_TEXT + (objSection))
+
+static const char* elfSectionNames[SEC_TOTAL] = {
+  "", ".text", ".data", ".rela.text", ".rela.data", ".symtab", ".strtab", ".shstrtab"
+};
+
+typedef struct elfSectionHeader {
+  uint32_t name;
+  uint32_t type;
+  uint32_t flags;
+  uint32_t offset;
+  uint32_t size;
+  uint32_t link;
+  uint32_t info;
+  uint32_t align;
+  uint32_t entsize;
+} ElfSectionHeader;
+
+/*
+ *  Bytes of the file being built. Every value is stored little endian,
+ *  whatever the host.
+ */
+typedef struct elfBuffer {
+  uint8_t* bytes;
+  size_t size;
+  size_t capacity;
+} ElfBuffer;
+
+static void PutBytes(ElfBuffer* buffer, const void* bytes, size_t total) {
+  if (buffer->size + total > buffer->capacity) {
+    size_t capacity = buffer->capacity ? buffer->capacity : INITIAL_CAPACITY;
+    while (buffer->size + total > capacity) {
+      capacity *= 2;
+    }
+    buffer->bytes = realloc(buffer->bytes, capacity);
+    if (buffer->bytes == NULL) {
+      AllocationFailed();
+    }
+    buffer->capacity = capacity;
+  }
+  if (total != 0) {
+    memcpy(buffer->bytes + buffer->size, bytes, total);
+  }
+  buffer->size += total;
+}
+
+static void PutValue(ElfBuffer* buffer, uint32_t value, size_t size) {
+  uint8_t bytes[4];
+  for (size_t i = 0; i < size; i++) {
+    bytes[i] = (uint8_t) (value >> (8 * i));
+  }
+  PutBytes(buffer, bytes, size);
+}
+
+static void PutHalf(ElfBuffer* buffer, uint32_t value) {
+  PutValue(buffer, value, 2);
+}
+
+static void PutWord(ElfBuffer* buffer, uint32_t value) {
+  PutValue(buffer, value, 4);
+}
+
+static void PutAlign(ElfBuffer* buffer, size_t alignment) {
+  while (buffer->size % alignment != 0) {
+    PutValue(buffer, 0, 1);
+  }
+}
+
+/*
+ *  Appends str and its terminator to a string table and returns its offset.
+ */
+static uint32_t PutString(ElfBuffer* table, const char* str) {
+  uint32_t offset = (uint32_t) table->size;
+  PutBytes(table, str, strlen(str) + 1);
+  return offset;
+}
+
+/*
+ *  Starts a section at the end of file, aligned to alignment.
+ */
+static void BeginSection(ElfBuffer* file, ElfSectionHeader* header, uint32_t type, uint32_t flags,
+                         uint32_t alignment) {
+  PutAlign(file, alignment);
+  header->type = type;
+  header->flags = flags;
+  header->align = alignment;
+  header->offset = (uint32_t) file->size;
+}
+
+static void EndSection(ElfBuffer* file, ElfSectionHeader* header) {
+  header->size = (uint32_t) file->size - header->offset;
+}
+
+static void PutSymbol(ElfBuffer* file, const ObjSymbol* symbol, uint32_t name) {
+  PutWord(file, name);
+  PutWord(file, symbol->defined ? symbol->offset : 0);
+  PutWord(file, 0);
+  PutValue(file, (symbol->global ? STB_GLOBAL : STB_LOCAL) << 4 | STT_NOTYPE, 1);
+  PutValue(file, 0, 1);
+  PutHalf(file, symbol->defined ? (uint32_t) CODE_SECTION(symbol->section) : SHN_UNDEF);
+}
+
+static void PutElfHeader(ElfBuffer* file, uint32_t sectionHeaders) {
+  static const uint8_t ident[16] = {0x7f, 'E', 'L', 'F', ELFCLASS32, ELFDATA2LSB, EV_CURRENT};
+  PutBytes(file, ident, sizeof(ident));
+  PutHalf(file, ET_REL);
+  PutHalf(file, EM_RISCV);
+  PutWord(file, EV_CURRENT);
+  PutWord(file, 0);                   /* Entry point                    */
+  PutWord(file, 0);                   /* Program headers                */
+  PutWord(file, sectionHeaders);
+  PutWord(file, 0);                   /* Flags, soft float              */
+  PutHalf(file, ELF_HEADER_SIZE);
+  PutHalf(file, 0);                   /* Program header size            */
+  PutHalf(file, 0);                   /* Program header total           */
+  PutHalf(file, ELF_SECTION_HEADER_SIZE);
+  PutHalf(file, SEC_TOTAL);
+  PutHalf(file, SEC_SHSTRTAB);
+}
+
+int WriteElfObject(const ObjectCode* code, FILE* out) {
+  ElfBuffer file = {0};
+  ElfBuffer strtab = {0};
+  ElfBuffer shstrtab = {0};
+  ElfSectionHeader headers[SEC_TOTAL] = {{0}};
+  uint32_t* elfIndex = malloc(sizeof(uint32_t) * (code->symbolSize + 1));
+  uint32_t* nameOffset = malloc(sizeof(uint32_t) * (code->symbolSize + 1));
+  uint32_t symbolTotal = 1;
+  uint32_t sectionHeaders;
+  int written;
+  if (elfIndex == NULL || nameOffset == NULL) {
+    AllocationFailed();
+  }
+
+  /* ELF wants every local symbol before the first global one. */
+  for (int global = 0; global <= 1; global++) {
+    for (size_t i = 0; i < code->symbolSize; i++) {
+      if (code->symbols[i].global == global) {
+        elfIndex[i] = symbolTotal++;
+      }
+    }
+  }
+  PutString(&strtab, "");
+  for (size_t i = 0; i < code->symbolSize; i++) {
+    nameOffset[i] = PutString(&strtab, code->symbols[i].name);
+  }
+  for (int i = 0; i < SEC_TOTAL; i++) {
+    headers[i].name = PutString(&shstrtab, elfSectionNames[i]);
+  }
+
+  /* Room for the header, filled in once the section headers are placed. */
+  for (int i = 0; i < ELF_HEADER_SIZE; i++) {
+    PutValue(&file, 0, 1);
+  }
+
+  for (int i = 0; i < OBJ_SECTION_TOTAL; i++) {
+    const ObjSectionData* section = &code->sections[i];
+    ElfSectionHeader* header = &headers[CODE_SECTION(i)];
+    BeginSection(&file, header, SHT_PROGBITS, SHF_ALLOC | (i == OBJ_TEXT ? SHF_EXECINSTR : SHF_WRITE), 4);
+    PutBytes(&file, section->bytes, section->size);
+    EndSection(&file, header);
+  }
+  for (int i = 0; i < OBJ_SECTION_TOTAL; i++) {
+    const ObjSectionData* section = &code->sections[i];
+    ElfSectionHeader* header = &headers[RELA_SECTION(i)];
+    BeginSection(&file, header, SHT_RELA, SHF_INFO_LINK, 4);
+    for (size_t j = 0; j < section->relocSize; j++) {
+      PutWord(&file, section->relocs[j].offset);
+      PutWord(&file, elfIndex[section->relocs[j].symbol] << 8 | section->relocs[j].type);
+      PutWord(&file, 0);              /* Addend                         */
+    }
+    EndSection(&file, header);
+    header->link = SEC_SYMTAB;
+    header->info = CODE_SECTION(i);
+    header->entsize = ELF_RELA_SIZE;
+  }
+
+  BeginSection(&file, &headers[SEC_SYMTAB], SHT_SYMTAB, 0, 4);
+  for (int i = 0; i < ELF_SYMBOL_SIZE; i++) {
+    PutValue(&file, 0, 1);
+  }
+  for (int global = 0; global <= 1; global++) {
+    for (size_t i = 0; i < code->symbolSize; i++) {
+      if (code->symbols[i].global == global) {
+        PutSymbol(&file, &code->symbols[i], nameOffset[i]);
+      }
+    }
+  }
+  EndSection(&file, &headers[SEC_SYMTAB]);
+  headers[SEC_SYMTAB].link = SEC_STRTAB;
+  headers[SEC_SYMTAB].entsize = ELF_SYMBOL_SIZE;
+  headers[SEC_SYMTAB].info = 1;
+  for (size_t i = 0; i < code->symbolSize; i++) {
+    headers[SEC_SYMTAB].info += !code->symbols[i].global;
+  }
+
+  BeginSection(&file, &headers[SEC_STRTAB], SHT_STRTAB, 0, 1);
+  PutBytes(&file, strtab.bytes, strtab.size);
+  EndSection(&file, &headers[SEC_STRTAB]);
+  BeginSection(&file, &headers[SEC_SHSTRTAB], SHT_STRTAB, 0, 1);
+  PutBytes(&file, shstrtab.bytes, shstrtab.size);
+  EndSection(&file, &headers[SEC_SHSTRTAB]);
+
+  PutAlign(&file, 4);
+  sectionHeaders = (uint32_t) file.size;
+  for (int i = 0; i < SEC_TOTAL; i++) {
+    ElfSectionHeader* header = &headers[i];
+    PutWord(&file, header->name);
+    PutWord(&file, header->type);
+    PutWord(&file, header->flags);
+    PutWord(&file, 0);                /* Address                        */
+    PutWord(&file, header->offset);
+    PutWord(&file, header->size);
+    PutWord(&file, header->link);
+    PutWord(&file, header->info);
+    PutWord(&file, header->align);
+    PutWord(&file, header->entsize);
+  }
+
+  /* Writes the header over the space left for it at the start. */
+  size_t end = file.size;
+  file.size = 0;
+  PutElfHeader(&file, sectionHeaders);
+  file.size = end;
+
+  written = fwrite(file.bytes, 1, file.size, out) == file.size;
+  free(file.bytes);
+  free(strtab.bytes);
+  free(shstrtab.bytes);
+  free(elfIndex);
+  free(nameOffset);
+  return written;
+}
@@ -0,0 +1,20 @@
+/*
+ *  File that holds the writer for relocatable RV32 ELF objects. It lays out
+ *  the sections, symbols and relocations of assembled code the way a linker
+ *  expects to find them, so the compiler output can be linked with the
+ *  cgen-lib objects instead of being pasted together as text.
+ */
+
+#ifndef ELF_OBJECT_H
+#define ELF_OBJECT_H
+
+#include <stdio.h>
+#include "rv-assembler.h"
+
+/*
+ *  Writes code to out as an ELF object and returns whether every byte was
+ *  written.
+ */
+int WriteElfObject(const ObjectCode* code, FILE* out);
+
+#endif
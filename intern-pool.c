@@ -0,0 +1,101 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "intern-pool.h"
+#include "utils.h"
+
+/* Strings are packed into blocks of at least this many bytes. */
+#define POOL_BLOCK_SIZE 4096
+
+typedef struct poolBlock {
+  struct poolBlock* next;
+  size_t used;
+  size_t size;
+  char bytes[];
+} PoolBlock;
+
+static PoolBlock* blocks = NULL;
+
+/* Open addressed table of the pooled strings, at most half full. */
+static char** table = NULL;
+static size_t tableSize = 0;
+static size_t stringTotal = 0;
+static size_t byteTotal = 0;
+
+static uint32_t HashString(const char* str) {
+  uint32_t hash = 2166136261u;
+  for (; *str != '\0'; str++) {
+    hash = (hash ^ (uint8_t) *str) * 16777619u;
+  }
+  return hash;
+}
+
+/*
+ *  Returns the slot holding str, or the empty slot it belongs in.
+ */
+static size_t FindSlot(const char* str, uint32_t hash) {
+  size_t slot = hash & (tableSize - 1);
+  while (table[slot] != NULL && strcmp(table[slot], str) != 0) {
+    slot = (slot + 1) & (tableSize - 1);
+  }
+  return slot;
+}
+
+static void GrowTable() {
+  char** oldTable = table;
+  size_t oldSize = tableSize;
+  tableSize = tableSize ? tableSize * 2 : INITIAL_CAPACITY * 32;
+  table = calloc(tableSize, sizeof(char*));
+  if (table == NULL) {
+    AllocationFailed();
+  }
+  for (size_t i = 0; i < oldSize; i++) {
+    if (oldTable[i] != NULL) {
+      table[FindSlot(oldTable[i], HashString(oldTable[i]))] = oldTable[i];
+    }
+  }
+  free(oldTable);
+}
+
+/*
+ *  Copies bytes bytes of str into the current block, starting a new one if
+ *  it does not fit.
+ */
+static char* PoolCopy(const char* str, size_t bytes) {
+  if (blocks == NULL || blocks->size - blocks->used < bytes) {
+    size_t size = bytes > POOL_BLOCK_SIZE ? bytes : POOL_BLOCK_SIZE;
+    PoolBlock* block = malloc(sizeof(PoolBlock) + size);
+    if (block == NULL) {
+      AllocationFailed();
+    }
+    block->next = blocks;
+    block->used = 0;
+    block->size = size;
+    blocks = block;
+  }
+  char* copy = blocks->bytes + blocks->used;
+  memcpy(copy, str, bytes);
+  blocks->used += bytes;
+  return copy;
+}
+
+char* InternString(const char* str) {
+  uint32_t hash = HashString(str);
+  size_t slot;
+  if (2 * (stringTotal + 1) > tableSize) {
+    GrowTable();
+  }
+  slot = FindSlot(str, hash);
+  if (table[slot] == NULL) {
+    size_t bytes = strlen(str) + 1;
+    table[slot] = PoolCopy(str, bytes);
+    stringTotal++;
+    byteTotal += bytes;
+  }
+  return table[slot];
+}
+
+void InternPoolUsage(size_t* strings, size_t* bytes) {
+  *strings = stringTotal;
+  *bytes = byteTotal;
+}
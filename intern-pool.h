@@ -0,0 +1,25 @@
+/*
+ *  File that holds the pool of interned strings. Each distinct string is
+ *  stored once, packed into large blocks that live until the compiler exits,
+ *  so equal strings share a pointer and can be compared with ==. The IR
+ *  keeps every label and comment here instead of in its own allocations.
+ */
+
+#ifndef INTERN_POOL_H
+#define INTERN_POOL_H
+
+#include <stddef.h>
+
+/*
+ *  Returns the pooled copy of str, the same pointer for every equal string.
+ *  The result must not be changed or freed.
+ */
+char* InternString(const char* str);
+
+/*
+ *  Stores how many strings are pooled and the bytes they take up, counting
+ *  their terminators.
+ */
+void InternPoolUsage(size_t* strings, size_t* bytes);
+
+#endif
@@ -0,0 +1,659 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "asm-output.h"
+#include "decorate-builtins.h"
+#include "intern-pool.h"
+#include "linear-ir.h"
+#include "utils.h"
+
+/* Prefix of the comment EmitCallArgs uses to annotate the following call. */
+#define CALL_ARGS_MARKER "#!args "
+
+const IROpInfo irOps[] = {
+  [IR_LABEL] = {"", FMT_NONE},
+  [IR_COMMENT] = {"#", FMT_NONE},
+  [IR_RAW] = {"", FMT_NONE},
+  [IR_DELETED] = {"", FMT_NONE},
+  [IR_ADD] = {"add", FMT_R},
+  [IR_SUB] = {"sub", FMT_R},
+  [IR_MUL] = {"mul", FMT_R},
+  [IR_MULH] = {"mulh", FMT_R},
+  [IR_DIV] = {"div", FMT_R},
+  [IR_DIVU] = {"divu", FMT_R},
+  [IR_REM] = {"rem", FMT_R},
+  [IR_REMU] = {"remu", FMT_R},
+  [IR_SLL] = {"sll", FMT_R},
+  [IR_SRL] = {"srl", FMT_R},
+  [IR_SRA] = {"sra", FMT_R},
+  [IR_AND] = {"and", FMT_R},
+  [IR_OR] = {"or", FMT_R},
+  [IR_XOR] = {"xor", FMT_R},
+  [IR_SLT] = {"slt", FMT_R},
+  [IR_SLTU] = {"sltu", FMT_R},
+  [IR_ADDI] = {"addi", FMT_I},
+  [IR_SLLI] = {"slli", FMT_I},
+  [IR_SRLI] = {"srli", FMT_I},
+  [IR_SRAI] = {"srai", FMT_I},
+  [IR_ANDI] = {"andi", FMT_I},
+  [IR_ORI] = {"ori", FMT_I},
+  [IR_XORI] = {"xori", FMT_I},
+  [IR_SLTI] = {"slti", FMT_I},
+  [IR_SLTIU] = {"sltiu", FMT_I},
+  [IR_MV] = {"mv", FMT_U},
+  [IR_SEQZ] = {"seqz", FMT_U},
+  [IR_SNEZ] = {"snez", FMT_U},
+  [IR_LI] = {"li", FMT_LI},
+  [IR_LA] = {"la", FMT_LA},
+  [IR_LW] = {"lw", FMT_LOAD},
+  [IR_LB] = {"lb", FMT_LOAD},
+  [IR_LBU] = {"lbu", FMT_LOAD},
+  [IR_SW] = {"sw", FMT_STORE},
+  [IR_SB] = {"sb", FMT_STORE},
+  [IR_BEQ] = {"beq", FMT_BRANCH},
+  [IR_BNE] = {"bne", FMT_BRANCH},
+  [IR_BLT] = {"blt", FMT_BRANCH},
+  [IR_BGE] = {"bge", FMT_BRANCH},
+  [IR_BLTU] = {"bltu", FMT_BRANCH},
+  [IR_BGEU] = {"bgeu", FMT_BRANCH},
+  [IR_BEQZ] = {"beqz", FMT_BRANCHZ},
+  [IR_BNEZ] = {"bnez", FMT_BRANCHZ},
+  [IR_J] = {"j", FMT_J},
+  [IR_JAL] = {"jal", FMT_JAL},
+  [IR_JR] = {"jr", FMT_JR},
+  [IR_ECALL] = {"ecall", FMT_NONE},
+  [IR_EBREAK] = {"ebreak", FMT_NONE},
+};
+
+/* State for the function body currently being collected. */
+static FILE* savedStdout = NULL;
+static FILE* captureStream = NULL;
+static char* captureBuffer = NULL;
+static size_t captureSize = 0;
+
+void BeginFunctionIR() {
+  fflush(stdout);
+  captureStream = open_memstream(&captureBuffer, &captureSize);
+  if (captureStream == NULL) {
+    AllocationFailed();
+  }
+  savedStdout = stdout;
+  stdout = captureStream;
+}
+
+void EmitCallArgs(int argBytes, int argRegs) {
+  printf(CALL_ARGS_MARKER "%d %d\n", argBytes, argRegs);
+}
+
+void AppendIR(IRList* list, IRInstr instr) {
+  if (list->size == list->capacity) {
+    list->capacity = list->capacity ? list->capacity * 2 : INITIAL_CAPACITY;
+    list->instrs = realloc(list->instrs, sizeof(IRInstr) * list->capacity);
+    if (list->instrs == NULL) {
+      AllocationFailed();
+    }
+  }
+  list->instrs[list->size++] = instr;
+}
+
+void InsertIR(IRList* list, size_t index, IRInstr instr) {
+  AppendIR(list, instr);
+  memmove(&list->instrs[index + 1], &list->instrs[index], sizeof(IRInstr) * (list->size - 1 - index));
+  list->instrs[index] = instr;
+}
+
+void CompactIR(IRList* list) {
+  size_t kept = 0;
+  for (size_t i = 0; i < list->size; i++) {
+    if (list->instrs[i].op != IR_DELETED) {
+      list->instrs[kept++] = list->instrs[i];
+    }
+  }
+  list->size = kept;
+}
+
+int NewVirtualReg(IRList* list) {
+  return REG_TOTAL + list->vregTotal++;
+}
+
+/*
+ *  Returns the register named by token or NO_REG if it is not a register.
+ */
+static int ParseReg(char* token) {
+  for (int i = 0; i < A0; i++) {
+    if (strcmp(regNames[i], token) == 0) {
+      return i;
+    }
+  }
+  for (int i = 0; i < ARG_REG_TOTAL; i++) {
+    if (strcmp(argRegNames[i], token) == 0) {
+      return A0 + i;
+    }
+  }
+  return NO_REG;
+}
+
+/*
+ *  Parses a decimal integer, returning 0 if token is not one.
+ */
+static int ParseImm(char* token, int* imm) {
+  char* end;
+  long value = strtol(token, &end, 10);
+  if (end == token || *end != '\0') {
+    return 0;
+  }
+  *imm = (int) value;
+  return 1;
+}
+
+/*
+ *  Parses an operand of the form imm(reg).
+ */
+static int ParseAddress(char* token, int* imm, int* reg) {
+  char* open = strchr(token, '(');
+  size_t length = strlen(token);
+  if (open == NULL || token[length - 1] != ')') {
+    return 0;
+  }
+  *open = '\0';
+  token[length - 1] = '\0';
+  *reg = ParseReg(open + 1);
+  return ParseImm(token, imm) && *reg != NO_REG;
+}
+
+/*
+ *  Fills in instr from the whitespace separated tokens of one instruction.
+ *  Returns 0 if the tokens do not match any operation we know.
+ */
+static int ParseInstr(char** tokens, int total, IRInstr* instr) {
+  int op;
+  for (op = IR_ADD; op < IR_OP_TOTAL; op++) {
+    if (strcmp(irOps[op].name, tokens[0]) == 0) {
+      break;
+    }
+  }
+  if (op == IR_OP_TOTAL) {
+    return 0;
+  }
+  instr->op = op;
+  switch (irOps[op].format) {
+    case FMT_R:
+      if (total != 4) return 0;
+      instr->rd = ParseReg(tokens[1]);
+      instr->rs1 = ParseReg(tokens[2]);
+      instr->rs2 = ParseReg(tokens[3]);
+      return instr->rd != NO_REG && instr->rs1 != NO_REG && instr->rs2 != NO_REG;
+    case FMT_I:
+      if (total != 4) return 0;
+      instr->rd = ParseReg(tokens[1]);
+      instr->rs1 = ParseReg(tokens[2]);
+      return instr->rd != NO_REG && instr->rs1 != NO_REG && ParseImm(tokens[3], &instr->imm);
+    case FMT_U:
+      if (total != 3) return 0;
+      instr->rd = ParseReg(tokens[1]);
+      instr->rs1 = ParseReg(tokens[2]);
+      return instr->rd != NO_REG && instr->rs1 != NO_REG;
+    case FMT_LI:
+      if (total != 3) return 0;
+      instr->rd = ParseReg(tokens[1]);
+      return instr->rd != NO_REG && ParseImm(tokens[2], &instr->imm);
+    case FMT_LA:
+      if (total != 3) return 0;
+      instr->rd = ParseReg(tokens[1]);
+      instr->label = InternString(tokens[2]);
+      return instr->rd != NO_REG;
+    case FMT_LOAD:
+      if (total != 3) return 0;
+      instr->rd = ParseReg(tokens[1]);
+      return instr->rd != NO_REG && ParseAddress(tokens[2], &instr->imm, &instr->rs1);
+    case FMT_STORE:
+      if (total != 3) return 0;
+      instr->rs2 = ParseReg(tokens[1]);
+      return instr->rs2 != NO_REG && ParseAddress(tokens[2], &instr->imm, &instr->rs1);
+    case FMT_BRANCH:
+      if (total != 4) return 0;
+      instr->rs1 = ParseReg(tokens[1]);
+      instr->rs2 = ParseReg(tokens[2]);
+      instr->label = InternString(tokens[3]);
+      return instr->rs1 != NO_REG && instr->rs2 != NO_REG;
+    case FMT_BRANCHZ:
+      if (total != 3) return 0;
+      instr->rs1 = ParseReg(tokens[1]);
+      instr->label = InternString(tokens[2]);
+      return instr->rs1 != NO_REG;
+    case FMT_J:
+      if (total != 2) return 0;
+      instr->label = InternString(tokens[1]);
+      return 1;
+    case FMT_JAL:
+      if (total != 3) return 0;
+      instr->rd = ParseReg(tokens[1]);
+      instr->label = InternString(tokens[2]);
+      return instr->rd != NO_REG;
+    case FMT_JR:
+      if (total != 2) return 0;
+      instr->rs1 = ParseReg(tokens[1]);
+      return instr->rs1 != NO_REG;
+    case FMT_NONE:
+      return total == 1;
+  }
+  return 0;
+}
+
+/*
+ *  Parses a single line of emitted assembly and appends it to the list.
+ *  pendingCall holds the arguments EmitCallArgs gave for the next call.
+ */
+static void ParseLine(IRList* list, char* line, IRInstr* pendingCall) {
+  IRInstr instr = {IR_RAW, NO_REG, NO_REG, NO_REG, 0, NULL, -1, 0};
+  size_t length = strlen(line);
+  char* tokens[4];
+  int total = 0;
+
+  if (length == 0) {
+    return;
+  }
+  if (strncmp(line, CALL_ARGS_MARKER, strlen(CALL_ARGS_MARKER)) == 0) {
+    sscanf(line + strlen(CALL_ARGS_MARKER), "%d %d", &pendingCall->argBytes, &pendingCall->argRegs);
+    return;
+  }
+  if (line[0] == '#') {
+    instr.op = IR_COMMENT;
+    instr.label = InternString(line[1] == ' ' ? line + 2 : line + 1);
+    AppendIR(list, instr);
+    return;
+  }
+  if (line[length - 1] == ':' && strchr(line, ' ') == NULL) {
+    line[length - 1] = '\0';
+    instr.op = IR_LABEL;
+    instr.label = InternString(line);
+    AppendIR(list, instr);
+    return;
+  }
+
+  /* Tokenizing writes into the line, which is still needed for IR_RAW. */
+  char buffer[DEFAULT_BUFFERSIZE];
+  char* copy = length < sizeof(buffer) ? buffer : malloc(length + 1);
+  if (copy == NULL) {
+    AllocationFailed();
+  }
+  memcpy(copy, line, length + 1);
+  for (char* token = strtok(copy, " \t"); token != NULL; token = strtok(NULL, " \t")) {
+    if (total == 4) {
+      total++;
+      break;
+    }
+    tokens[total++] = token;
+  }
+  if (total == 0 || total > 4 || !ParseInstr(tokens, total, &instr)) {
+    instr = (IRInstr) {IR_RAW, NO_REG, NO_REG, NO_REG, 0, InternString(line), -1, 0};
+  } else if (instr.op == IR_JAL) {
+    instr.argBytes = pendingCall->argBytes;
+    instr.argRegs = pendingCall->argRegs;
+    pendingCall->argBytes = -1;
+    pendingCall->argRegs = 0;
+  }
+  if (copy != buffer) {
+    free(copy);
+  }
+  AppendIR(list, instr);
+}
+
+IRList* EndFunctionIR() {
+  IRList* list = calloc(1, sizeof(IRList));
+  IRInstr pendingCall = {IR_JAL, NO_REG, NO_REG, NO_REG, 0, NULL, -1, 0};
+  if (list == NULL) {
+    AllocationFailed();
+  }
+  fflush(captureStream);
+  stdout = savedStdout;
+  fclose(captureStream);
+  captureStream = NULL;
+
+  char* line = captureBuffer;
+  while (line != NULL && *line != '\0') {
+    char* next = strchr(line, '\n');
+    if (next != NULL) {
+      *next++ = '\0';
+    }
+    ParseLine(list, line, &pendingCall);
+    line = next;
+  }
+  free(captureBuffer);
+  captureBuffer = NULL;
+  return list;
+}
+
+/*
+ *  Returns the name of a register. Virtual registers should never reach the
+ *  output but are printed recognizably to ease debugging.
+ */
+static const char* RegName(int reg) {
+  static char buffer[16];
+  if (reg >= 0 && reg < A0) {
+    return regNames[reg];
+  } else if (reg >= A0 && reg < REG_TOTAL) {
+    return argRegNames[reg - A0];
+  }
+  snprintf(buffer, sizeof(buffer), "v%d", reg - REG_TOTAL);
+  return buffer;
+}
+
+/*
+ *  Writes a space and then the name of reg.
+ */
+static void WriteReg(int reg) {
+  WriteAsmChar(' ');
+  WriteAsmString(RegName(reg));
+}
+
+/*
+ *  Writes a space and then text.
+ */
+static void WriteWord(const char* text) {
+  WriteAsmChar(' ');
+  WriteAsmString(text);
+}
+
+static void WriteImm(int imm) {
+  WriteAsmChar(' ');
+  WriteAsmInt(imm);
+}
+
+/*
+ *  Writes the imm(reg) operand of a load or store.
+ */
+static void WriteAddress(int imm, int reg) {
+  WriteImm(imm);
+  WriteAsmChar('(');
+  WriteAsmString(RegName(reg));
+  WriteAsmChar(')');
+}
+
+void PrintIR(IRList* list) {
+  for (size_t i = 0; i < list->size; i++) {
+    IRInstr* instr = &list->instrs[i];
+    switch (instr->op) {
+      case IR_LABEL:
+        WriteAsmString(instr->label);
+        WriteAsmString(":\n");
+        continue;
+      case IR_COMMENT:
+        WriteAsmString("# ");
+        WriteAsmString(instr->label);
+        WriteAsmChar('\n');
+        continue;
+      case IR_RAW:
+        WriteAsmString(instr->label);
+        WriteAsmChar('\n');
+        continue;
+      case IR_DELETED:
+        continue;
+      default:
+        break;
+    }
+    WriteAsmString(irOps[instr->op].name);
+    switch (irOps[instr->op].format) {
+      case FMT_R:
+        WriteReg(instr->rd);
+        WriteReg(instr->rs1);
+        WriteReg(instr->rs2);
+        break;
+      case FMT_I:
+        WriteReg(instr->rd);
+        WriteReg(instr->rs1);
+        WriteImm(instr->imm);
+        break;
+      case FMT_U:
+        WriteReg(instr->rd);
+        WriteReg(instr->rs1);
+        break;
+      case FMT_LI:
+        WriteReg(instr->rd);
+        WriteImm(instr->imm);
+        break;
+      case FMT_LA:
+      case FMT_JAL:
+        WriteReg(instr->rd);
+        WriteWord(instr->label);
+        break;
+      case FMT_LOAD:
+        WriteReg(instr->rd);
+        WriteAddress(instr->imm, instr->rs1);
+        break;
+      case FMT_STORE:
+        WriteReg(instr->rs2);
+        WriteAddress(instr->imm, instr->rs1);
+        break;
+      case FMT_BRANCH:
+        WriteReg(instr->rs1);
+        WriteReg(instr->rs2);
+        WriteWord(instr->label);
+        break;
+      case FMT_BRANCHZ:
+        WriteReg(instr->rs1);
+        WriteWord(instr->label);
+        break;
+      case FMT_J:
+        WriteWord(instr->label);
+        break;
+      case FMT_JR:
+        WriteReg(instr->rs1);
+        break;
+      case FMT_NONE:
+        break;
+    }
+    WriteAsmChar('\n');
+  }
+}
+
+void FreeIR(IRList* list) {
+  free(list->instrs);
+  free(list);
+}
+
+int IRUses(IRInstr* instr, int* regs) {
+  int total = 0;
+  switch (irOps[instr->op].format) {
+    case FMT_R:
+    case FMT_STORE:
+    case FMT_BRANCH:
+      regs[total++] = instr->rs1;
+      regs[total++] = instr->rs2;
+      break;
+    case FMT_I:
+    case FMT_U:
+    case FMT_LOAD:
+    case FMT_BRANCHZ:
+    case FMT_JR:
+      regs[total++] = instr->rs1;
+      break;
+    case FMT_JAL:
+      regs[total++] = SP;
+      for (int i = 0; i < instr->argRegs; i++) {
+        regs[total++] = A0 + i;
+      }
+      break;
+    case FMT_NONE:
+      if (instr->op == IR_ECALL) {
+        regs[total++] = A0;
+        regs[total++] = A1;
+      }
+      break;
+    default:
+      break;
+  }
+  /* Reading x0 never depends on another instruction. */
+  int kept = 0;
+  for (int i = 0; i < total; i++) {
+    if (regs[i] != X0) {
+      regs[kept++] = regs[i];
+    }
+  }
+  return kept;
+}
+
+int IRDefs(IRInstr* instr, int* regs) {
+  int total = 0;
+  switch (irOps[instr->op].format) {
+    case FMT_R:
+    case FMT_I:
+    case FMT_U:
+    case FMT_LI:
+    case FMT_LA:
+    case FMT_LOAD:
+      if (instr->rd != X0) {
+        regs[total++] = instr->rd;
+      }
+      break;
+    case FMT_JAL: {
+      static const int clobbered[] = {T0, T1, T2, T3, T4, T5};
+      if (instr->rd != X0) {
+        regs[total++] = instr->rd;
+      }
+      for (size_t i = 0; i < sizeof(clobbered) / sizeof(clobbered[0]); i++) {
+        regs[total++] = clobbered[i];
+      }
+      for (int i = 0; i < ARG_REG_TOTAL; i++) {
+        regs[total++] = A0 + i;
+      }
+      break;
+    }
+    case FMT_NONE:
+      if (instr->op == IR_ECALL) {
+        regs[total++] = A0;
+      }
+      break;
+    default:
+      break;
+  }
+  return total;
+}
+
+/*
+ *  Returns the block starting with label, or OUTSIDE_BLOCK if there is none.
+ */
+static int FindLabelBlock(IRList* list, IRBlock* blocks, int blockTotal, char* label) {
+  for (int b = 0; b < blockTotal; b++) {
+    IRInstr* first = &list->instrs[blocks[b].start];
+    if (first->op == IR_LABEL && first->label == label) {
+      return b;
+    }
+  }
+  return OUTSIDE_BLOCK;
+}
+
+IRBlock* BuildIRBlocks(IRList* list, int* blockTotal) {
+  IRBlock* blocks = malloc(sizeof(IRBlock) * (list->size ? list->size : 1));
+  int total = 0;
+  if (blocks == NULL) {
+    AllocationFailed();
+  }
+  for (size_t i = 0; i < list->size; i++) {
+    int leader = i == 0 || list->instrs[i].op == IR_LABEL;
+    if (i > 0) {
+      IRInstr* prev = &list->instrs[i - 1];
+      leader = leader || IsLabelJump(prev) || prev->op == IR_JR;
+    }
+    if (leader) {
+      if (total > 0) {
+        blocks[total - 1].end = i;
+      }
+      blocks[total].start = i;
+      total++;
+    }
+  }
+  if (total > 0) {
+    blocks[total - 1].end = list->size;
+  }
+  for (int b = 0; b < total; b++) {
+    IRInstr* last = &list->instrs[blocks[b].end - 1];
+    blocks[b].succ[0] = b + 1 < total ? b + 1 : -1;
+    blocks[b].succ[1] = -1;
+    if (IsLabelJump(last)) {
+      int target = FindLabelBlock(list, blocks, total, last->label);
+      if (last->op == IR_J) {
+        blocks[b].succ[0] = target;
+      } else {
+        blocks[b].succ[1] = target;
+      }
+    } else if (last->op == IR_JR) {
+      blocks[b].succ[0] = -1;
+    }
+  }
+  *blockTotal = total;
+  return blocks;
+}
+
+size_t CountIRInstrs(IRList* list) {
+  size_t total = 0;
+  for (size_t i = 0; i < list->size; i++) {
+    total += list->instrs[i].op >= IR_ADD;
+  }
+  return total;
+}
+
+uint32_t WrittenRegisters(IRList* list) {
+  uint32_t written = 0;
+  int regs[16];
+  for (size_t i = 0; i < list->size; i++) {
+    int total = IRDefs(&list->instrs[i], regs);
+    for (int j = 0; j < total; j++) {
+      if (regs[j] < REG_TOTAL) {
+        written |= 1u << regs[j];
+      }
+    }
+  }
+  return written;
+}
+
+Decl* IRFunctionBlock(IRList* list) {
+  char* name = IRFunctionName(list);
+  if (name == NULL || funcSize == 0 || funcList[0]->parent == NULL) {
+    return NULL;
+  }
+  /* The decorator stores it among the globals right after the function. */
+  Decl* global = funcList[0]->parent;
+  for (size_t i = 0; i < global->childrenSize; i++) {
+    Decl* child = global->children[i];
+    if (child->group == DECL_BLOCK && child->parent != NULL && child->parent->group == DECL_FUNC_DEF
+        && strcmp(child->parent->identifier, name) == 0) {
+      return child;
+    }
+  }
+  return NULL;
+}
+
+char* IRFunctionName(IRList* list) {
+  /* GenerateFunctionEndLabel prefixes the name with an underscore. */
+  for (size_t i = list->size; i-- > 0;) {
+    if (list->instrs[i].op == IR_LABEL) {
+      return list->instrs[i].label[0] == '_' ? list->instrs[i].label + 1 : NULL;
+    }
+  }
+  return NULL;
+}
+
+int IsUnconditionalJump(IRInstr* instr) {
+  return instr->op == IR_J || instr->op == IR_JR;
+}
+
+int IsLabelJump(IRInstr* instr) {
+  enum IRFormat format = irOps[instr->op].format;
+  return format == FMT_BRANCH || format == FMT_BRANCHZ || format == FMT_J;
+}
+
+int IsPureInstr(IRInstr* instr) {
+  switch (irOps[instr->op].format) {
+    case FMT_R:
+    case FMT_I:
+    case FMT_U:
+    case FMT_LI:
+    case FMT_LA:
+      return instr->rd != SP && instr->rd != FP;
+    default:
+      return 0;
+  }
+}
@@ -0,0 +1,222 @@
+/*
+ *  File that holds the information about the linear intermediate
+ *  representation used between the Process* functions and the assembly we
+ *  output. The code for each function body is collected as it is emitted and
+ *  parsed into a list of three address instructions, which lets later passes
+ *  look at the whole function instead of a single node at a time before it
+ *  is printed.
+ */
+
+#ifndef LINEAR_IR_H
+#define LINEAR_IR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "additional-instructions.h"
+#include "decl.h"
+#include "instructions.h"
+
+/*
+ *  Registers are stored as ints so that the IR can hold virtual registers.
+ *  Values up to A1 are the enum reg values from instructions.h, followed by
+ *  the argument registers a2-a7 so that argument n is always A0 + n.
+ *  Anything at or above REG_TOTAL is a virtual register.
+ */
+#define REG_TOTAL (A0 + ARG_REG_TOTAL)
+#define NO_REG -1
+
+/*
+ *  All of the operations the IR can hold. IR_RAW holds a line we could not
+ *  parse and IR_DELETED marks an instruction removed by a pass.
+ */
+enum IROp {
+  IR_LABEL, IR_COMMENT, IR_RAW, IR_DELETED,
+  IR_ADD, IR_SUB, IR_MUL, IR_MULH, IR_DIV, IR_DIVU, IR_REM, IR_REMU,
+  IR_SLL, IR_SRL, IR_SRA, IR_AND, IR_OR, IR_XOR, IR_SLT, IR_SLTU,
+  IR_ADDI, IR_SLLI, IR_SRLI, IR_SRAI, IR_ANDI, IR_ORI, IR_XORI, IR_SLTI, IR_SLTIU,
+  IR_MV, IR_SEQZ, IR_SNEZ, IR_LI, IR_LA,
+  IR_LW, IR_LB, IR_LBU, IR_SW, IR_SB,
+  IR_BEQ, IR_BNE, IR_BLT, IR_BGE, IR_BLTU, IR_BGEU, IR_BEQZ, IR_BNEZ,
+  IR_J, IR_JAL, IR_JR, IR_ECALL, IR_EBREAK,
+  IR_OP_TOTAL
+};
+
+/*
+ *  Operand layouts, used to parse, print and find the registers an
+ *  instruction reads and writes.
+ */
+enum IRFormat {
+  FMT_NONE,           /* label, comment, ecall                  */
+  FMT_R,              /* op rd rs1 rs2                          */
+  FMT_I,              /* op rd rs1 imm                          */
+  FMT_U,              /* op rd rs1                              */
+  FMT_LI,             /* op rd imm                              */
+  FMT_LA,             /* op rd label                            */
+  FMT_LOAD,           /* op rd imm(rs1)                         */
+  FMT_STORE,          /* op rs2 imm(rs1)                        */
+  FMT_BRANCH,         /* op rs1 rs2 label                       */
+  FMT_BRANCHZ,        /* op rs1 label                           */
+  FMT_J,              /* op label                               */
+  FMT_JAL,            /* op rd label                            */
+  FMT_JR              /* op rs1                                 */
+};
+
+typedef struct irOpInfo {
+  char* name;
+  enum IRFormat format;
+} IROpInfo;
+
+/*
+ *  Table indexed by enum IROp.
+ */
+extern const IROpInfo irOps[];
+
+/*
+ *  A single instruction. Stores follow the RISC-V convention of keeping the
+ *  base address in rs1 and the value stored in rs2.
+ */
+typedef struct irInstr {
+  enum IROp op;
+  int rd;
+  int rs1;
+  int rs2;
+  int imm;
+  char* label;        /* Label defined or used, or the text of a comment, */
+                      /* always from InternString so labels compare ==.   */
+  int argBytes;       /* Stack bytes of arguments read by a call, or -1.  */
+  int argRegs;        /* Argument registers read by a call.               */
+} IRInstr;
+
+/*
+ *  The instructions of a single function body, in order.
+ */
+typedef struct irList {
+  IRInstr* instrs;
+  size_t size;
+  size_t capacity;
+  int vregTotal;      /* Number of virtual registers handed out.        */
+} IRList;
+
+/*
+ *  Successor of a block that jumps to a label outside of its list.
+ */
+#define OUTSIDE_BLOCK -2
+
+/*
+ *  A straight line run of instructions in an IRList.
+ */
+typedef struct irBlock {
+  size_t start;       /* Index of the first instruction.                  */
+  size_t end;         /* Index one past the last instruction.             */
+  int succ[2];        /* Following blocks, -1 for none. A -1 in succ[0]   */
+                      /* means control leaves through the function end.   */
+} IRBlock;
+
+/*
+ *  Starts collecting everything emitted into a buffer instead of printing
+ *  it. Used by SaveRegisters at the start of each function body.
+ */
+void BeginFunctionIR();
+
+/*
+ *  Stops collecting emitted code and returns it parsed into an IRList.
+ */
+IRList* EndFunctionIR();
+
+/*
+ *  Marks the call emitted next as reading argBytes bytes of arguments
+ *  starting at the stack pointer and argRegs argument registers starting
+ *  at a0. Passes use this to know which values the callee can see.
+ */
+void EmitCallArgs(int argBytes, int argRegs);
+
+/*
+ *  Appends an instruction to the end of the list.
+ */
+void AppendIR(IRList* list, IRInstr instr);
+
+/*
+ *  Inserts an instruction before the one at index.
+ */
+void InsertIR(IRList* list, size_t index, IRInstr instr);
+
+/*
+ *  Drops every instruction marked IR_DELETED.
+ */
+void CompactIR(IRList* list);
+
+/*
+ *  Returns a new virtual register for the list.
+ */
+int NewVirtualReg(IRList* list);
+
+/*
+ *  Prints the instructions in the same format as the Emit* functions.
+ */
+void PrintIR(IRList* list);
+
+/*
+ *  Frees the list. Labels belong to the intern pool and are kept.
+ */
+void FreeIR(IRList* list);
+
+/*
+ *  Fills regs with the registers the instruction reads and returns how many
+ *  there are. Calls report the stack pointer only, their stack arguments are
+ *  handled separately by the passes that care about memory.
+ */
+int IRUses(IRInstr* instr, int* regs);
+
+/*
+ *  Fills regs with the registers the instruction writes, including every
+ *  caller saved register a call may change, and returns how many there are.
+ */
+int IRDefs(IRInstr* instr, int* regs);
+
+/*
+ *  Splits the list into basic blocks, stores how many there are in
+ *  blockTotal and returns them in order. The caller frees the result.
+ */
+IRBlock* BuildIRBlocks(IRList* list, int* blockTotal);
+
+/*
+ *  Returns how many entries of the list are operations rather than labels,
+ *  comments, unparsed lines or deleted instructions.
+ */
+size_t CountIRInstrs(IRList* list);
+
+/*
+ *  Returns a bit mask, indexed by register, of every register the list
+ *  writes.
+ */
+uint32_t WrittenRegisters(IRList* list);
+
+/*
+ *  Returns the name of the function a body belongs to, found from the label
+ *  its return statements jump to, or NULL if there is none.
+ */
+char* IRFunctionName(IRList* list);
+
+/*
+ *  Returns the block declaring the parameters and locals of the function a
+ *  body belongs to, or NULL if it can not be found.
+ */
+Decl* IRFunctionBlock(IRList* list);
+
+/*
+ *  Returns if control can not fall through from the instruction to the next.
+ */
+int IsUnconditionalJump(IRInstr* instr);
+
+/*
+ *  Returns if the instruction is a branch or jump to a label.
+ */
+int IsLabelJump(IRInstr* instr);
+
+/*
+ *  Returns if the instruction only computes a register value and can be
+ *  removed when that value is never used.
+ */
+int IsPureInstr(IRInstr* instr);
+
+#endif
@@ -0,0 +1,1083 @@
+#include <stdlib.h>
+#include <string.h>
+#include "cgen-helpers.h"
+#include "cgen-options.h"
+#include "intern-pool.h"
+#include "peephole.h"
+#include "utils.h"
+
+/* Most instructions a rule looks past the one it starts at. */
+#define PEEPHOLE_WINDOW 16
+
+/* Passes over a body before giving up on reaching a fixed point. */
+#define MAX_ROUNDS 32
+
+#define REG_BIT(reg) ((uint32_t) 1 << (reg))
+#define ALL_REGS (REG_BIT(REG_TOTAL) - 1)
+
+/* Registers the code after a body reads. */
+#define EXIT_LIVE (REG_BIT(A0) | REG_BIT(SP) | REG_BIT(FP) | REG_BIT(RA) | REG_BIT(GP))
+
+typedef struct peephole {
+  IRList* body;
+  uint32_t* liveAfter;  /* Registers live after each instruction.          */
+} Peephole;
+
+/*
+ *  A rewrite tried on the window starting at index. Returns if it changed
+ *  anything.
+ */
+typedef struct peepholeRule {
+  char* name;
+  int (*apply)(Peephole* p, size_t index);
+} PeepholeRule;
+
+static int IsCode(IRInstr* instr) {
+  return instr->op != IR_DELETED && instr->op != IR_COMMENT;
+}
+
+/*
+ *  Returns the index of the next instruction after index, skipping removed
+ *  instructions and comments.
+ */
+static size_t NextInstr(IRList* body, size_t index) {
+  for (index++; index < body->size && !IsCode(&body->instrs[index]); index++) {
+  }
+  return index;
+}
+
+static void DeleteInstr(IRInstr* instr) {
+  instr->label = NULL;
+  instr->op = IR_DELETED;
+}
+
+/*
+ *  Inserts instr before index. Nothing is known to be dead after it until
+ *  liveness is computed again.
+ */
+static void InsertInstr(Peephole* p, size_t index, IRInstr instr) {
+  InsertIR(p->body, index, instr);
+  p->liveAfter = realloc(p->liveAfter, sizeof(uint32_t) * p->body->size);
+  if (p->liveAfter == NULL) {
+    AllocationFailed();
+  }
+  memmove(&p->liveAfter[index + 1], &p->liveAfter[index], sizeof(uint32_t) * (p->body->size - 1 - index));
+  p->liveAfter[index] = ALL_REGS;
+}
+
+/*
+ *  Returns the registers an instruction reads. Lines that were not parsed
+ *  could read anything.
+ */
+static uint32_t UseMask(IRInstr* instr) {
+  int regs[16];
+  uint32_t mask = 0;
+  if (instr->op == IR_RAW) {
+    return ALL_REGS;
+  }
+  int total = IRUses(instr, regs);
+  for (int i = 0; i < total; i++) {
+    mask |= REG_BIT(regs[i]);
+  }
+  return mask;
+}
+
+static uint32_t DefMask(IRInstr* instr) {
+  int regs[16];
+  uint32_t mask = 0;
+  int total = IRDefs(instr, regs);
+  for (int i = 0; i < total; i++) {
+    mask |= REG_BIT(regs[i]);
+  }
+  return mask;
+}
+
+/*
+ *  Returns if control may leave the block after the instruction.
+ */
+static int EndsWindow(IRInstr* instr) {
+  return instr->op == IR_LABEL || instr->op == IR_RAW || IsLabelJump(instr) || instr->op == IR_JR;
+}
+
+/*
+ *  Replaces every register instr reads from with to, returning if there
+ *  were any. Does not look at registers read implicitly by calls.
+ */
+static int ReplaceUse(IRInstr* instr, int from, int to) {
+  int replaced = 0;
+  switch (irOps[instr->op].format) {
+    case FMT_R:
+    case FMT_STORE:
+    case FMT_BRANCH:
+      if (instr->rs2 == from) {
+        instr->rs2 = to;
+        replaced = 1;
+      }
+      /* Fall through */
+    case FMT_I:
+    case FMT_U:
+    case FMT_LOAD:
+    case FMT_BRANCHZ:
+    case FMT_JR:
+      if (instr->rs1 == from) {
+        instr->rs1 = to;
+        replaced = 1;
+      }
+      break;
+    default:
+      break;
+  }
+  return replaced;
+}
+
+/*
+ *  Recognizes instructions that only copy src into dst.
+ */
+static int IsCopy(IRInstr* instr, int* dst, int* src) {
+  switch (instr->op) {
+    case IR_MV:
+      *src = instr->rs1;
+      break;
+    case IR_ADD:
+    case IR_OR:
+    case IR_XOR:
+      if (instr->rs1 != X0 && instr->rs2 != X0) {
+        return 0;
+      }
+      *src = instr->rs1 == X0 ? instr->rs2 : instr->rs1;
+      break;
+    case IR_SUB:
+    case IR_SLL:
+    case IR_SRL:
+    case IR_SRA:
+      if (instr->rs2 != X0) {
+        return 0;
+      }
+      *src = instr->rs1;
+      break;
+    case IR_ADDI:
+    case IR_ORI:
+    case IR_XORI:
+    case IR_SLLI:
+    case IR_SRLI:
+    case IR_SRAI:
+      if (instr->imm != 0) {
+        return 0;
+      }
+      *src = instr->rs1;
+      break;
+    default:
+      return 0;
+  }
+  *dst = instr->rd;
+  return 1;
+}
+
+static int AccessBytes(IRInstr* instr) {
+  return instr->op == IR_LW || instr->op == IR_SW ? WORDSIZE : BYTESIZE;
+}
+
+static int FitsImm(int imm) {
+  return imm >= -2048 && imm <= 2047;
+}
+
+/*
+ *  Computes an immediate instruction on a known value. Returns 0 for
+ *  operations it does not handle.
+ */
+static int EvalImm(enum IROp op, int32_t value, int32_t imm, int32_t* result) {
+  uint32_t a = (uint32_t) value;
+  uint32_t b = (uint32_t) imm;
+  switch (op) {
+    case IR_ADDI:  *result = (int32_t) (a + b); return 1;
+    case IR_ANDI:  *result = (int32_t) (a & b); return 1;
+    case IR_ORI:   *result = (int32_t) (a | b); return 1;
+    case IR_XORI:  *result = (int32_t) (a ^ b); return 1;
+    case IR_SLTI:  *result = value < imm; return 1;
+    case IR_SLTIU: *result = a < b; return 1;
+    case IR_SLLI:  *result = (int32_t) (a << (b & 31)); return 1;
+    case IR_SRLI:  *result = (int32_t) (a >> (b & 31)); return 1;
+    case IR_SRAI:  *result = value < 0 ? (int32_t) ~(~a >> (b & 31)) : (int32_t) (a >> (b & 31)); return 1;
+    default:       return 0;
+  }
+}
+
+/*
+ *  Returns the immediate form of a register operation whose second operand
+ *  is a constant, or IR_DELETED if there is none.
+ */
+static enum IROp ImmediateForm(enum IROp op) {
+  switch (op) {
+    case IR_ADD:  return IR_ADDI;
+    case IR_AND:  return IR_ANDI;
+    case IR_OR:   return IR_ORI;
+    case IR_XOR:  return IR_XORI;
+    case IR_SLT:  return IR_SLTI;
+    case IR_SLTU: return IR_SLTIU;
+    case IR_SLL:  return IR_SLLI;
+    case IR_SRL:  return IR_SRLI;
+    case IR_SRA:  return IR_SRAI;
+    default:      return IR_DELETED;
+  }
+}
+
+/*
+ *  Folds the constant reg holds into an instruction reading it. Returns if
+ *  the instruction changed.
+ */
+static int FoldConstant(IRInstr* instr, int reg, int32_t value) {
+  int32_t result;
+  enum IRFormat format = irOps[instr->op].format;
+  if (instr->op == IR_MV && instr->rs1 == reg) {
+    *instr = (IRInstr) {IR_LI, instr->rd, NO_REG, NO_REG, value, NULL, -1, 0};
+    return 1;
+  }
+  if (format == FMT_I && instr->rs1 == reg && EvalImm(instr->op, value, instr->imm, &result)) {
+    *instr = (IRInstr) {IR_LI, instr->rd, NO_REG, NO_REG, result, NULL, -1, 0};
+    return 1;
+  }
+  if (format == FMT_R && instr->rs1 != instr->rs2) {
+    int other = instr->rs2 == reg ? instr->rs1 : instr->rs2;
+    int commutes = instr->op == IR_ADD || instr->op == IR_AND || instr->op == IR_OR || instr->op == IR_XOR;
+    int shift = instr->op == IR_SLL || instr->op == IR_SRL || instr->op == IR_SRA;
+    enum IROp op = ImmediateForm(instr->op);
+    int32_t imm = value;
+    if (instr->op == IR_SUB && instr->rs2 == reg && value != INT32_MIN) {
+      op = IR_ADDI;
+      imm = -value;
+    }
+    if (op != IR_DELETED && (instr->rs2 == reg || (commutes && instr->rs1 == reg))
+        && (shift ? imm >= 0 && imm < 32 : FitsImm(imm))) {
+      *instr = (IRInstr) {op, instr->rd, other, NO_REG, imm, NULL, -1, 0};
+      return 1;
+    }
+  }
+  return value == 0 && ReplaceUse(instr, reg, X0);
+}
+
+/*
+ *  Computes the registers live after every instruction of the body.
+ */
+static void ComputeLiveness(Peephole* p) {
+  IRList* body = p->body;
+  int blockTotal;
+  IRBlock* blocks = BuildIRBlocks(body, &blockTotal);
+  uint32_t* liveIn = calloc(blockTotal ? blockTotal : 1, sizeof(uint32_t));
+  int changed = 1;
+  if (liveIn == NULL) {
+    AllocationFailed();
+  }
+  while (changed) {
+    changed = 0;
+    for (int b = blockTotal - 1; b >= 0; b--) {
+      uint32_t live = 0;
+      for (int s = 0; s < 2; s++) {
+        int succ = blocks[b].succ[s];
+        if (succ >= 0) {
+          live |= liveIn[succ];
+        } else if (succ == OUTSIDE_BLOCK) {
+          live |= ALL_REGS;
+        } else if (s == 0) {
+          live |= EXIT_LIVE;
+        }
+      }
+      for (size_t i = blocks[b].end; i-- > blocks[b].start;) {
+        IRInstr* instr = &body->instrs[i];
+        p->liveAfter[i] = live;
+        live = (live & ~DefMask(instr)) | UseMask(instr);
+      }
+      if (live != liveIn[b]) {
+        liveIn[b] = live;
+        changed = 1;
+      }
+    }
+  }
+  free(liveIn);
+  free(blocks);
+}
+
+/*
+ *  mv x x and anything equivalent.
+ */
+static int SelfMove(Peephole* p, size_t index) {
+  int dst, src;
+  IRInstr* instr = &p->body->instrs[index];
+  if (IsCopy(instr, &dst, &src) && dst == src) {
+    DeleteInstr(instr);
+    return 1;
+  }
+  return 0;
+}
+
+/*
+ *  Writes copies as mv and constants as li so the other rules only need to
+ *  look for one form.
+ */
+static int CanonicalMove(Peephole* p, size_t index) {
+  int dst, src;
+  IRInstr* instr = &p->body->instrs[index];
+  if (IsCopy(instr, &dst, &src) && dst != src) {
+    if (src == X0) {
+      *instr = (IRInstr) {IR_LI, dst, NO_REG, NO_REG, 0, NULL, -1, 0};
+      return 1;
+    } else if (instr->op != IR_MV) {
+      *instr = (IRInstr) {IR_MV, dst, src, NO_REG, 0, NULL, -1, 0};
+      return 1;
+    }
+  } else if ((instr->op == IR_ADDI || instr->op == IR_ORI || instr->op == IR_XORI) && instr->rs1 == X0) {
+    *instr = (IRInstr) {IR_LI, instr->rd, NO_REG, NO_REG, instr->imm, NULL, -1, 0};
+    return 1;
+  }
+  return 0;
+}
+
+/*
+ *  Computations and stack or frame loads whose result is never read.
+ */
+static int DeadCode(Peephole* p, size_t index) {
+  IRInstr* instr = &p->body->instrs[index];
+  int safeLoad = irOps[instr->op].format == FMT_LOAD && (instr->rs1 == SP || instr->rs1 == FP);
+  if ((IsPureInstr(instr) || (safeLoad && instr->rd != SP && instr->rd != FP))
+      && (instr->rd == X0 || !(p->liveAfter[index] & REG_BIT(instr->rd)))) {
+    DeleteInstr(instr);
+    return 1;
+  }
+  return 0;
+}
+
+/*
+ *  li r c followed by instructions reading r: uses the constant directly.
+ */
+static int ConstantOperand(Peephole* p, size_t index) {
+  IRList* body = p->body;
+  IRInstr* instr = &body->instrs[index];
+  int reg = instr->rd;
+  int32_t value = instr->imm;
+  int changed = 0;
+  if (instr->op != IR_LI || reg == X0) {
+    return 0;
+  }
+  size_t next = NextInstr(body, index);
+  for (int step = 0; step < PEEPHOLE_WINDOW && next < body->size; step++) {
+    IRInstr* user = &body->instrs[next];
+    if (user->op == IR_LABEL || user->op == IR_RAW) {
+      break;
+    }
+    changed |= FoldConstant(user, reg, value);
+    if ((DefMask(user) & REG_BIT(reg)) || EndsWindow(user)) {
+      break;
+    }
+    next = NextInstr(body, next);
+  }
+  return changed;
+}
+
+/*
+ *  Looks back through the block for the li that last set reg. Returns if
+ *  there is one.
+ */
+static int KnownConstant(IRList* body, size_t index, int reg, int32_t* value) {
+  if (reg == X0) {
+    *value = 0;
+    return 1;
+  }
+  for (int step = 0; step < PEEPHOLE_WINDOW && index > 0; step++) {
+    IRInstr* instr = &body->instrs[--index];
+    if (instr->op == IR_LABEL || instr->op == IR_RAW) {
+      return 0;
+    }
+    if (IsCode(instr) && (DefMask(instr) & REG_BIT(reg))) {
+      *value = instr->imm;
+      return instr->op == IR_LI;
+    }
+  }
+  return 0;
+}
+
+/*
+ *  Returns k if value is 2 to the k, otherwise -1.
+ */
+static int ExactLog2(uint32_t value) {
+  for (int k = 0; k < 32; k++) {
+    if (value == (uint32_t) 1 << k) {
+      return k;
+    }
+  }
+  return -1;
+}
+
+/*
+ *  Returns a caller saved register that is dead after index and is not in
+ *  avoid, or NO_REG if there is none. Callee saved registers are left alone
+ *  so using one does not add to what the function has to save.
+ */
+static int FreeScratch(Peephole* p, size_t index, uint32_t avoid) {
+  static const int scratchRegs[] = {T0, T1, T2, T3, T4, T5};
+  uint32_t busy = p->liveAfter[index] | avoid;
+  for (size_t i = 0; i < sizeof(scratchRegs) / sizeof(scratchRegs[0]); i++) {
+    if (!(busy & REG_BIT(scratchRegs[i]))) {
+      return scratchRegs[i];
+    }
+  }
+  for (int reg = A0; reg < REG_TOTAL; reg++) {
+    if (!(busy & REG_BIT(reg))) {
+      return reg;
+    }
+  }
+  return NO_REG;
+}
+
+/*
+ *  Finds the multiplier and shift that divide by a constant with mulh, as
+ *  in Hacker's Delight chapter 10. Divisor must not be 0, 1, -1 or the
+ *  smallest int.
+ */
+static void SignedMagic(int32_t divisor, int32_t* multiplier, int* shift) {
+  const uint32_t two31 = 0x80000000u;
+  uint32_t ad = divisor < 0 ? 0u - (uint32_t) divisor : (uint32_t) divisor;
+  uint32_t t = two31 + ((uint32_t) divisor >> 31);
+  uint32_t anc = t - 1 - t % ad;
+  uint32_t q1 = two31 / anc;
+  uint32_t r1 = two31 - q1 * anc;
+  uint32_t q2 = two31 / ad;
+  uint32_t r2 = two31 - q2 * ad;
+  uint32_t delta;
+  int p = 31;
+  do {
+    p++;
+    q1 *= 2;
+    r1 *= 2;
+    if (r1 >= anc) {
+      q1++;
+      r1 -= anc;
+    }
+    q2 *= 2;
+    r2 *= 2;
+    if (r2 >= ad) {
+      q2++;
+      r2 -= ad;
+    }
+    delta = ad - r2;
+  } while (q1 < delta || (q1 == delta && r1 == 0));
+  *multiplier = (int32_t) (divisor < 0 ? 0u - (q2 + 1) : q2 + 1);
+  *shift = p - 32;
+}
+
+#define MAX_REDUCED 8
+
+/*
+ *  Appends the instructions rounding x / 2^shift towards zero into tmp,
+ *  leaving the quotient shifted back up by shift when keepScaled is set.
+ */
+static int RoundedShift(IRInstr* seq, int total, int tmp, int x, int shift, int keepScaled) {
+  if (shift == 1) {
+    seq[total++] = (IRInstr) {IR_SRLI, tmp, x, NO_REG, 31, NULL, -1, 0};
+  } else {
+    seq[total++] = (IRInstr) {IR_SRAI, tmp, x, NO_REG, 31, NULL, -1, 0};
+    seq[total++] = (IRInstr) {IR_SRLI, tmp, tmp, NO_REG, 32 - shift, NULL, -1, 0};
+  }
+  seq[total++] = (IRInstr) {IR_ADD, tmp, tmp, x, 0, NULL, -1, 0};
+  if (keepScaled && FitsImm(-(1 << shift))) {
+    seq[total++] = (IRInstr) {IR_ANDI, tmp, tmp, NO_REG, -(1 << shift), NULL, -1, 0};
+  } else {
+    seq[total++] = (IRInstr) {IR_SRAI, tmp, tmp, NO_REG, shift, NULL, -1, 0};
+    if (keepScaled) {
+      seq[total++] = (IRInstr) {IR_SLLI, tmp, tmp, NO_REG, shift, NULL, -1, 0};
+    }
+  }
+  return total;
+}
+
+/*
+ *  Appends the instructions leaving x / divisor in tmp, using spare to
+ *  round, for a divisor that is not a power of two.
+ */
+static int MagicDivide(IRInstr* seq, int total, int tmp, int spare, int x, int32_t divisor) {
+  int32_t multiplier;
+  int shift;
+  SignedMagic(divisor, &multiplier, &shift);
+  seq[total++] = (IRInstr) {IR_LI, tmp, NO_REG, NO_REG, multiplier, NULL, -1, 0};
+  seq[total++] = (IRInstr) {IR_MULH, tmp, x, tmp, 0, NULL, -1, 0};
+  if (divisor > 0 && multiplier < 0) {
+    seq[total++] = (IRInstr) {IR_ADD, tmp, tmp, x, 0, NULL, -1, 0};
+  } else if (divisor < 0 && multiplier > 0) {
+    seq[total++] = (IRInstr) {IR_SUB, tmp, tmp, x, 0, NULL, -1, 0};
+  }
+  if (shift > 0) {
+    seq[total++] = (IRInstr) {IR_SRAI, tmp, tmp, NO_REG, shift, NULL, -1, 0};
+  }
+  /* Rounds a negative quotient up towards zero. */
+  seq[total++] = (IRInstr) {IR_SRLI, spare, tmp, NO_REG, 31, NULL, -1, 0};
+  seq[total++] = (IRInstr) {IR_ADD, tmp, tmp, spare, 0, NULL, -1, 0};
+  return total;
+}
+
+/*
+ *  mul, div and rem by a constant held in a register: shifts for powers of
+ *  two and a multiply by the reciprocal for other divisors, since both are
+ *  much cheaper than dividing.
+ */
+static int StrengthReduction(Peephole* p, size_t index) {
+  IRList* body = p->body;
+  IRInstr* instr = &body->instrs[index];
+  IRInstr seq[MAX_REDUCED];
+  int total = 0;
+  int32_t value;
+  int d = instr->rd;
+  int x = instr->rs1;
+  if (instr->op != IR_MUL && instr->op != IR_DIV && instr->op != IR_REM) {
+    return 0;
+  }
+  if (!KnownConstant(body, index, instr->rs2, &value)) {
+    if (instr->op != IR_MUL || !KnownConstant(body, index, instr->rs1, &value)) {
+      return 0;
+    }
+    x = instr->rs2;
+  }
+  uint32_t magnitude = value < 0 ? 0u - (uint32_t) value : (uint32_t) value;
+  int shift = ExactLog2(magnitude);
+  if (x == X0 || d == X0 || value == INT32_MIN || (value == 0 && instr->op != IR_MUL)) {
+    return 0;
+  }
+  if (value == 0) {
+    seq[total++] = (IRInstr) {IR_LI, d, NO_REG, NO_REG, 0, NULL, -1, 0};
+  } else if (instr->op == IR_MUL) {
+    if (value == 1) {
+      seq[total++] = (IRInstr) {IR_MV, d, x, NO_REG, 0, NULL, -1, 0};
+    } else if (value == -1) {
+      seq[total++] = (IRInstr) {IR_SUB, d, X0, x, 0, NULL, -1, 0};
+    } else if (value > 0 && shift > 0) {
+      seq[total++] = (IRInstr) {IR_SLLI, d, x, NO_REG, shift, NULL, -1, 0};
+    } else {
+      return 0;
+    }
+  } else if (magnitude == 1) {
+    if (instr->op == IR_REM) {
+      seq[total++] = (IRInstr) {IR_LI, d, NO_REG, NO_REG, 0, NULL, -1, 0};
+    } else {
+      seq[total++] = value == 1 ? (IRInstr) {IR_MV, d, x, NO_REG, 0, NULL, -1, 0}
+                                : (IRInstr) {IR_SUB, d, X0, x, 0, NULL, -1, 0};
+    }
+  } else if (shift > 0) {
+    int tmp = d != x ? d : FreeScratch(p, index, REG_BIT(x));
+    if (tmp == NO_REG) {
+      return 0;
+    }
+    total = RoundedShift(seq, total, tmp, x, shift, instr->op == IR_REM);
+    if (instr->op == IR_REM) {
+      seq[total++] = (IRInstr) {IR_SUB, d, x, tmp, 0, NULL, -1, 0};
+    } else if (value < 0) {
+      seq[total++] = (IRInstr) {IR_SUB, d, X0, tmp, 0, NULL, -1, 0};
+    } else if (tmp != d) {
+      seq[total++] = (IRInstr) {IR_MV, d, tmp, NO_REG, 0, NULL, -1, 0};
+    }
+  } else {
+    int tmp = FreeScratch(p, index, REG_BIT(x) | REG_BIT(d));
+    int spare = d != x ? d : FreeScratch(p, index, REG_BIT(x) | REG_BIT(tmp));
+    if (tmp == NO_REG || spare == NO_REG) {
+      return 0;
+    }
+    total = MagicDivide(seq, total, tmp, spare, x, value);
+    if (instr->op == IR_DIV) {
+      /* x is no longer needed, so the last add can write d directly. */
+      seq[total - 1].rd = d;
+    } else {
+      seq[total++] = (IRInstr) {IR_LI, spare, NO_REG, NO_REG, value, NULL, -1, 0};
+      seq[total++] = (IRInstr) {IR_MUL, tmp, tmp, spare, 0, NULL, -1, 0};
+      seq[total++] = (IRInstr) {IR_SUB, d, x, tmp, 0, NULL, -1, 0};
+    }
+  }
+  body->instrs[index] = seq[total - 1];
+  for (int i = 0; i < total - 1; i++) {
+    InsertInstr(p, index + i, seq[i]);
+  }
+  return 1;
+}
+
+/*
+ *  mv d s followed by instructions reading d: reads s instead, which often
+ *  leaves the copy dead.
+ */
+static int CopyPropagation(Peephole* p, size_t index) {
+  IRList* body = p->body;
+  IRInstr* instr = &body->instrs[index];
+  int dst = instr->rd;
+  int src = instr->rs1;
+  size_t last = index;
+  if (instr->op != IR_MV || dst == src || dst == X0) {
+    return 0;
+  }
+  size_t next = NextInstr(body, index);
+  for (int step = 0; step < PEEPHOLE_WINDOW && next < body->size; step++) {
+    IRInstr* user = &body->instrs[next];
+    if (user->op == IR_LABEL || user->op == IR_RAW) {
+      break;
+    }
+    if (ReplaceUse(user, dst, src)) {
+      last = next;
+    }
+    if ((DefMask(user) & (REG_BIT(dst) | REG_BIT(src))) || EndsWindow(user)) {
+      break;
+    }
+    next = NextInstr(body, next);
+  }
+  /* src is now read further on than before. */
+  for (size_t i = index; i < last; i++) {
+    p->liveAfter[i] |= REG_BIT(src);
+  }
+  return last != index;
+}
+
+/*
+ *  sw x k(b) followed by lw y k(b): copies x instead of loading it.
+ */
+static int StoreLoad(Peephole* p, size_t index) {
+  IRInstr* store = &p->body->instrs[index];
+  size_t next = NextInstr(p->body, index);
+  if (store->op != IR_SW || next == p->body->size) {
+    return 0;
+  }
+  IRInstr* load = &p->body->instrs[next];
+  if (load->op != IR_LW || load->rs1 != store->rs1 || load->imm != store->imm) {
+    return 0;
+  }
+  if (load->rd == store->rs2) {
+    DeleteInstr(load);
+  } else {
+    *load = (IRInstr) {IR_MV, load->rd, store->rs2, NO_REG, 0, NULL, -1, 0};
+    p->liveAfter[index] |= REG_BIT(store->rs2);
+  }
+  return 1;
+}
+
+/*
+ *  An instruction computing d followed by mv x d, where d is not read
+ *  again, computes x directly.
+ */
+static int ForwardResult(Peephole* p, size_t index) {
+  IRList* body = p->body;
+  IRInstr* instr = &body->instrs[index];
+  size_t next = NextInstr(body, index);
+  if (!(IsPureInstr(instr) || irOps[instr->op].format == FMT_LOAD) || instr->rd == X0 || next == body->size) {
+    return 0;
+  }
+  IRInstr* move = &body->instrs[next];
+  if (move->op != IR_MV || move->rs1 != instr->rd || move->rd == SP || move->rd == FP
+      || (p->liveAfter[next] & REG_BIT(instr->rd))) {
+    return 0;
+  }
+  instr->rd = move->rd;
+  DeleteInstr(move);
+  return 1;
+}
+
+/*
+ *  A store to the stack that is popped off before anything could read it.
+ */
+static int DeadStore(Peephole* p, size_t index) {
+  IRList* body = p->body;
+  IRInstr* store = &body->instrs[index];
+  if (irOps[store->op].format != FMT_STORE || store->rs1 != SP || store->imm < 0) {
+    return 0;
+  }
+  size_t next = NextInstr(body, index);
+  for (int step = 0; step < PEEPHOLE_WINDOW && next < body->size; step++) {
+    IRInstr* instr = &body->instrs[next];
+    enum IRFormat format = irOps[instr->op].format;
+    if (instr->op == IR_ADDI && instr->rd == SP && instr->rs1 == SP) {
+      if (store->imm + AccessBytes(store) > instr->imm) {
+        return 0;
+      }
+      DeleteInstr(store);
+      return 1;
+    }
+    if (EndsWindow(instr) || format == FMT_LOAD || format == FMT_JAL || instr->op == IR_ECALL
+        || ((UseMask(instr) | DefMask(instr)) & REG_BIT(SP))) {
+      return 0;
+    }
+    next = NextInstr(body, next);
+  }
+  return 0;
+}
+
+/*
+ *  Two stack pointer adjustments with nothing using the stack between
+ *  them become one, or none if they cancel out.
+ */
+static int StackAdjust(Peephole* p, size_t index) {
+  IRList* body = p->body;
+  IRInstr* first = &body->instrs[index];
+  if (first->op != IR_ADDI || first->rd != SP || first->rs1 != SP) {
+    return 0;
+  }
+  size_t next = NextInstr(body, index);
+  for (int step = 0; step < PEEPHOLE_WINDOW && next < body->size; step++) {
+    IRInstr* instr = &body->instrs[next];
+    enum IRFormat format = irOps[instr->op].format;
+    if (instr->op == IR_ADDI && instr->rd == SP && instr->rs1 == SP) {
+      instr->imm += first->imm;
+      if (instr->imm == 0) {
+        DeleteInstr(instr);
+      }
+      DeleteInstr(first);
+      return 1;
+    }
+    if (EndsWindow(instr) || format == FMT_LOAD || format == FMT_STORE || format == FMT_JAL
+        || instr->op == IR_ECALL || ((UseMask(instr) | DefMask(instr)) & REG_BIT(SP))) {
+      return 0;
+    }
+    next = NextInstr(body, next);
+  }
+  return 0;
+}
+
+/*
+ *  Returns if label is defined before any other instruction after index.
+ */
+static int LabelFollows(IRList* body, size_t index, char* label) {
+  for (size_t next = NextInstr(body, index); next < body->size; next = NextInstr(body, next)) {
+    if (body->instrs[next].op != IR_LABEL) {
+      return 0;
+    } else if (body->instrs[next].label == label) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*
+ *  j L straight before L.
+ */
+static int JumpToNext(Peephole* p, size_t index) {
+  IRInstr* instr = &p->body->instrs[index];
+  if (instr->op == IR_J && LabelFollows(p->body, index, instr->label)) {
+    DeleteInstr(instr);
+    return 1;
+  }
+  return 0;
+}
+
+static enum IROp InvertBranch(enum IROp op) {
+  switch (op) {
+    case IR_BEQ:  return IR_BNE;
+    case IR_BNE:  return IR_BEQ;
+    case IR_BLT:  return IR_BGE;
+    case IR_BGE:  return IR_BLT;
+    case IR_BLTU: return IR_BGEU;
+    case IR_BGEU: return IR_BLTU;
+    case IR_BEQZ: return IR_BNEZ;
+    case IR_BNEZ: return IR_BEQZ;
+    default:      return op;
+  }
+}
+
+/*
+ *  Returns if instr branches on whether reg is zero, setting jumpIfZero.
+ */
+static int IsZeroTest(IRInstr* instr, int reg, int* jumpIfZero) {
+  *jumpIfZero = instr->op == IR_BEQZ || instr->op == IR_BEQ;
+  switch (instr->op) {
+    case IR_BEQZ:
+    case IR_BNEZ:
+      return instr->rs1 == reg;
+    case IR_BEQ:
+    case IR_BNE:
+      return (instr->rs1 == reg && instr->rs2 == X0) || (instr->rs1 == X0 && instr->rs2 == reg);
+    default:
+      return 0;
+  }
+}
+
+/*
+ *  A comparison whose result, possibly inverted, only feeds a branch on
+ *  zero, as in slt t a b; xori t t 1; beqz t L, becomes a single branch on
+ *  the operands. An immediate operand is loaded into the register the
+ *  comparison wrote.
+ */
+static int CompareBranch(Peephole* p, size_t index) {
+  IRList* body = p->body;
+  IRInstr* first = &body->instrs[index];
+  int a = first->rs1;
+  int b = first->rs2;
+  int32_t imm = first->imm;
+  int loadImm = irOps[first->op].format == FMT_I && imm != 0;
+  int isBool = 1;
+  int length = 1;
+  int jumpIfZero;
+  enum IROp op;
+  /* op is the branch taken exactly when the current value is not zero. */
+  switch (first->op) {
+    case IR_SLT:
+    case IR_SLTI:
+      op = IR_BLT;
+      break;
+    case IR_SLTU:
+    case IR_SLTIU:
+      op = IR_BLTU;
+      break;
+    case IR_XOR:
+    case IR_XORI:
+    case IR_SUB:
+      op = IR_BNE;
+      isBool = 0;
+      break;
+    case IR_SEQZ:
+      op = IR_BEQ;
+      b = X0;
+      break;
+    case IR_SNEZ:
+      op = IR_BNE;
+      b = X0;
+      break;
+    default:
+      return 0;
+  }
+  if (first->rd == X0) {
+    return 0;
+  }
+  if (irOps[first->op].format == FMT_I) {
+    b = loadImm ? first->rd : X0;
+  }
+  int value = first->rd;
+  uint32_t written = REG_BIT(value);
+  size_t next = NextInstr(body, index);
+  for (; next < body->size; next = NextInstr(body, next), length++) {
+    IRInstr* instr = &body->instrs[next];
+    if (IsZeroTest(instr, value, &jumpIfZero)) {
+      break;
+    }
+    if (irOps[instr->op].format != FMT_U && instr->op != IR_XORI) {
+      return 0;
+    }
+    if (instr->rs1 != value || instr->rd == X0) {
+      return 0;
+    }
+    if (instr->op == IR_SEQZ || (instr->op == IR_XORI && isBool && instr->imm == 1)) {
+      op = InvertBranch(op);
+    } else if (instr->op != IR_SNEZ) {
+      return 0;
+    }
+    isBool = 1;
+    value = instr->rd;
+    written |= REG_BIT(value);
+  }
+  /*
+   *  The whole chain is removed, so the operands still hold their values at
+   *  the branch unless the immediate is loaded over one of them.
+   */
+  if (next == body->size || (p->liveAfter[next] & written) || (loadImm && a == b)) {
+    return 0;
+  }
+  /* Loading the immediate would leave as many instructions as before. */
+  if (loadImm && length == 1) {
+    return 0;
+  }
+  IRInstr* branch = &body->instrs[next];
+  *branch = (IRInstr) {jumpIfZero ? InvertBranch(op) : op, NO_REG, a, b, 0, branch->label, -1, 0};
+  for (size_t i = index; i < next; i++) {
+    if (IsCode(&body->instrs[i])) {
+      DeleteInstr(&body->instrs[i]);
+    }
+  }
+  if (loadImm) {
+    body->instrs[index] = (IRInstr) {IR_LI, b, NO_REG, NO_REG, imm, NULL, -1, 0};
+  }
+  return 1;
+}
+
+/*
+ *  Returns the index of the first instruction that is not a label after the
+ *  definition of label, or the size of the body if it is not defined there.
+ */
+static size_t LabelTarget(IRList* body, char* label) {
+  for (size_t i = 0; i < body->size; i++) {
+    if (body->instrs[i].op == IR_LABEL && body->instrs[i].label == label) {
+      while (i < body->size && (!IsCode(&body->instrs[i]) || body->instrs[i].op == IR_LABEL)) {
+        i++;
+      }
+      return i;
+    }
+  }
+  return body->size;
+}
+
+/*
+ *  Returns the register instr branches on being zero or not, or NO_REG if
+ *  it does not.
+ */
+static int ZeroTestReg(IRInstr* instr, int* jumpIfZero) {
+  if (instr->op == IR_BEQZ || instr->op == IR_BNEZ || instr->op == IR_BEQ || instr->op == IR_BNE) {
+    int reg = instr->rs1 == X0 ? instr->rs2 : instr->rs1;
+    if (IsZeroTest(instr, reg, jumpIfZero)) {
+      return reg;
+    }
+  }
+  return NO_REG;
+}
+
+/*
+ *  A branch or jump to a label that is followed by j L goes straight to L.
+ *  A branch on whether a register is zero that lands on another such test
+ *  of the same register goes straight to wherever that test leads, which
+ *  is what chains of && and || leave behind.
+ */
+static int JumpThreading(Peephole* p, size_t index) {
+  IRList* body = p->body;
+  IRInstr* instr = &body->instrs[index];
+  int jumpIfZero, nextIfZero;
+  if (!IsLabelJump(instr)) {
+    return 0;
+  }
+  size_t target = LabelTarget(body, instr->label);
+  if (target == body->size || target == index) {
+    return 0;
+  }
+  IRInstr* next = &body->instrs[target];
+  int reg = ZeroTestReg(instr, &jumpIfZero);
+  char* label;
+  if (next->op == IR_J) {
+    label = next->label;
+  } else if (reg != NO_REG && reg != X0 && ZeroTestReg(next, &nextIfZero) == reg) {
+    if (jumpIfZero == nextIfZero) {
+      label = next->label;
+    } else {
+      /* The second test never passes, so continue after it. */
+      size_t after = NextInstr(body, target);
+      if (after == body->size) {
+        return 0;
+      }
+      if (body->instrs[after].op != IR_LABEL) {
+        char* generated = GenerateLocalLabel();
+        InsertInstr(p, after, (IRInstr) {IR_LABEL, NO_REG, NO_REG, NO_REG, 0, InternString(generated), -1, 0});
+        free(generated);
+        if (after <= index) {
+          index++;
+        }
+      }
+      instr = &body->instrs[index];
+      label = body->instrs[after].label;
+    }
+  } else {
+    return 0;
+  }
+  if (label == instr->label) {
+    return 0;
+  }
+  instr->label = label;
+  return 1;
+}
+
+/*
+ *  A branch over a jump, b L1; j L2; L1:, becomes a single inverted branch.
+ */
+static int BranchOverJump(Peephole* p, size_t index) {
+  IRList* body = p->body;
+  IRInstr* branch = &body->instrs[index];
+  enum IRFormat format = irOps[branch->op].format;
+  size_t next = NextInstr(body, index);
+  if ((format != FMT_BRANCH && format != FMT_BRANCHZ) || next == body->size) {
+    return 0;
+  }
+  IRInstr* jump = &body->instrs[next];
+  if (jump->op != IR_J || !LabelFollows(body, next, branch->label)) {
+    return 0;
+  }
+  char* target = jump->label;
+  jump->label = branch->label;
+  branch->label = target;
+  branch->op = InvertBranch(branch->op);
+  DeleteInstr(jump);
+  return 1;
+}
+
+/*
+ *  Labels nothing jumps to, which lets the other rules look past them. The
+ *  last label is kept since it names the function for later passes.
+ */
+static int UnusedLabel(Peephole* p, size_t index) {
+  IRList* body = p->body;
+  IRInstr* instr = &body->instrs[index];
+  int isLast = 1;
+  if (instr->op != IR_LABEL) {
+    return 0;
+  }
+  for (size_t i = index + 1; i < body->size && isLast; i++) {
+    isLast = body->instrs[i].op != IR_LABEL;
+  }
+  if (isLast) {
+    return 0;
+  }
+  for (size_t i = 0; i < body->size; i++) {
+    IRInstr* user = &body->instrs[i];
+    if (user->op == IR_RAW || (user->op != IR_LABEL && user->op != IR_COMMENT && user->label != NULL
+                               && user->label == instr->label)) {
+      return 0;
+    }
+  }
+  DeleteInstr(instr);
+  return 1;
+}
+
+static const PeepholeRule peepholeRules[] = {
+  {"canonical-move", CanonicalMove},
+  {"self-move", SelfMove},
+  {"dead-code", DeadCode},
+  {"constant-operand", ConstantOperand},
+  {"strength-reduction", StrengthReduction},
+  {"copy-propagation", CopyPropagation},
+  {"store-load", StoreLoad},
+  {"forward-result", ForwardResult},
+  {"dead-store", DeadStore},
+  {"stack-adjust", StackAdjust},
+  {"compare-branch", CompareBranch},
+  {"jump-threading", JumpThreading},
+  {"jump-to-next", JumpToNext},
+  {"branch-over-jump", BranchOverJump},
+  {"unused-label", UnusedLabel},
+};
+
+#define RULE_TOTAL (sizeof(peepholeRules) / sizeof(peepholeRules[0]))
+
+/* Number of times each rule fired. */
+static size_t ruleCounts[RULE_TOTAL];
+
+void PrintPeepholeStats(FILE* out) {
+  for (size_t r = 0; r < RULE_TOTAL; r++) {
+    fprintf(out, "peephole %-18s %zu\n", peepholeRules[r].name, ruleCounts[r]);
+  }
+}
+
+static void PrintPeepholeStatsAtExit() {
+  PrintPeepholeStats(stderr);
+}
+
+void RunPeephole(IRList* body) {
+  static int statsRegistered = 0;
+  Peephole p = {body, NULL};
+  int changed = 1;
+
+  if (GetCGenOptions()->peepholeStats && !statsRegistered) {
+    atexit(PrintPeepholeStatsAtExit);
+    statsRegistered = 1;
+  }
+  for (int round = 0; changed && round < MAX_ROUNDS; round++) {
+    changed = 0;
+    CompactIR(body);
+    free(p.liveAfter);
+    p.liveAfter = malloc(sizeof(uint32_t) * (body->size ? body->size : 1));
+    if (p.liveAfter == NULL) {
+      AllocationFailed();
+    }
+    ComputeLiveness(&p);
+    for (size_t i = 0; i < body->size; i++) {
+      for (size_t r = 0; r < RULE_TOTAL && IsCode(&body->instrs[i]); r++) {
+        if (peepholeRules[r].apply(&p, i)) {
+          ruleCounts[r]++;
+          changed = 1;
+        }
+      }
+    }
+  }
+  CompactIR(body);
+  free(p.liveAfter);
+}
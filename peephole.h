@@ -0,0 +1,25 @@
+/*
+ *  File that holds the peephole optimizer run over each function body after
+ *  register allocation and before it is printed. It slides a window over the
+ *  instructions and applies a table of rewrite rules until none of them
+ *  changes anything. Rules that remove code use the registers live after
+ *  each instruction, so they can see past the end of the window.
+ */
+
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include <stdio.h>
+#include "linear-ir.h"
+
+/*
+ *  Rewrites body in place until no rule applies.
+ */
+void RunPeephole(IRList* body);
+
+/*
+ *  Prints how many times each rule has fired over every body so far.
+ */
+void PrintPeepholeStats(FILE* out);
+
+#endif
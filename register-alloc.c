@@ -0,0 +1,926 @@
+#include <stdlib.h>
+#include <string.h>
+#include "register-alloc.h"
+#include "decorate-builtins.h"
+#include "utils.h"
+
+/* Most scalar frame objects considered for registers in one function. */
+#define MAX_CANDIDATES 64
+
+/* Words below the stack pointer at the start of the body that are tracked. */
+#define STACK_WORDS 256
+
+/* Value of a stack pointer offset we could not determine. */
+#define SP_UNKNOWN INT32_MIN
+
+/* Registers handed out to promoted variables, in order of preference. */
+static const int colorOrder[] = {
+  T0, T1, T2, T3, T4, T5, S2, S3, S4, S5, S6, S7, S8, S9, S10, S11
+};
+
+#define COLOR_TOTAL (sizeof(colorOrder) / sizeof(colorOrder[0]))
+
+/*
+ *  A word sized variable in the frame that may be kept in a register.
+ */
+typedef struct frameObject {
+  int offset;         /* Address relative to fp.                          */
+  int isParam;        /* Parameters start with a value from the caller.   */
+  int accessed;       /* Set once a load or store of it is found.         */
+  int vreg;           /* Virtual register holding it, or NO_REG.          */
+  int color;          /* Register chosen for vreg, or NO_REG.             */
+  long weight;        /* Uses weighted by loop depth.                     */
+  int crossesCall;    /* Live across a call so it needs a saved register. */
+  uint64_t adjacent;  /* Promoted objects live at the same time.          */
+} FrameObject;
+
+/*
+ *  What the address analysis knows about a value. Either it is exactly fp
+ *  plus offset, or it may point into any of the objects in the set.
+ */
+typedef struct addrValue {
+  int exact;
+  int offset;
+  uint64_t objects;
+} AddrValue;
+
+/*
+ *  Values of every register and tracked stack word at a program point.
+ *  spDelta is the stack pointer relative to its value at the body start.
+ */
+typedef struct addrState {
+  int reached;
+  int spDelta;
+  AddrValue regs[REG_TOTAL];
+  AddrValue stack[STACK_WORDS];
+} AddrState;
+
+typedef struct allocator {
+  IRList* body;
+  FrameObject objects[MAX_CANDIDATES];
+  int objectTotal;
+  uint64_t escaped;   /* Objects whose address is used unpredictably.     */
+  uint64_t badAccess; /* Objects accessed with a different size or offset. */
+  int failed;         /* Set if the body can not be safely analyzed.      */
+  IRBlock* blocks;
+  int blockTotal;
+  int* access;        /* Object a load or store touches, or -1.           */
+  int* spDelta;       /* Stack pointer offset before each instruction.    */
+  char* safeLoad;     /* Loads that can never fault.                      */
+  int locTotal;       /* Registers, virtual registers and stack words.    */
+  int slotBase;       /* Location of the first stack word.                */
+  int words;          /* uint64_t words per location set.                 */
+} Allocator;
+
+static void* AllocZeroed(size_t total, size_t size) {
+  void* ptr = calloc(total ? total : 1, size);
+  if (ptr == NULL) {
+    AllocationFailed();
+  }
+  return ptr;
+}
+
+/*
+ *  Adds every word sized variable in block and its nested blocks as a
+ *  candidate. Parameters have non-negative offsets and sit above the saved
+ *  frame pointer, locals sit below the registers SaveRegisters stored.
+ */
+static void CollectObjects(Allocator* a, Decl* block, int regBytes) {
+  for (size_t i = 0; i < block->childrenSize; i++) {
+    Decl* child = block->children[i];
+    if (child->group == DECL_BLOCK) {
+      CollectObjects(a, child, regBytes);
+    } else if (child->group == DECL_VAR && child->arrTotal == 0 && child->dataSize == WORDSIZE
+               && a->objectTotal < MAX_CANDIDATES) {
+      FrameObject* object = &a->objects[a->objectTotal++];
+      object->isParam = child->offset >= 0;
+      object->offset = object->isParam ? child->offset + WORDSIZE : child->offset - regBytes;
+      object->vreg = NO_REG;
+      object->color = NO_REG;
+    }
+  }
+}
+
+/*
+ *  Returns the set of candidates overlapping [addr, addr + width).
+ */
+static uint64_t ObjectsOverlapping(Allocator* a, int addr, int width) {
+  uint64_t result = 0;
+  for (int i = 0; i < a->objectTotal; i++) {
+    if (a->objects[i].offset < addr + width && addr < a->objects[i].offset + WORDSIZE) {
+      result |= 1ull << i;
+    }
+  }
+  return result;
+}
+
+static AddrValue NoAddr() {
+  AddrValue value = {0, 0, 0};
+  return value;
+}
+
+static AddrValue FrameAddr(Allocator* a, int offset) {
+  AddrValue value = {1, offset, ObjectsOverlapping(a, offset, 1)};
+  return value;
+}
+
+static int SameValue(AddrValue x, AddrValue y) {
+  return x.exact == y.exact && x.objects == y.objects && (!x.exact || x.offset == y.offset);
+}
+
+/*
+ *  Returns the tracked stack word holding addr, relative to the stack
+ *  pointer at the start of the body, or -1 if it is not tracked.
+ */
+static int StackSlot(int addr) {
+  if (addr >= 0 || addr < -WORDSIZE * STACK_WORDS) {
+    return -1;
+  }
+  return (-addr - 1) / WORDSIZE;
+}
+
+static void Escape(Allocator* a, AddrValue value) {
+  a->escaped |= value.objects;
+}
+
+static void SetReg(AddrState* state, int reg, AddrValue value) {
+  if (reg != X0 && reg != SP) {
+    state->regs[reg] = value;
+  }
+}
+
+/*
+ *  Forgets the position of the stack pointer, which means any address left
+ *  on the stack could be read from anywhere.
+ */
+static void ForgetStack(Allocator* a, AddrState* state) {
+  for (int i = 0; i < STACK_WORDS; i++) {
+    Escape(a, state->stack[i]);
+    state->stack[i] = NoAddr();
+  }
+  state->spDelta = SP_UNKNOWN;
+}
+
+/*
+ *  Returns if the instruction reads the stack pointer as a value rather
+ *  than as the base of a load or store or to move the stack.
+ */
+static int ReadsSpValue(IRInstr* instr) {
+  switch (irOps[instr->op].format) {
+    case FMT_R:
+    case FMT_BRANCH:
+      return instr->rs1 == SP || instr->rs2 == SP;
+    case FMT_STORE:
+      return instr->rs2 == SP;
+    case FMT_I:
+      return instr->rs1 == SP && !(instr->op == IR_ADDI && instr->rd == SP);
+    case FMT_U:
+    case FMT_BRANCHZ:
+    case FMT_JR:
+      return instr->rs1 == SP;
+    default:
+      return 0;
+  }
+}
+
+static int AccessWidth(IRInstr* instr) {
+  return instr->op == IR_LW || instr->op == IR_SW ? WORDSIZE : BYTESIZE;
+}
+
+/*
+ *  Handles the address used by a load or store.
+ */
+static void CheckAccess(Allocator* a, AddrState* state, size_t index, int record) {
+  IRInstr* instr = &a->body->instrs[index];
+  int width = AccessWidth(instr);
+  if (instr->rs1 == SP) {
+    if (record) {
+      a->safeLoad[index] = 1;
+    }
+    return;
+  }
+  AddrValue base = state->regs[instr->rs1];
+  if (!base.exact) {
+    Escape(a, base);
+    return;
+  }
+  if (record) {
+    a->safeLoad[index] = 1;
+  }
+  int addr = base.offset + instr->imm;
+  uint64_t hit = ObjectsOverlapping(a, addr, width);
+  if (hit == 0) {
+    return;
+  }
+  int object = __builtin_ctzll(hit);
+  if (hit == (1ull << object) && a->objects[object].offset == addr && width == WORDSIZE) {
+    if (record) {
+      a->access[index] = object;
+    }
+  } else {
+    a->badAccess |= hit;
+  }
+}
+
+/*
+ *  Applies a single instruction to the state. When record is set the
+ *  results used to rewrite the body are saved.
+ */
+static void Step(Allocator* a, AddrState* state, size_t index, int record) {
+  IRInstr* instr = &a->body->instrs[index];
+  int defs[16];
+  int defTotal = IRDefs(instr, defs);
+
+  if (record) {
+    a->spDelta[index] = state->spDelta;
+  }
+  if (instr->op == IR_RAW || ReadsSpValue(instr)) {
+    a->failed = 1;
+    return;
+  }
+  for (int i = 0; i < defTotal; i++) {
+    if (defs[i] == FP) {
+      a->failed = 1;
+      return;
+    }
+  }
+
+  switch (irOps[instr->op].format) {
+    case FMT_LOAD: {
+      AddrValue value = NoAddr();
+      CheckAccess(a, state, index, record);
+      if (instr->rs1 == SP && state->spDelta != SP_UNKNOWN && instr->op == IR_LW) {
+        int addr = state->spDelta + instr->imm;
+        int slot = StackSlot(addr);
+        if (slot >= 0 && addr % WORDSIZE == 0) {
+          value = state->stack[slot];
+        }
+      }
+      if (instr->rd == SP) {
+        ForgetStack(a, state);
+      }
+      SetReg(state, instr->rd, value);
+      break;
+    }
+    case FMT_STORE: {
+      AddrValue value = state->regs[instr->rs2];
+      CheckAccess(a, state, index, record);
+      if (instr->rs1 == SP && state->spDelta != SP_UNKNOWN) {
+        int addr = state->spDelta + instr->imm;
+        int slot = StackSlot(addr);
+        if (instr->op == IR_SW && slot >= 0 && addr % WORDSIZE == 0) {
+          state->stack[slot] = value;
+          break;
+        }
+        if (slot >= 0) {
+          state->stack[slot] = NoAddr();
+        }
+      }
+      Escape(a, value);
+      break;
+    }
+    case FMT_I:
+      if (instr->rd == SP) {
+        if (instr->rs1 == SP && instr->op == IR_ADDI && state->spDelta != SP_UNKNOWN) {
+          /* Anything popped off the stack is gone. */
+          for (int addr = state->spDelta; addr < state->spDelta + instr->imm; addr++) {
+            int slot = StackSlot(addr);
+            if (slot >= 0) {
+              state->stack[slot] = NoAddr();
+            }
+          }
+          state->spDelta += instr->imm;
+        } else {
+          ForgetStack(a, state);
+        }
+      } else if (instr->op == IR_ADDI && state->regs[instr->rs1].exact) {
+        SetReg(state, instr->rd, FrameAddr(a, state->regs[instr->rs1].offset + instr->imm));
+      } else {
+        Escape(a, state->regs[instr->rs1]);
+        SetReg(state, instr->rd, NoAddr());
+      }
+      break;
+    case FMT_R:
+      if (instr->rd == SP) {
+        ForgetStack(a, state);
+      } else if (instr->op == IR_ADD && instr->rs1 == X0) {
+        SetReg(state, instr->rd, state->regs[instr->rs2]);
+      } else if (instr->op == IR_ADD && instr->rs2 == X0) {
+        SetReg(state, instr->rd, state->regs[instr->rs1]);
+      } else {
+        Escape(a, state->regs[instr->rs1]);
+        Escape(a, state->regs[instr->rs2]);
+        SetReg(state, instr->rd, NoAddr());
+      }
+      break;
+    case FMT_U:
+      if (instr->rd == SP) {
+        ForgetStack(a, state);
+      } else if (instr->op == IR_MV) {
+        SetReg(state, instr->rd, state->regs[instr->rs1]);
+      } else {
+        Escape(a, state->regs[instr->rs1]);
+        SetReg(state, instr->rd, NoAddr());
+      }
+      break;
+    case FMT_LI:
+    case FMT_LA:
+      if (instr->rd == SP) {
+        ForgetStack(a, state);
+      }
+      SetReg(state, instr->rd, NoAddr());
+      break;
+    case FMT_BRANCH:
+      Escape(a, state->regs[instr->rs2]);
+      Escape(a, state->regs[instr->rs1]);
+      break;
+    case FMT_BRANCHZ:
+    case FMT_JR:
+      Escape(a, state->regs[instr->rs1]);
+      break;
+    case FMT_JAL:
+      for (int i = 0; i < instr->argRegs; i++) {
+        Escape(a, state->regs[A0 + i]);
+      }
+      /* The callee sees its arguments and may change them. */
+      if (state->spDelta != SP_UNKNOWN && instr->argBytes >= 0) {
+        for (int addr = state->spDelta; addr < state->spDelta + instr->argBytes; addr++) {
+          int slot = StackSlot(addr);
+          if (slot >= 0) {
+            Escape(a, state->stack[slot]);
+            state->stack[slot] = NoAddr();
+          }
+        }
+      } else {
+        int spDelta = state->spDelta;
+        ForgetStack(a, state);
+        state->spDelta = spDelta;
+      }
+      for (int i = 0; i < defTotal; i++) {
+        SetReg(state, defs[i], NoAddr());
+      }
+      break;
+    case FMT_NONE:
+      if (instr->op == IR_ECALL) {
+        Escape(a, state->regs[A0]);
+        Escape(a, state->regs[A1]);
+        SetReg(state, A0, NoAddr());
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+/*
+ *  Merges src into the state at the start of a block. Returns if dst
+ *  changed.
+ */
+static int MergeState(Allocator* a, AddrState* dst, AddrState* src) {
+  int changed = 0;
+  if (!dst->reached) {
+    *dst = *src;
+    return 1;
+  }
+  for (int i = 0; i < REG_TOTAL; i++) {
+    if (!SameValue(dst->regs[i], src->regs[i])) {
+      AddrValue merged = {0, 0, dst->regs[i].objects | src->regs[i].objects};
+      if (!SameValue(dst->regs[i], merged)) {
+        dst->regs[i] = merged;
+        changed = 1;
+      }
+    }
+  }
+  if (dst->spDelta != src->spDelta) {
+    /* Paths disagree on the stack depth so stop tracking it. */
+    for (int i = 0; i < STACK_WORDS; i++) {
+      Escape(a, src->stack[i]);
+    }
+    if (dst->spDelta != SP_UNKNOWN) {
+      ForgetStack(a, dst);
+      changed = 1;
+    }
+  } else if (dst->spDelta != SP_UNKNOWN) {
+    for (int i = 0; i < STACK_WORDS; i++) {
+      if (!SameValue(dst->stack[i], src->stack[i])) {
+        AddrValue merged = {0, 0, dst->stack[i].objects | src->stack[i].objects};
+        if (!SameValue(dst->stack[i], merged)) {
+          dst->stack[i] = merged;
+          changed = 1;
+        }
+      }
+    }
+  }
+  return changed;
+}
+
+/*
+ *  Splits the body into basic blocks, giving up on bodies that jump to
+ *  labels outside of them.
+ */
+static void BuildBlocks(Allocator* a) {
+  a->blocks = BuildIRBlocks(a->body, &a->blockTotal);
+  for (int b = 0; b < a->blockTotal; b++) {
+    if (a->blocks[b].succ[0] == OUTSIDE_BLOCK || a->blocks[b].succ[1] == OUTSIDE_BLOCK) {
+      a->failed = 1;
+    }
+  }
+}
+
+/*
+ *  Tracks which registers and stack words may hold the address of each
+ *  candidate, marking the candidates whose address is used for anything
+ *  other than loading or storing them as escaped.
+ */
+static void AnalyzeAddresses(Allocator* a) {
+  AddrState* states = AllocZeroed(a->blockTotal, sizeof(AddrState));
+  AddrState* current = AllocZeroed(1, sizeof(AddrState));
+  int changed = 1;
+
+  states[0].reached = 1;
+  states[0].spDelta = 0;
+  states[0].regs[FP] = FrameAddr(a, 0);
+  while (changed && !a->failed) {
+    changed = 0;
+    for (int b = 0; b < a->blockTotal; b++) {
+      if (!states[b].reached) {
+        continue;
+      }
+      *current = states[b];
+      for (size_t i = a->blocks[b].start; i < a->blocks[b].end; i++) {
+        Step(a, current, i, 0);
+      }
+      for (int s = 0; s < 2; s++) {
+        if (a->blocks[b].succ[s] >= 0) {
+          changed |= MergeState(a, &states[a->blocks[b].succ[s]], current);
+        }
+      }
+    }
+  }
+  for (size_t i = 0; i < a->body->size; i++) {
+    a->access[i] = -1;
+    a->spDelta[i] = SP_UNKNOWN;
+  }
+  for (int b = 0; b < a->blockTotal && !a->failed; b++) {
+    if (states[b].reached) {
+      *current = states[b];
+      for (size_t i = a->blocks[b].start; i < a->blocks[b].end; i++) {
+        Step(a, current, i, 1);
+      }
+    }
+  }
+  free(current);
+  free(states);
+}
+
+static void SetLoc(uint64_t* set, int loc) {
+  set[loc / 64] |= 1ull << (loc % 64);
+}
+
+static int HasLoc(uint64_t* set, int loc) {
+  return (set[loc / 64] >> (loc % 64)) & 1;
+}
+
+/*
+ *  Marks the stack words overlapping [addr, addr + width) in set.
+ */
+static void SetStackLocs(Allocator* a, uint64_t* set, int spDelta, int addr, int width) {
+  if (spDelta == SP_UNKNOWN || width < 0) {
+    for (int i = 0; i < STACK_WORDS; i++) {
+      SetLoc(set, a->slotBase + i);
+    }
+    return;
+  }
+  for (int byte = spDelta + addr; byte < spDelta + addr + width; byte++) {
+    int slot = StackSlot(byte);
+    if (slot >= 0) {
+      SetLoc(set, a->slotBase + slot);
+    }
+  }
+}
+
+/*
+ *  Computes the locations an instruction reads and the ones it overwrites.
+ */
+static void Effects(Allocator* a, size_t index, uint64_t* use, uint64_t* def) {
+  IRInstr* instr = &a->body->instrs[index];
+  int regs[16];
+  int total;
+  int spDelta = a->spDelta[index];
+
+  memset(use, 0, sizeof(uint64_t) * a->words);
+  memset(def, 0, sizeof(uint64_t) * a->words);
+  if (instr->op == IR_DELETED || instr->op == IR_LABEL || instr->op == IR_COMMENT) {
+    return;
+  }
+  total = IRUses(instr, regs);
+  for (int i = 0; i < total; i++) {
+    SetLoc(use, regs[i]);
+  }
+  total = IRDefs(instr, regs);
+  for (int i = 0; i < total; i++) {
+    SetLoc(def, regs[i]);
+  }
+  switch (irOps[instr->op].format) {
+    case FMT_LOAD:
+      if (instr->rs1 == SP) {
+        SetStackLocs(a, use, spDelta, instr->imm, AccessWidth(instr));
+      }
+      break;
+    case FMT_STORE:
+      if (instr->rs1 == SP && instr->op == IR_SW && spDelta != SP_UNKNOWN) {
+        int slot = StackSlot(spDelta + instr->imm);
+        if (slot >= 0 && (spDelta + instr->imm) % WORDSIZE == 0) {
+          SetLoc(def, a->slotBase + slot);
+        }
+      }
+      break;
+    case FMT_JAL:
+      SetStackLocs(a, use, spDelta, 0, instr->argBytes);
+      break;
+    case FMT_NONE:
+      if (instr->op == IR_ECALL) {
+        SetStackLocs(a, use, SP_UNKNOWN, 0, 0);
+      }
+      break;
+    case FMT_I:
+      if (instr->rd == SP && instr->rs1 == SP && instr->imm > 0 && spDelta != SP_UNKNOWN) {
+        SetStackLocs(a, def, spDelta, 0, instr->imm);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+/*
+ *  Applies an instruction to a set of live locations, walking backwards.
+ */
+static void TransferLive(Allocator* a, uint64_t* live, uint64_t* use, uint64_t* def) {
+  for (int w = 0; w < a->words; w++) {
+    live[w] = (live[w] & ~def[w]) | use[w];
+  }
+}
+
+/*
+ *  Computes the locations live on exit from each block.
+ */
+static void ComputeLiveOut(Allocator* a, uint64_t* liveOut) {
+  uint64_t* liveIn = AllocZeroed(a->blockTotal * a->words, sizeof(uint64_t));
+  uint64_t* live = AllocZeroed(a->words, sizeof(uint64_t));
+  uint64_t* use = AllocZeroed(a->words, sizeof(uint64_t));
+  uint64_t* def = AllocZeroed(a->words, sizeof(uint64_t));
+  uint64_t* exitLive = AllocZeroed(a->words, sizeof(uint64_t));
+  int changed = 1;
+
+  /* The epilogue needs the return value and the frame. */
+  SetLoc(exitLive, A0);
+  SetLoc(exitLive, SP);
+  SetLoc(exitLive, FP);
+  SetLoc(exitLive, RA);
+  SetLoc(exitLive, GP);
+  while (changed) {
+    changed = 0;
+    for (int b = a->blockTotal - 1; b >= 0; b--) {
+      IRBlock* block = &a->blocks[b];
+      uint64_t* out = &liveOut[b * a->words];
+      for (int s = 0; s < 2; s++) {
+        uint64_t* from = exitLive;
+        if (block->succ[s] >= 0) {
+          from = &liveIn[block->succ[s] * a->words];
+        } else if (s == 1) {
+          continue;
+        }
+        for (int w = 0; w < a->words; w++) {
+          out[w] |= from[w];
+        }
+      }
+      memcpy(live, out, sizeof(uint64_t) * a->words);
+      for (size_t i = block->end; i-- > block->start;) {
+        Effects(a, i, use, def);
+        TransferLive(a, live, use, def);
+      }
+      if (memcmp(live, &liveIn[b * a->words], sizeof(uint64_t) * a->words) != 0) {
+        memcpy(&liveIn[b * a->words], live, sizeof(uint64_t) * a->words);
+        changed = 1;
+      }
+    }
+  }
+  free(exitLive);
+  free(def);
+  free(use);
+  free(live);
+  free(liveIn);
+}
+
+/*
+ *  Returns if an instruction only produces values nobody reads.
+ */
+static int IsDead(Allocator* a, size_t index, uint64_t* live, uint64_t* def) {
+  IRInstr* instr = &a->body->instrs[index];
+  if (IsPureInstr(instr) || (irOps[instr->op].format == FMT_LOAD && a->safeLoad[index])) {
+    return instr->rd != SP && instr->rd != FP && (instr->rd == X0 || !HasLoc(live, instr->rd));
+  }
+  if (instr->op == IR_SW && instr->rs1 == SP) {
+    for (int i = 0; i < STACK_WORDS; i++) {
+      if (HasLoc(def, a->slotBase + i)) {
+        return !HasLoc(live, a->slotBase + i);
+      }
+    }
+  }
+  return 0;
+}
+
+/*
+ *  Deletes instructions whose results are never used until none are left.
+ */
+static void RemoveDeadCode(Allocator* a) {
+  uint64_t* liveOut = AllocZeroed(a->blockTotal * a->words, sizeof(uint64_t));
+  uint64_t* live = AllocZeroed(a->words, sizeof(uint64_t));
+  uint64_t* use = AllocZeroed(a->words, sizeof(uint64_t));
+  uint64_t* def = AllocZeroed(a->words, sizeof(uint64_t));
+  int removed = 1;
+
+  while (removed) {
+    removed = 0;
+    memset(liveOut, 0, sizeof(uint64_t) * a->blockTotal * a->words);
+    ComputeLiveOut(a, liveOut);
+    for (int b = 0; b < a->blockTotal; b++) {
+      memcpy(live, &liveOut[b * a->words], sizeof(uint64_t) * a->words);
+      for (size_t i = a->blocks[b].end; i-- > a->blocks[b].start;) {
+        Effects(a, i, use, def);
+        if (a->body->instrs[i].op != IR_DELETED && IsDead(a, i, live, def)) {
+          a->body->instrs[i].label = NULL;
+          a->body->instrs[i].op = IR_DELETED;
+          removed = 1;
+          continue;
+        }
+        TransferLive(a, live, use, def);
+      }
+    }
+  }
+  free(def);
+  free(use);
+  free(live);
+  free(liveOut);
+}
+
+/*
+ *  Returns the candidate held in a virtual register.
+ */
+static FrameObject* VregObject(Allocator* a, int reg) {
+  for (int i = 0; i < a->objectTotal; i++) {
+    if (a->objects[i].vreg == reg) {
+      return &a->objects[i];
+    }
+  }
+  return NULL;
+}
+
+/*
+ *  Records which promoted variables are live at the same time and which are
+ *  live across a call.
+ */
+static void BuildInterference(Allocator* a) {
+  uint64_t* liveOut = AllocZeroed(a->blockTotal * a->words, sizeof(uint64_t));
+  uint64_t* live = AllocZeroed(a->words, sizeof(uint64_t));
+  uint64_t* use = AllocZeroed(a->words, sizeof(uint64_t));
+  uint64_t* def = AllocZeroed(a->words, sizeof(uint64_t));
+  int vregBase = REG_TOTAL;
+  int vregTotal = a->body->vregTotal;
+
+  ComputeLiveOut(a, liveOut);
+  for (int b = 0; b < a->blockTotal; b++) {
+    memcpy(live, &liveOut[b * a->words], sizeof(uint64_t) * a->words);
+    for (size_t i = a->blocks[b].end; i-- > a->blocks[b].start;) {
+      IRInstr* instr = &a->body->instrs[i];
+      Effects(a, i, use, def);
+      for (int v = 0; v < vregTotal; v++) {
+        FrameObject* object = VregObject(a, vregBase + v);
+        if (!HasLoc(live, vregBase + v)) {
+          continue;
+        }
+        if (instr->op == IR_JAL) {
+          object->crossesCall = 1;
+        }
+        for (int d = 0; d < vregTotal; d++) {
+          /* A copy does not make its source and destination conflict. */
+          if (d == v || !HasLoc(def, vregBase + d) || (instr->op == IR_MV && instr->rs1 == vregBase + v)) {
+            continue;
+          }
+          FrameObject* other = VregObject(a, vregBase + d);
+          object->adjacent |= 1ull << (other - a->objects);
+          other->adjacent |= 1ull << (object - a->objects);
+        }
+      }
+      TransferLive(a, live, use, def);
+    }
+  }
+  free(def);
+  free(use);
+  free(live);
+  free(liveOut);
+}
+
+/*
+ *  Weighs every use of a promoted variable by how deeply nested in loops it
+ *  is, where a loop is any backwards branch.
+ */
+static void ComputeWeights(Allocator* a) {
+  IRList* body = a->body;
+  int* depth = AllocZeroed(body->size, sizeof(int));
+  for (size_t j = 0; j < body->size; j++) {
+    if (!IsLabelJump(&body->instrs[j])) {
+      continue;
+    }
+    for (size_t i = 0; i <= j; i++) {
+      if (body->instrs[i].op == IR_LABEL && body->instrs[i].label == body->instrs[j].label) {
+        for (size_t k = i; k <= j; k++) {
+          depth[k]++;
+        }
+        break;
+      }
+    }
+  }
+  for (size_t i = 0; i < body->size; i++) {
+    IRInstr* instr = &body->instrs[i];
+    int regs[3] = {instr->rd, instr->rs1, instr->rs2};
+    for (int r = 0; r < 3; r++) {
+      FrameObject* object = regs[r] >= REG_TOTAL ? VregObject(a, regs[r]) : NULL;
+      if (object != NULL && instr->op != IR_DELETED) {
+        object->weight += 1l << (3 * (depth[i] < 6 ? depth[i] : 6));
+      }
+    }
+  }
+  free(depth);
+}
+
+/*
+ *  Assigns registers the body never mentions to promoted variables, most
+ *  heavily used first. Variables live across a call only get saved
+ *  registers.
+ */
+static void ColorObjects(Allocator* a) {
+  IRList* body = a->body;
+  int referenced[REG_TOTAL] = {0};
+  for (size_t i = 0; i < body->size; i++) {
+    IRInstr* instr = &body->instrs[i];
+    int regs[3] = {instr->rd, instr->rs1, instr->rs2};
+    if (instr->op == IR_DELETED) {
+      continue;
+    }
+    for (int r = 0; r < 3; r++) {
+      if (regs[r] >= 0 && regs[r] < REG_TOTAL) {
+        referenced[regs[r]] = 1;
+      }
+    }
+  }
+  for (;;) {
+    FrameObject* next = NULL;
+    for (int i = 0; i < a->objectTotal; i++) {
+      FrameObject* object = &a->objects[i];
+      if (object->vreg != NO_REG && object->color == NO_REG && object->weight >= 0
+          && (next == NULL || object->weight > next->weight)) {
+        next = object;
+      }
+    }
+    if (next == NULL) {
+      break;
+    }
+    for (size_t c = 0; c < COLOR_TOTAL && next->color == NO_REG; c++) {
+      int reg = colorOrder[c];
+      int taken = referenced[reg] || (next->crossesCall && reg >= T0 && reg <= T5);
+      for (int i = 0; i < a->objectTotal && !taken; i++) {
+        taken = ((next->adjacent >> i) & 1) && a->objects[i].color == reg;
+      }
+      if (!taken) {
+        next->color = reg;
+      }
+    }
+    if (next->color == NO_REG) {
+      /* Nothing left, so it stays in the frame. */
+      next->weight = -1;
+    }
+  }
+}
+
+/*
+ *  Replaces virtual registers with their colors, or with frame accesses for
+ *  variables that did not get a register.
+ */
+static void AssignRegisters(Allocator* a) {
+  IRList* body = a->body;
+  for (size_t i = 0; i < body->size; i++) {
+    IRInstr* instr = &body->instrs[i];
+    if (instr->op == IR_DELETED) {
+      continue;
+    }
+    FrameObject* dst = instr->rd >= REG_TOTAL ? VregObject(a, instr->rd) : NULL;
+    FrameObject* src = instr->rs1 >= REG_TOTAL ? VregObject(a, instr->rs1) : NULL;
+    if (dst != NULL && dst->color == NO_REG) {
+      if (instr->op == IR_LW) {
+        instr->op = IR_DELETED;
+      } else {
+        *instr = (IRInstr) {IR_SW, NO_REG, FP, instr->rs1, dst->offset, NULL, -1, 0};
+      }
+      continue;
+    }
+    if (src != NULL && src->color == NO_REG) {
+      *instr = (IRInstr) {IR_LW, instr->rd, FP, NO_REG, src->offset, NULL, -1, 0};
+      continue;
+    }
+    if (dst != NULL) {
+      instr->rd = dst->color;
+    }
+    if (src != NULL) {
+      instr->rs1 = src->color;
+    }
+    if (instr->rs2 >= REG_TOTAL) {
+      instr->rs2 = VregObject(a, instr->rs2)->color;
+    }
+    if (instr->op == IR_MV && instr->rd == instr->rs1) {
+      instr->op = IR_DELETED;
+    }
+  }
+}
+
+void AllocateRegisters(IRList* body, int regBytes) {
+  Allocator a;
+  Decl* block = IRFunctionBlock(body);
+  int paramTotal = 0;
+
+  memset(&a, 0, sizeof(Allocator));
+  a.body = body;
+  if (block != NULL) {
+    CollectObjects(&a, block, regBytes);
+  }
+  if (body->size == 0) {
+    return;
+  }
+  /* Reserve room at the start for loading parameters into registers. */
+  for (int i = 0; i < a.objectTotal; i++) {
+    if (a.objects[i].isParam) {
+      IRInstr placeholder = {IR_DELETED, NO_REG, NO_REG, NO_REG, 0, NULL, -1, 0};
+      InsertIR(body, 0, placeholder);
+      paramTotal++;
+    }
+  }
+  a.access = AllocZeroed(body->size, sizeof(int));
+  a.spDelta = AllocZeroed(body->size, sizeof(int));
+  a.safeLoad = AllocZeroed(body->size, sizeof(char));
+  BuildBlocks(&a);
+  if (!a.failed) {
+    AnalyzeAddresses(&a);
+  }
+  if (!a.failed) {
+    /* Move every promotable variable into its own virtual register. */
+    uint64_t promotable = ~(a.escaped | a.badAccess);
+    for (size_t i = 0; i < body->size; i++) {
+      int object = a.access[i];
+      if (object >= 0 && ((promotable >> object) & 1)) {
+        a.objects[object].accessed = 1;
+      }
+    }
+    int placeholder = 0;
+    for (int i = 0; i < a.objectTotal; i++) {
+      FrameObject* object = &a.objects[i];
+      if (object->accessed && ((promotable >> i) & 1)) {
+        object->vreg = NewVirtualReg(body);
+      }
+      if (object->isParam) {
+        if (object->vreg != NO_REG) {
+          body->instrs[placeholder] = (IRInstr) {IR_LW, object->vreg, FP, NO_REG, object->offset, NULL, -1, 0};
+          a.safeLoad[placeholder] = 1;
+          a.spDelta[placeholder] = 0;
+        }
+        placeholder++;
+      }
+    }
+    for (size_t i = paramTotal; i < body->size; i++) {
+      IRInstr* instr = &body->instrs[i];
+      int object = a.access[i];
+      if (object < 0 || a.objects[object].vreg == NO_REG) {
+        continue;
+      }
+      if (instr->op == IR_LW) {
+        *instr = (IRInstr) {IR_MV, instr->rd, a.objects[object].vreg, NO_REG, 0, NULL, -1, 0};
+      } else {
+        *instr = (IRInstr) {IR_MV, a.objects[object].vreg, instr->rs2, NO_REG, 0, NULL, -1, 0};
+      }
+    }
+
+    a.slotBase = REG_TOTAL + body->vregTotal;
+    a.locTotal = a.slotBase + STACK_WORDS;
+    a.words = (a.locTotal + 63) / 64;
+    RemoveDeadCode(&a);
+    BuildInterference(&a);
+    ComputeWeights(&a);
+    ColorObjects(&a);
+    AssignRegisters(&a);
+  }
+  CompactIR(body);
+  free(a.blocks);
+  free(a.safeLoad);
+  free(a.spDelta);
+  free(a.access);
+}
@@ -0,0 +1,22 @@
+/*
+ *  File that holds the register allocator run over each function body once
+ *  it has been lowered into the linear IR. It finds scalar locals and
+ *  parameters whose address never escapes, moves them from the stack frame
+ *  into virtual registers and then colors those onto the registers the body
+ *  leaves unused. Anything that can not be colored stays in the frame.
+ */
+
+#ifndef REGISTER_ALLOC_H
+#define REGISTER_ALLOC_H
+
+#include "linear-ir.h"
+
+/*
+ *  Takes in the body of a function, from just after SaveRegisters to just
+ *  before RestoreRegisters, and the number of bytes SaveRegisters reserved.
+ *  Rewrites the body so that promotable variables live in registers and
+ *  removes the stack traffic that leaves unused.
+ */
+void AllocateRegisters(IRList* body, int regBytes);
+
+#endif
@@ -1,75 +1,333 @@
-import argparse, os, re, subprocess, sys
+import argparse, concurrent.futures, hashlib, json, os, re, struct, subprocess, sys, time
+from xml.sax.saxutils import quoteattr
 
 
 filenamePattern = re.compile ("(.+)\.61c")
 basePath = "tests"
+stages = ["part1", "part2", "part3", "part4", "part5", "part6", "integration", "elf", "simulator", "profile", "line-info"]
 
-def main (section, staffTests):
+# Results of passing tests by the hash of everything they depend on, so a
+# test is only run again once the compiler, its files or the flags change
+cacheFile = "{}/.results-cache.json".format (basePath)
+
+fileHashes = {}
+
+def hashFile (path):
+  if path not in fileHashes:
+    with open (path, "rb") as f:
+      fileHashes[path] = hashlib.sha256 (f.read ()).hexdigest ()
+  return fileHashes[path]
+
+class Test:
+  inputPattern = filenamePattern
+
+  def __init__ (self, section, baseName, files, staffTests, registerArgs, native):
+    self.native = native
+    self.section = section
+    self.baseName = baseName
+    self.staffTests = staffTests
+    self.name = "{}/{}".format (section, baseName)
+    self.source = "{}/{}/inputs/{}.61c".format (basePath, section, baseName)
+    self.destFile = "{}/{}/outputs/{}-output.S".format (basePath, section, baseName)
+    self.outFile = "{}/{}/outputs/{}.out".format (basePath, section, baseName)
+    self.expectedFile = "{}/{}/expected/{}.out".format (basePath, section, baseName)
+    # Append any .s/.S file for the test and then the print library
+    self.appended = []
+    for assemFile in ["{}.S".format (baseName), "{}.s".format (baseName)]:
+      if assemFile in files:
+        self.appended.append ("{}/{}/inputs/{}".format (basePath, section, assemFile))
+    self.appended.append ("cgen-lib/print-regargs.s" if registerArgs else "cgen-lib/print.s")
+    self.result = None
+    self.seconds = 0.0
+    self.cached = False
+
+  def key (self, env):
+    parts = [hashFile ("61ccc"), hashFile ("61csim" if self.native else "venus.jar"), hashFile (self.source), env.get ("CGENFLAGS", "")]
+    parts += [hashFile (path) for path in self.appended]
+    if self.staffTests:
+      parts.append (hashFile (self.expectedFile))
+    return hashlib.sha256 ("\n".join (parts).encode ()).hexdigest ()
+
+  def run (self, env):
+    start = time.time ()
+    # Run the compiler on the file and place the output in output
+    with open (self.destFile, "w") as outputFile:
+      res = subprocess.run (["./61ccc", "-c", self.source], stdout=outputFile, env=env)
+    if res.returncode:
+      self.result = "compile error"
+    else:
+      with open (self.destFile, "a") as outputFile:
+        for path in self.appended:
+          subprocess.run (["cat", path], stdout=outputFile)
+      # Run the actual file through venus or the native simulator
+      simulator = ["./61csim"] if self.native else ["java", "-jar", "venus.jar"]
+      with open (self.outFile, "w") as outputFile:
+        subprocess.run (simulator + [self.destFile], stdout=outputFile)
+      if not self.staffTests:
+        self.result = "ran"
+      else:
+        # Record and compare the result of the output
+        with open (self.outFile, "rb") as output, open (self.expectedFile, "rb") as expected:
+          self.result = "passed" if output.read () == expected.read () else "failed"
+    self.seconds = time.time () - start
+    return self
+
+# Relocation types 61ccc --elf writes, from rv-assembler.h
+relocNames = {1: "R_RISCV_32", 16: "R_RISCV_BRANCH", 17: "R_RISCV_JAL", 26: "R_RISCV_HI20", 27: "R_RISCV_LO12_I"}
+
+def dumpElf (data):
+  # Lists the sections, symbols and relocations of a 32 bit ELF object
+  sectionOffset, = struct.unpack_from ("<I", data, 32)
+  sectionTotal, namesIndex = struct.unpack_from ("<HH", data, 48)
+  sections = [struct.unpack_from ("<10I", data, sectionOffset + 40 * i) for i in range (sectionTotal)]
+  def string (table, offset):
+    start = sections[table][4] + offset
+    return data[start:data.index (b"\0", start)].decode ()
+  names = [string (namesIndex, section[0]) for section in sections]
+  lines = []
+  symbols = []
+  for i, section in enumerate (sections[1:], 1):
+    lines.append ("section {} size {}".format (names[i], section[5]))
+    if section[1] == 2:
+      for offset in range (section[4], section[4] + section[5], 16):
+        name, value, size, info, other, index = struct.unpack_from ("<IIIBBH", data, offset)
+        symbols.append (string (section[6], name))
+        if offset > section[4]:
+          where = names[index] if index else "UNDEF"
+          lines.append ("symbol {} {} {} {:#x}".format (symbols[-1], "GLOBAL" if info >> 4 else "LOCAL", where, value))
+  for i, section in enumerate (sections):
+    if section[1] == 4:
+      for offset in range (section[4], section[4] + section[5], 12):
+        where, info, addend = struct.unpack_from ("<IIi", data, offset)
+        lines.append ("reloc {} {:#x} {} {}".format (names[i], where, relocNames.get (info & 0xff, info & 0xff), symbols[info >> 8]))
+  return "\n".join (lines) + "\n"
+
+class ElfTest (Test):
+  # Compiles with --elf and compares what the object defines and refers to
+  def __init__ (self, *args):
+    Test.__init__ (self, *args)
+    self.destFile = "{}/{}/outputs/{}.o".format (basePath, self.section, self.baseName)
+
+  def key (self, env):
+    parts = [hashFile ("61ccc"), hashFile (self.source), hashFile (self.expectedFile), env.get ("CGENFLAGS", "")]
+    return hashlib.sha256 ("\n".join (parts).encode ()).hexdigest ()
+
+  def run (self, env):
+    start = time.time ()
+    elfEnv = dict (env)
+    elfEnv["CGENFLAGS"] = "{} --elf -o {}".format (env.get ("CGENFLAGS", ""), self.destFile).strip ()
+    res = subprocess.run (["./61ccc", "-c", self.source], env=elfEnv)
+    if res.returncode:
+      self.result = "compile error"
+    else:
+      with open (self.destFile, "rb") as f:
+        dump = dumpElf (f.read ())
+      with open (self.outFile, "w") as f:
+        f.write (dump)
+      with open (self.expectedFile) as expected:
+        self.result = "passed" if dump == expected.read () else "failed"
+    self.seconds = time.time () - start
+    return self
+
+class LineInfoTest (Test):
+  # Compiles with --line-info and compares the assembly itself, so the line
+  # markers are checked after register allocation and the peephole pass
+  def __init__ (self, *args):
+    Test.__init__ (self, *args)
+    self.outFile = self.destFile
+    self.expectedFile = "{}/{}/expected/{}.S".format (basePath, self.section, self.baseName)
+
+  def key (self, env):
+    parts = [hashFile ("61ccc"), hashFile (self.source), hashFile (self.expectedFile), env.get ("CGENFLAGS", "")]
+    return hashlib.sha256 ("\n".join (parts).encode ()).hexdigest ()
+
+  def run (self, env):
+    start = time.time ()
+    lineEnv = dict (env)
+    lineEnv["CGENFLAGS"] = "{} --line-info".format (env.get ("CGENFLAGS", "")).strip ()
+    with open (self.destFile, "w") as outputFile:
+      res = subprocess.run (["./61ccc", "-c", self.source], stdout=outputFile, env=lineEnv)
+    if res.returncode:
+      self.result = "compile error"
+    else:
+      with open (self.destFile, "rb") as output, open (self.expectedFile, "rb") as expected:
+        self.result = "passed" if output.read () == expected.read () else "failed"
+    self.seconds = time.time () - start
+    return self
+
+class SimulatorTest (Test):
+  # Runs hand written assembly in 61csim and compares what it prints, what
+  # it reports on stderr and its exit status
+  inputPattern = re.compile ("(.+)\.S$")
+
+  def __init__ (self, *args):
+    Test.__init__ (self, *args)
+    self.source = "{}/{}/inputs/{}.S".format (basePath, self.section, self.baseName)
+    self.appended = []
+
+  def key (self, env):
+    parts = [hashFile ("61csim"), hashFile (self.source), hashFile (self.expectedFile)]
+    return hashlib.sha256 ("\n".join (parts).encode ()).hexdigest ()
+
+  def simulate (self, env, options=[]):
+    res = subprocess.run (["./61csim"] + options + [self.source], stdout=subprocess.PIPE, stderr=subprocess.PIPE, env=env)
+    report = res.stdout.decode ()
+    report += "".join ("stderr: {}\n".format (line) for line in res.stderr.decode ().splitlines ())
+    return report + "exit status {}\n".format (res.returncode)
+
+  def run (self, env):
+    start = time.time ()
+    report = self.simulate (env)
+    with open (self.outFile, "w") as f:
+      f.write (report)
+    with open (self.expectedFile) as expected:
+      self.result = "passed" if report == expected.read () else "failed"
+    self.seconds = time.time () - start
+    return self
+
+class ProfileTest (SimulatorTest):
+  # Also compares the --profile and --folded files 61csim writes, which
+  # rank the functions and lines that ran the most
+  def simulate (self, env):
+    paths = {name: "{}/{}/outputs/{}-{}.txt".format (basePath, self.section, self.baseName, name) for name in ["profile", "folded"]}
+    for path in paths.values ():
+      if os.path.exists (path):
+        os.remove (path)
+    report = SimulatorTest.simulate (self, env, ["--profile", paths["profile"], "--folded", paths["folded"]])
+    for name, path in paths.items ():
+      if os.path.exists (path):
+        with open (path) as f:
+          report += "{}:\n{}".format (name, f.read ())
+    return report
+
+# Sections whose tests are not compiled and run in venus
+testKinds = {"elf": ElfTest, "line-info": LineInfoTest, "simulator": SimulatorTest, "profile": ProfileTest}
+
+def loadCache ():
+  try:
+    with open (cacheFile) as f:
+      return json.load (f)
+  except (OSError, ValueError):
+    return {}
+
+def saveCache (cache):
+  with open (cacheFile + ".tmp", "w") as f:
+    json.dump (cache, f, indent=1, sort_keys=True)
+  os.replace (cacheFile + ".tmp", cacheFile)
+
+def writeJson (path, tests):
+  results = [{"name": t.name, "result": t.result, "seconds": round (t.seconds, 3), "cached": t.cached} for t in tests]
+  with open (path, "w") as f:
+    json.dump ({"tests": results}, f, indent=1)
+
+def writeJUnit (path, tests):
+  failures = sum (1 for t in tests if t.result in ("failed", "compile error"))
+  with open (path, "w") as f:
+    f.write ("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n")
+    f.write ("<testsuite name=\"61ccc\" tests=\"{}\" failures=\"{}\" time=\"{:.3f}\">\n".format (len (tests), failures, sum (t.seconds for t in tests)))
+    for t in tests:
+      f.write ("  <testcase classname={} name={} time=\"{:.3f}\"".format (quoteattr (t.section), quoteattr (t.baseName), t.seconds))
+      if t.result in ("failed", "compile error"):
+        f.write (">\n    <failure message={}/>\n  </testcase>\n".format (quoteattr (t.result)))
+      else:
+        f.write ("/>\n")
+    f.write ("</testsuite>\n")
+
+def collectTests (section, staffTests, registerArgs, native):
   # Next we want to get the list of all files for the tests we will be running
   files = os.listdir ("{}/{}/inputs".format (basePath, section))
 
   # Verify that the outputs folder exists
-  with open ("/dev/null", "w") as f:
-    subprocess.run (["mkdir", "-p", "{}/{}/outputs".format (basePath, section)], stdout=f, stderr=f)
- 
-  totalTests = 0
-  testsPassed = 0
- 
-  # Now iterate through every file to produce results
-  for f in files:
+  os.makedirs ("{}/{}/outputs".format (basePath, section), exist_ok=True)
+
+  kind = testKinds.get (section, Test)
+  tests = []
+  for f in sorted (files):
     # Select the base name of the test
-    baseMatch = filenamePattern.match (f)
+    baseMatch = kind.inputPattern.match (f)
     if baseMatch:
       baseName = baseMatch.group (1)
-      totalTests += 1
-      # Run the compiler on the file and place the output in output
-      destFile = "{}-output.S".format (baseName)
-      with open ("{}/{}/outputs/{}".format (basePath, section, destFile), "w") as outputFile:
-        res = subprocess.run (["./61ccc", "-c", "{}/{}/inputs/{}".format (basePath, section, f)], stdout=outputFile)
-      if res.returncode:
+      # Hand written assembly passes arguments on the stack
+      if registerArgs and ("{}.s".format (baseName) in files or "{}.S".format (baseName) in files):
+        continue
+      tests.append (kind (section, baseName, files, staffTests, registerArgs, native))
+  return tests
+
+def main (sections, registerArgs=False, jobs=None, useCache=True, jsonPath=None, junitPath=None, native=False):
+  # Code using the register calling convention needs the matching library
+  env = dict (os.environ)
+  if registerArgs:
+    env["CGENFLAGS"] = (env.get ("CGENFLAGS", "") + " --register-args").strip ()
+
+  tests = []
+  for section, staffTests in sections:
+    tests += collectTests (section, staffTests, registerArgs, native)
+
+  # Passing tests whose inputs have not changed are not run again
+  cache = loadCache () if useCache else {}
+  flags = env.get ("CGENFLAGS", "")
+  toRun = []
+  for t in tests:
+    t.cacheName = "{} {}{}".format (t.name, flags, " native" if native else "").strip ()
+    entry = cache.get (t.cacheName)
+    if t.staffTests and entry is not None and entry["key"] == t.key (env) and os.path.exists (t.outFile):
+      t.result = "passed"
+      t.cached = True
+      t.seconds = entry["seconds"]
+    else:
+      toRun.append (t)
+
+  # Every test compiles and runs in its own processes, so threads are enough
+  with concurrent.futures.ThreadPoolExecutor (max_workers=jobs or os.cpu_count ()) as pool:
+    for t in pool.map (lambda t: t.run (env), toRun):
+      print ("{:<50} {:<14} {:6.2f}s".format (t.name, t.result, t.seconds))
+      if t.result == "compile error":
         print ("Error in compiling the test.", file=sys.stderr)
-      else:
-        # Check if there is a .s/.S file to append to the output
-        assemFile = "{}.S".format (baseName)
-        if assemFile in files:
-          with open ("{}/{}/outputs/{}".format (basePath, section, destFile), "a") as outputFile:
-            subprocess.run (["cat", "{}/{}/inputs/{}".format (basePath, section, assemFile)], stdout=outputFile)
-        assemFile = "{}.s".format (baseName)
-        if assemFile in files:
-          with open ("{}/{}/outputs/{}".format (basePath, section, destFile), "a") as outputFile:
-            subprocess.run (["cat", "{}/{}/inputs/{}".format (basePath, section, assemFile)], stdout=outputFile)
-
-        # Append the print library to the file
-        with open ("{}/{}/outputs/{}".format (basePath, section, destFile), "a") as outputFile:
-          subprocess.run (["cat", "cgen-lib/print.s"], stdout=outputFile)
-
-        # Run the actual file through venus
-        with open ("{}/{}/outputs/{}.out".format (basePath, section, baseName), "w") as outputFile:
-          res = subprocess.run (["java", "-jar", "venus.jar", "{}/{}/outputs/{}".format (basePath, section, destFile)], stdout=outputFile)
-          ret1 = res.returncode
-
-        if staffTests:
-          # Record and compare the result of the output
-          res = subprocess.run (["diff", "{}/{}/outputs/{}.out".format (basePath, section, baseName), "{}/{}/expected/{}.out".format (basePath, section, baseName)])
-          if res.returncode == 0:
-            testsPassed += 1
-          else:
-            # Output whether/where it matched
-            print ("Difference between output and expected output for {0}. Run:\n\n\ndiff {1}/{2}/outputs/{3}.out {1}/{2}/expected/{3}.out\n\n\n To view the differences.".format (f, basePath, section, baseName), file=sys.stderr)
-  
-  if staffTests:
-    # Provide a hollistic output on the results for that part
-    print ("{}: {}/{} Tests Passed".format (section, testsPassed, totalTests))
+      elif t.result == "failed":
+        # Output whether/where it matched
+        print ("Difference between output and expected output for {0}. Run:\n\n\ndiff {1} {2}\n\n\n To view the differences.".format (os.path.basename (t.source), t.outFile, t.expectedFile), file=sys.stderr)
+
+  for t in tests:
+    if t.result == "passed" and not t.cached:
+      cache[t.cacheName] = {"key": t.key (env), "seconds": round (t.seconds, 3)}
+    elif t.result != "passed":
+      cache.pop (t.cacheName, None)
+  if useCache:
+    saveCache (cache)
+
+  # Provide a hollistic output on the results for each part
+  for section, staffTests in sections:
+    if staffTests:
+      sectionTests = [t for t in tests if t.section == section]
+      testsPassed = sum (1 for t in sectionTests if t.result == "passed")
+      cached = sum (1 for t in sectionTests if t.cached)
+      print ("{}: {}/{} Tests Passed ({} unchanged)".format (section, testsPassed, len (sectionTests), cached))
+
+  if jsonPath:
+    writeJson (jsonPath, tests)
+  if junitPath:
+    writeJUnit (junitPath, tests)
 
 if __name__ == "__main__":
-  parser = argparse.ArgumentParser (description="Runs all of the .")
-  parser.add_argument ("--section", type=int, dest="section", help="Determines what stage of tests to run")
-  stages = ["part1", "part2", "part3", "part4", "part5", "part6", "integration"]
+  parser = argparse.ArgumentParser (description="Compiles and runs the tests of each section in parallel.")
+  parser.add_argument ("--section", type=int, dest="section", action="append", help="Determines what stage of tests to run, may be given more than once")
+  parser.add_argument ("--register-args", action="store_true", dest="registerArgs", help="Pass arguments in registers")
+  parser.add_argument ("--native", action="store_true", dest="native", help="Run the tests with ./61csim instead of venus")
+  parser.add_argument ("--jobs", type=int, dest="jobs", help="Number of tests to run at once, all cores by default")
+  parser.add_argument ("--no-cache", action="store_false", dest="useCache", help="Run every test even if nothing it depends on changed")
+  parser.add_argument ("--json", dest="jsonPath", help="Write the results as JSON to this file")
+  parser.add_argument ("--junit", dest="junitPath", help="Write the results as JUnit XML to this file")
   items = parser.parse_args ()
-  if items.section == 0:
-    main ("student-tests", False) 
-  elif items.section < 1 or items.section > 7:
+  sections = []
+  for section in items.section or []:
+    if section == 0:
+      sections.append (("student-tests", False))
+    elif section < 1 or section > len (stages):
+      print ("Invalid Argument")
+      sys.exit (1)
+    else:
+      sections.append ((stages[section - 1], True))
+  if not sections:
     print ("Invalid Argument")
-    os.exit (1)
-  else:
-    main (stages[items.section - 1], True)
+    sys.exit (1)
+  main (sections, items.registerArgs, items.jobs, items.useCache, items.jsonPath, items.junitPath, items.native)
@@ -0,0 +1,899 @@
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "intern-pool.h"
+#include "rv-assembler.h"
+#include "utils.h"
+
+/* An instruction takes at most MAX_OPERANDS, a directive like .word more. */
+#define MAX_OPERANDS 3
+#define MAX_TOKENS 64
+
+/* Major opcodes of the instructions we encode. */
+#define OPCODE_LOAD 0x03
+#define OPCODE_OP_IMM 0x13
+#define OPCODE_AUIPC 0x17
+#define OPCODE_STORE 0x23
+#define OPCODE_OP 0x33
+#define OPCODE_LUI 0x37
+#define OPCODE_BRANCH 0x63
+#define OPCODE_JALR 0x67
+#define OPCODE_JAL 0x6f
+#define OPCODE_SYSTEM 0x73
+
+#define REG_ZERO 0
+#define REG_FILE_SIZE 32
+
+/* Reach of the pc relative offsets, in bytes either way. */
+#define BRANCH_REACH (1 << 12)
+#define JAL_REACH (1 << 20)
+
+static const char* rvRegNames[REG_FILE_SIZE] = {
+  "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2",
+  "s0", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+  "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7",
+  "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6"
+};
+
+/*
+ *  Operand layouts of the base instructions. Memory operands are split by
+ *  the tokenizer into the register followed by the offset, so loads and
+ *  jalr share RV_I and stores take rs2 rs1 imm.
+ */
+enum rvFormat {
+  RV_R,               /* op rd rs1 rs2                          */
+  RV_I,               /* op rd rs1 imm                          */
+  RV_SHIFT,           /* op rd rs1 shamt                        */
+  RV_S,               /* op rs2 rs1 imm                         */
+  RV_B,               /* op rs1 rs2 label                       */
+  RV_U,               /* op rd imm                              */
+  RV_J,               /* op rd label                            */
+  RV_SYSTEM           /* op                                     */
+};
+
+typedef struct rvOp {
+  char* name;
+  enum rvFormat format;
+  uint32_t opcode;
+  uint32_t funct3;
+  uint32_t funct7;    /* Also holds the immediate of ecall and ebreak.    */
+} RVOp;
+
+static const RVOp rvOps[] = {
+  {"add", RV_R, OPCODE_OP, 0x0, 0x00},
+  {"sub", RV_R, OPCODE_OP, 0x0, 0x20},
+  {"sll", RV_R, OPCODE_OP, 0x1, 0x00},
+  {"slt", RV_R, OPCODE_OP, 0x2, 0x00},
+  {"sltu", RV_R, OPCODE_OP, 0x3, 0x00},
+  {"xor", RV_R, OPCODE_OP, 0x4, 0x00},
+  {"srl", RV_R, OPCODE_OP, 0x5, 0x00},
+  {"sra", RV_R, OPCODE_OP, 0x5, 0x20},
+  {"or", RV_R, OPCODE_OP, 0x6, 0x00},
+  {"and", RV_R, OPCODE_OP, 0x7, 0x00},
+  {"mul", RV_R, OPCODE_OP, 0x0, 0x01},
+  {"mulh", RV_R, OPCODE_OP, 0x1, 0x01},
+  {"mulhsu", RV_R, OPCODE_OP, 0x2, 0x01},
+  {"mulhu", RV_R, OPCODE_OP, 0x3, 0x01},
+  {"div", RV_R, OPCODE_OP, 0x4, 0x01},
+  {"divu", RV_R, OPCODE_OP, 0x5, 0x01},
+  {"rem", RV_R, OPCODE_OP, 0x6, 0x01},
+  {"remu", RV_R, OPCODE_OP, 0x7, 0x01},
+  {"addi", RV_I, OPCODE_OP_IMM, 0x0, 0},
+  {"slti", RV_I, OPCODE_OP_IMM, 0x2, 0},
+  {"sltiu", RV_I, OPCODE_OP_IMM, 0x3, 0},
+  {"xori", RV_I, OPCODE_OP_IMM, 0x4, 0},
+  {"ori", RV_I, OPCODE_OP_IMM, 0x6, 0},
+  {"andi", RV_I, OPCODE_OP_IMM, 0x7, 0},
+  {"slli", RV_SHIFT, OPCODE_OP_IMM, 0x1, 0x00},
+  {"srli", RV_SHIFT, OPCODE_OP_IMM, 0x5, 0x00},
+  {"srai", RV_SHIFT, OPCODE_OP_IMM, 0x5, 0x20},
+  {"lb", RV_I, OPCODE_LOAD, 0x0, 0},
+  {"lh", RV_I, OPCODE_LOAD, 0x1, 0},
+  {"lw", RV_I, OPCODE_LOAD, 0x2, 0},
+  {"lbu", RV_I, OPCODE_LOAD, 0x4, 0},
+  {"lhu", RV_I, OPCODE_LOAD, 0x5, 0},
+  {"jalr", RV_I, OPCODE_JALR, 0x0, 0},
+  {"sb", RV_S, OPCODE_STORE, 0x0, 0},
+  {"sh", RV_S, OPCODE_STORE, 0x1, 0},
+  {"sw", RV_S, OPCODE_STORE, 0x2, 0},
+  {"beq", RV_B, OPCODE_BRANCH, 0x0, 0},
+  {"bne", RV_B, OPCODE_BRANCH, 0x1, 0},
+  {"blt", RV_B, OPCODE_BRANCH, 0x4, 0},
+  {"bge", RV_B, OPCODE_BRANCH, 0x5, 0},
+  {"bltu", RV_B, OPCODE_BRANCH, 0x6, 0},
+  {"bgeu", RV_B, OPCODE_BRANCH, 0x7, 0},
+  {"lui", RV_U, OPCODE_LUI, 0, 0},
+  {"auipc", RV_U, OPCODE_AUIPC, 0, 0},
+  {"jal", RV_J, OPCODE_JAL, 0, 0},
+  {"ecall", RV_SYSTEM, OPCODE_SYSTEM, 0, 0},
+  {"ebreak", RV_SYSTEM, OPCODE_SYSTEM, 0, 1},
+};
+
+#define RV_OP_TOTAL (sizeof(rvOps) / sizeof(rvOps[0]))
+
+/* Number of operands each format takes. */
+static const int rvOperandTotals[] = {
+  [RV_R] = 3, [RV_I] = 3, [RV_SHIFT] = 3, [RV_S] = 3,
+  [RV_B] = 3, [RV_U] = 2, [RV_J] = 2, [RV_SYSTEM] = 0
+};
+
+/*
+ *  A pseudo instruction that stands for a single base instruction. Operands
+ *  of the form %n are replaced by the nth operand of the pseudo instruction.
+ *  li and la expand to more than one instruction and are handled on their
+ *  own.
+ */
+typedef struct rvPseudo {
+  char* name;
+  int operandTotal;
+  char* base;
+  char* operands[MAX_OPERANDS];
+} RVPseudo;
+
+static const RVPseudo rvPseudos[] = {
+  {"nop", 0, "addi", {"x0", "x0", "0"}},
+  {"mv", 2, "addi", {"%1", "%2", "0"}},
+  {"not", 2, "xori", {"%1", "%2", "-1"}},
+  {"neg", 2, "sub", {"%1", "x0", "%2"}},
+  {"seqz", 2, "sltiu", {"%1", "%2", "1"}},
+  {"snez", 2, "sltu", {"%1", "x0", "%2"}},
+  {"sltz", 2, "slt", {"%1", "%2", "x0"}},
+  {"sgtz", 2, "slt", {"%1", "x0", "%2"}},
+  {"beqz", 2, "beq", {"%1", "x0", "%2"}},
+  {"bnez", 2, "bne", {"%1", "x0", "%2"}},
+  {"bltz", 2, "blt", {"%1", "x0", "%2"}},
+  {"bgez", 2, "bge", {"%1", "x0", "%2"}},
+  {"blez", 2, "bge", {"x0", "%1", "%2"}},
+  {"bgtz", 2, "blt", {"x0", "%1", "%2"}},
+  {"bgt", 3, "blt", {"%2", "%1", "%3"}},
+  {"ble", 3, "bge", {"%2", "%1", "%3"}},
+  {"bgtu", 3, "bltu", {"%2", "%1", "%3"}},
+  {"bleu", 3, "bgeu", {"%2", "%1", "%3"}},
+  {"j", 1, "jal", {"x0", "%1"}},
+  {"jal", 1, "jal", {"ra", "%1"}},
+  {"call", 1, "jal", {"ra", "%1"}},
+  {"tail", 1, "jal", {"x0", "%1"}},
+  {"jr", 1, "jalr", {"x0", "%1", "0"}},
+  {"jalr", 1, "jalr", {"ra", "%1", "0"}},
+  {"jalr", 2, "jalr", {"%1", "%2", "0"}},
+  {"ret", 0, "jalr", {"x0", "ra", "0"}},
+};
+
+#define RV_PSEUDO_TOTAL (sizeof(rvPseudos) / sizeof(rvPseudos[0]))
+
+/*
+ *  A label used before the end of the file. Branches and jumps to a label
+ *  in their own section are patched once it is known, everything else is
+ *  turned into a relocation.
+ */
+typedef struct fixup {
+  enum relocType type;
+  enum objSection section;
+  uint32_t offset;
+  size_t symbol;
+  int line;
+} Fixup;
+
+typedef struct assembler {
+  ObjectCode* code;
+  const char* name;
+  char* file;         /* Interned name, for the line table.               */
+  int line;
+  char* sourceFile;   /* Set by the last LINE_MARKER, or NULL.            */
+  int sourceLine;
+  int errorTotal;
+  enum objSection section;
+  size_t* buckets;    /* Symbol index plus one, or 0 for an empty slot.   */
+  size_t bucketTotal;
+  Fixup* fixups;
+  size_t fixupSize;
+  size_t fixupCapacity;
+} Assembler;
+
+static void AsmError(Assembler* as, const char* message, const char* token) {
+  if (token == NULL) {
+    fprintf(stderr, "Error: %s line %d: %s.\n", as->name, as->line, message);
+  } else {
+    fprintf(stderr, "Error: %s line %d: %s %s.\n", as->name, as->line, message, token);
+  }
+  as->errorTotal++;
+}
+
+/*
+ *  Makes sure array, holding size elements of elemSize bytes, has room for
+ *  one more and returns it.
+ */
+static void* GrowArray(void* array, size_t size, size_t* capacity, size_t elemSize) {
+  if (size == *capacity) {
+    *capacity = *capacity ? *capacity * 2 : INITIAL_CAPACITY;
+    array = realloc(array, elemSize * *capacity);
+    if (array == NULL) {
+      AllocationFailed();
+    }
+  }
+  return array;
+}
+
+static uint32_t EncodeR(uint32_t funct7, int rs2, int rs1, uint32_t funct3, int rd, uint32_t opcode) {
+  return funct7 << 25 | (uint32_t) rs2 << 20 | (uint32_t) rs1 << 15 | funct3 << 12 | (uint32_t) rd << 7 | opcode;
+}
+
+static uint32_t EncodeI(int32_t imm, int rs1, uint32_t funct3, int rd, uint32_t opcode) {
+  return ((uint32_t) imm & 0xfff) << 20 | (uint32_t) rs1 << 15 | funct3 << 12 | (uint32_t) rd << 7 | opcode;
+}
+
+static uint32_t EncodeS(int32_t imm, int rs2, int rs1, uint32_t funct3, uint32_t opcode) {
+  uint32_t bits = (uint32_t) imm;
+  return (bits >> 5 & 0x7f) << 25 | (uint32_t) rs2 << 20 | (uint32_t) rs1 << 15 | funct3 << 12 |
+         (bits & 0x1f) << 7 | opcode;
+}
+
+static uint32_t EncodeB(int32_t offset, int rs2, int rs1, uint32_t funct3, uint32_t opcode) {
+  uint32_t bits = (uint32_t) offset;
+  return (bits >> 12 & 0x1) << 31 | (bits >> 5 & 0x3f) << 25 | (uint32_t) rs2 << 20 | (uint32_t) rs1 << 15 |
+         funct3 << 12 | (bits >> 1 & 0xf) << 8 | (bits >> 11 & 0x1) << 7 | opcode;
+}
+
+static uint32_t EncodeU(uint32_t imm, int rd, uint32_t opcode) {
+  return (imm & 0xfffff) << 12 | (uint32_t) rd << 7 | opcode;
+}
+
+static uint32_t EncodeJ(int32_t offset, int rd, uint32_t opcode) {
+  uint32_t bits = (uint32_t) offset;
+  return (bits >> 20 & 0x1) << 31 | (bits >> 1 & 0x3ff) << 21 | (bits >> 11 & 0x1) << 20 |
+         (bits >> 12 & 0xff) << 12 | (uint32_t) rd << 7 | opcode;
+}
+
+static void AppendBytes(ObjSectionData* section, const uint8_t* bytes, size_t total) {
+  if (section->size + total > section->capacity) {
+    size_t capacity = section->capacity ? section->capacity : INITIAL_CAPACITY;
+    while (section->size + total > capacity) {
+      capacity *= 2;
+    }
+    section->bytes = realloc(section->bytes, capacity);
+    if (section->bytes == NULL) {
+      AllocationFailed();
+    }
+    section->capacity = capacity;
+  }
+  memcpy(section->bytes + section->size, bytes, total);
+  section->size += total;
+}
+
+/*
+ *  Appends a value of size bytes in little endian order, whatever the host.
+ */
+static void AppendValue(Assembler* as, uint32_t value, size_t size) {
+  uint8_t bytes[4];
+  for (size_t i = 0; i < size; i++) {
+    bytes[i] = (uint8_t) (value >> (8 * i));
+  }
+  AppendBytes(&as->code->sections[as->section], bytes, size);
+}
+
+static uint32_t ReadWord(const uint8_t* bytes) {
+  return (uint32_t) bytes[0] | (uint32_t) bytes[1] << 8 | (uint32_t) bytes[2] << 16 | (uint32_t) bytes[3] << 24;
+}
+
+static void WriteWord(uint8_t* bytes, uint32_t word) {
+  for (int i = 0; i < 4; i++) {
+    bytes[i] = (uint8_t) (word >> (8 * i));
+  }
+}
+
+/*
+ *  Records that the word about to be emitted came from the current line,
+ *  unless the previous word did too.
+ */
+static void AddLine(Assembler* as) {
+  ObjectCode* code = as->code;
+  ObjLine* last = code->lineSize != 0 ? &code->lines[code->lineSize - 1] : NULL;
+  char* file = as->sourceFile != NULL ? as->sourceFile : as->file;
+  int line = as->sourceFile != NULL ? as->sourceLine : as->line;
+  if (last != NULL && last->file == file && last->line == line) {
+    return;
+  }
+  code->lines = GrowArray(code->lines, code->lineSize, &code->lineCapacity, sizeof(ObjLine));
+  code->lines[code->lineSize].offset = (uint32_t) code->sections[OBJ_TEXT].size;
+  code->lines[code->lineSize].file = file;
+  code->lines[code->lineSize].line = line;
+  code->lineSize++;
+}
+
+/*
+ *  Reads the comment after the #, which may be a LINE_MARKER. Comments
+ *  that only look like one, such as "# line up the stack", are ignored.
+ */
+static void ReadComment(Assembler* as, char* comment) {
+  size_t length = strlen(LINE_MARKER);
+  while (isspace((unsigned char) *comment)) {
+    comment++;
+  }
+  if (strncmp(comment, LINE_MARKER, length) != 0 || (comment[length] != '\0' && !isspace((unsigned char) comment[length]))) {
+    return;
+  }
+  char* location = comment + length;
+  while (isspace((unsigned char) *location)) {
+    location++;
+  }
+  char* end = location + strlen(location);
+  while (end > location && isspace((unsigned char) end[-1])) {
+    end--;
+  }
+  if (end == location) {
+    as->sourceFile = NULL;
+    return;
+  }
+  /* File names may hold colons, so the line is after the last one. */
+  char* colon = end - 1;
+  while (colon > location && *colon != ':') {
+    colon--;
+  }
+  char* lineEnd;
+  long line = strtol(colon + 1, &lineEnd, 10);
+  if (colon == location || lineEnd != end || line <= 0 || line > INT_MAX) {
+    return;
+  }
+  *colon = '\0';
+  as->sourceFile = InternString(location);
+  as->sourceLine = (int) line;
+}
+
+static void EmitWord(Assembler* as, uint32_t word) {
+  if (as->section != OBJ_TEXT) {
+    AsmError(as, "Instructions must be in .text", NULL);
+  } else {
+    AddLine(as);
+  }
+  AppendValue(as, word, 4);
+}
+
+static uint32_t HashName(const char* name) {
+  uint32_t hash = 2166136261u;
+  for (; *name != '\0'; name++) {
+    hash = (hash ^ (uint8_t) *name) * 16777619u;
+  }
+  return hash;
+}
+
+/*
+ *  Doubles the symbol table once it is half full.
+ */
+static void GrowBuckets(Assembler* as) {
+  size_t bucketTotal = as->bucketTotal ? as->bucketTotal * 2 : INITIAL_CAPACITY * 8;
+  size_t* buckets = calloc(bucketTotal, sizeof(size_t));
+  if (buckets == NULL) {
+    AllocationFailed();
+  }
+  for (size_t i = 0; i < as->code->symbolSize; i++) {
+    size_t slot = HashName(as->code->symbols[i].name) & (bucketTotal - 1);
+    while (buckets[slot] != 0) {
+      slot = (slot + 1) & (bucketTotal - 1);
+    }
+    buckets[slot] = i + 1;
+  }
+  free(as->buckets);
+  as->buckets = buckets;
+  as->bucketTotal = bucketTotal;
+}
+
+/*
+ *  Returns the index of the symbol called name, adding it as an undefined
+ *  symbol if it has not been seen yet.
+ */
+static size_t FindSymbol(Assembler* as, const char* name) {
+  ObjectCode* code = as->code;
+  size_t slot;
+  if (2 * (code->symbolSize + 1) > as->bucketTotal) {
+    GrowBuckets(as);
+  }
+  slot = HashName(name) & (as->bucketTotal - 1);
+  while (as->buckets[slot] != 0) {
+    if (strcmp(code->symbols[as->buckets[slot] - 1].name, name) == 0) {
+      return as->buckets[slot] - 1;
+    }
+    slot = (slot + 1) & (as->bucketTotal - 1);
+  }
+  code->symbols = GrowArray(code->symbols, code->symbolSize, &code->symbolCapacity, sizeof(ObjSymbol));
+  ObjSymbol* symbol = &code->symbols[code->symbolSize];
+  symbol->name = malloc(strlen(name) + 1);
+  if (symbol->name == NULL) {
+    AllocationFailed();
+  }
+  strcpy(symbol->name, name);
+  symbol->defined = 0;
+  symbol->global = 0;
+  symbol->section = OBJ_TEXT;
+  symbol->offset = 0;
+  as->buckets[slot] = ++code->symbolSize;
+  return code->symbolSize - 1;
+}
+
+static void DefineLabel(Assembler* as, const char* name) {
+  size_t index = FindSymbol(as, name);
+  ObjSymbol* symbol = &as->code->symbols[index];
+  if (symbol->defined) {
+    AsmError(as, "Duplicate label", name);
+    return;
+  }
+  symbol->defined = 1;
+  symbol->global |= strncmp(name, LOCAL_LABEL_PREFIX, strlen(LOCAL_LABEL_PREFIX)) != 0;
+  symbol->section = as->section;
+  symbol->offset = (uint32_t) as->code->sections[as->section].size;
+}
+
+/*
+ *  Records that the word about to be emitted refers to label.
+ */
+static void AddFixup(Assembler* as, enum relocType type, const char* label) {
+  as->fixups = GrowArray(as->fixups, as->fixupSize, &as->fixupCapacity, sizeof(Fixup));
+  Fixup* fixup = &as->fixups[as->fixupSize++];
+  fixup->type = type;
+  fixup->section = as->section;
+  fixup->offset = (uint32_t) as->code->sections[as->section].size;
+  fixup->symbol = FindSymbol(as, label);
+  fixup->line = as->line;
+}
+
+static int ParseReg(Assembler* as, const char* token) {
+  if (strcmp(token, "fp") == 0) {
+    return 8;
+  }
+  if (token[0] == 'x' && isdigit((unsigned char) token[1])) {
+    char* end;
+    long value = strtol(token + 1, &end, 10);
+    if (*end == '\0' && value < REG_FILE_SIZE) {
+      return (int) value;
+    }
+  }
+  for (int i = 0; i < REG_FILE_SIZE; i++) {
+    if (strcmp(rvRegNames[i], token) == 0) {
+      return i;
+    }
+  }
+  AsmError(as, "Unknown register", token);
+  return REG_ZERO;
+}
+
+/*
+ *  Parses a decimal, 0x hexadecimal or 0b binary integer, or a character
+ *  literal, that fits in 32 bits. Returns 0 if token is not one.
+ */
+static int ParseNumber(const char* token, int32_t* value) {
+  int negative = *token == '-';
+  int base = 10;
+  const char* digits = token + (*token == '-' || *token == '+');
+  char* end;
+  long long magnitude;
+  if (token[0] == '\'' && token[1] != '\0' && token[2] == '\'' && token[3] == '\0') {
+    *value = (unsigned char) token[1];
+    return 1;
+  }
+  if (digits[0] == '0' && (digits[1] == 'x' || digits[1] == 'X')) {
+    base = 16;
+    digits += 2;
+  } else if (digits[0] == '0' && (digits[1] == 'b' || digits[1] == 'B')) {
+    base = 2;
+    digits += 2;
+  }
+  if (!isxdigit((unsigned char) *digits)) {
+    return 0;
+  }
+  errno = 0;
+  magnitude = strtoll(digits, &end, base);
+  if (*end != '\0' || errno != 0 || magnitude > (negative ? 0x80000000LL : 0xffffffffLL)) {
+    return 0;
+  }
+  *value = (int32_t) (uint32_t) (negative ? -magnitude : magnitude);
+  return 1;
+}
+
+/*
+ *  Parses an immediate that must lie within [min, max].
+ */
+static int32_t ParseImm(Assembler* as, const char* token, int32_t min, int32_t max) {
+  int32_t value;
+  if (!ParseNumber(token, &value)) {
+    AsmError(as, "Invalid immediate", token);
+    return 0;
+  }
+  if (value < min || value > max) {
+    AsmError(as, "Immediate out of range", token);
+    return 0;
+  }
+  return value;
+}
+
+static void AssembleOp(Assembler* as, const RVOp* op, char** operands) {
+  switch (op->format) {
+    case RV_R:
+      EmitWord(as, EncodeR(op->funct7, ParseReg(as, operands[2]), ParseReg(as, operands[1]), op->funct3,
+                           ParseReg(as, operands[0]), op->opcode));
+      break;
+    case RV_I:
+      EmitWord(as, EncodeI(ParseImm(as, operands[2], -2048, 2047), ParseReg(as, operands[1]), op->funct3,
+                           ParseReg(as, operands[0]), op->opcode));
+      break;
+    case RV_SHIFT:
+      EmitWord(as, EncodeR(op->funct7, ParseImm(as, operands[2], 0, 31), ParseReg(as, operands[1]), op->funct3,
+                           ParseReg(as, operands[0]), op->opcode));
+      break;
+    case RV_S:
+      EmitWord(as, EncodeS(ParseImm(as, operands[2], -2048, 2047), ParseReg(as, operands[0]),
+                           ParseReg(as, operands[1]), op->funct3, op->opcode));
+      break;
+    case RV_B:
+      AddFixup(as, RELOC_BRANCH, operands[2]);
+      EmitWord(as, EncodeB(0, ParseReg(as, operands[1]), ParseReg(as, operands[0]), op->funct3, op->opcode));
+      break;
+    case RV_U:
+      EmitWord(as, EncodeU((uint32_t) ParseImm(as, operands[1], 0, 0xfffff), ParseReg(as, operands[0]),
+                           op->opcode));
+      break;
+    case RV_J:
+      AddFixup(as, RELOC_JAL, operands[1]);
+      EmitWord(as, EncodeJ(0, ParseReg(as, operands[0]), op->opcode));
+      break;
+    case RV_SYSTEM:
+      EmitWord(as, EncodeI((int32_t) op->funct7, REG_ZERO, 0, REG_ZERO, op->opcode));
+      break;
+  }
+}
+
+/*
+ *  li loads any 32 bit value, using lui for the upper bits when it does not
+ *  fit in the 12 bit immediate of addi.
+ */
+static void AssembleLi(Assembler* as, char** operands) {
+  int rd = ParseReg(as, operands[0]);
+  int32_t value = ParseImm(as, operands[1], INT32_MIN, INT32_MAX);
+  uint32_t upper = ((uint32_t) value + 0x800) >> 12;
+  int32_t lower = (int32_t) ((uint32_t) value & 0xfff);
+  if (lower >= 2048) {
+    lower -= 4096;
+  }
+  if (value >= -2048 && value <= 2047) {
+    EmitWord(as, EncodeI(value, REG_ZERO, 0x0, rd, OPCODE_OP_IMM));
+    return;
+  }
+  EmitWord(as, EncodeU(upper, rd, OPCODE_LUI));
+  if (lower != 0) {
+    EmitWord(as, EncodeI(lower, rd, 0x0, rd, OPCODE_OP_IMM));
+  }
+}
+
+/*
+ *  la loads an absolute address, which is only known once the object has
+ *  been linked, so both halves are always relocated.
+ */
+static void AssembleLa(Assembler* as, char** operands) {
+  int rd = ParseReg(as, operands[0]);
+  AddFixup(as, RELOC_HI20, operands[1]);
+  EmitWord(as, EncodeU(0, rd, OPCODE_LUI));
+  AddFixup(as, RELOC_LO12_I, operands[1]);
+  EmitWord(as, EncodeI(0, rd, 0x0, rd, OPCODE_OP_IMM));
+}
+
+static void AssembleInstruction(Assembler* as, char** tokens, int total) {
+  char* name = tokens[0];
+  char** operands = tokens + 1;
+  int operandTotal = total - 1;
+  if (strcmp(name, "li") == 0 || strcmp(name, "la") == 0) {
+    if (operandTotal != 2) {
+      AsmError(as, "Wrong number of operands for", name);
+    } else if (name[1] == 'i') {
+      AssembleLi(as, operands);
+    } else {
+      AssembleLa(as, operands);
+    }
+    return;
+  }
+  for (size_t i = 0; i < RV_PSEUDO_TOTAL; i++) {
+    const RVPseudo* pseudo = &rvPseudos[i];
+    if (strcmp(pseudo->name, name) == 0 && pseudo->operandTotal == operandTotal) {
+      char* expanded[MAX_TOKENS] = {pseudo->base};
+      int expandedTotal = 1;
+      for (int j = 0; j < MAX_OPERANDS && pseudo->operands[j] != NULL; j++) {
+        char* operand = pseudo->operands[j];
+        expanded[expandedTotal++] = operand[0] == '%' ? operands[operand[1] - '1'] : operand;
+      }
+      AssembleInstruction(as, expanded, expandedTotal);
+      return;
+    }
+  }
+  for (size_t i = 0; i < RV_OP_TOTAL; i++) {
+    if (strcmp(rvOps[i].name, name) == 0) {
+      if (rvOperandTotals[rvOps[i].format] != operandTotal) {
+        AsmError(as, "Wrong number of operands for", name);
+      } else {
+        AssembleOp(as, &rvOps[i], operands);
+      }
+      return;
+    }
+  }
+  AsmError(as, "Unknown instruction", name);
+}
+
+/*
+ *  Appends the contents of the string literal in text, handling the same
+ *  escapes as the compiler.
+ */
+static void AssembleString(Assembler* as, char* text, int terminate) {
+  char* p = strchr(text, '"');
+  if (p == NULL) {
+    AsmError(as, "Expected a string", NULL);
+    return;
+  }
+  for (p++; *p != '"'; p++) {
+    uint8_t c = (uint8_t) *p;
+    if (c == '\0') {
+      AsmError(as, "Unterminated string", NULL);
+      return;
+    }
+    if (c == '\\') {
+      p++;
+      switch (*p) {
+        case 'n': c = '\n'; break;
+        case 't': c = '\t'; break;
+        case '0': c = '\0'; break;
+        case '\0': AsmError(as, "Unterminated string", NULL); return;
+        default: c = (uint8_t) *p; break;
+      }
+    }
+    AppendBytes(&as->code->sections[as->section], &c, 1);
+  }
+  if (terminate) {
+    AppendValue(as, 0, 1);
+  }
+}
+
+static void AssembleDirective(Assembler* as, char** tokens, int total) {
+  char* name = tokens[0];
+  if (strcmp(name, ".text") == 0) {
+    as->section = OBJ_TEXT;
+  } else if (strcmp(name, ".data") == 0) {
+    as->section = OBJ_DATA;
+  } else if (strcmp(name, ".globl") == 0 || strcmp(name, ".global") == 0) {
+    for (int i = 1; i < total; i++) {
+      size_t index = FindSymbol(as, tokens[i]);
+      as->code->symbols[index].global = 1;
+    }
+  } else if (strcmp(name, ".word") == 0) {
+    for (int i = 1; i < total; i++) {
+      int32_t value = 0;
+      if (!ParseNumber(tokens[i], &value)) {
+        AddFixup(as, RELOC_32, tokens[i]);
+      }
+      AppendValue(as, (uint32_t) value, 4);
+    }
+  } else if (strcmp(name, ".half") == 0) {
+    for (int i = 1; i < total; i++) {
+      AppendValue(as, (uint32_t) ParseImm(as, tokens[i], INT16_MIN, UINT16_MAX), 2);
+    }
+  } else if (strcmp(name, ".byte") == 0) {
+    for (int i = 1; i < total; i++) {
+      AppendValue(as, (uint32_t) ParseImm(as, tokens[i], INT8_MIN, UINT8_MAX), 1);
+    }
+  } else if ((strcmp(name, ".space") == 0 || strcmp(name, ".zero") == 0) && total == 2) {
+    for (int32_t i = ParseImm(as, tokens[1], 0, INT32_MAX); i > 0; i--) {
+      AppendValue(as, 0, 1);
+    }
+  } else if (strcmp(name, ".align") == 0 && total == 2) {
+    uint32_t alignment = 1u << ParseImm(as, tokens[1], 0, 12);
+    while (as->code->sections[as->section].size % alignment != 0) {
+      AppendValue(as, 0, 1);
+    }
+  } else {
+    AsmError(as, "Unsupported directive", name);
+  }
+}
+
+/*
+ *  Splits line into tokens separated by whitespace or commas and returns how
+ *  many there are. A memory operand like 4(sp) becomes the register followed
+ *  by the offset, so that it reads the same as the operands of addi.
+ */
+static int Tokenize(Assembler* as, char* line, char** tokens) {
+  int total = 0;
+  char* p = line;
+  for (;;) {
+    while (isspace((unsigned char) *p) || *p == ',') {
+      p++;
+    }
+    if (*p == '\0') {
+      return total;
+    }
+    if (total + 2 > MAX_TOKENS) {
+      AsmError(as, "Too many operands on one line", NULL);
+      return 0;
+    }
+    char* start = p;
+    while (*p != '\0' && !isspace((unsigned char) *p) && *p != ',' && *p != '(') {
+      p++;
+    }
+    if (*p == '(') {
+      char* reg = p + 1;
+      char* close = strchr(reg, ')');
+      if (close == NULL) {
+        AsmError(as, "Expected )", NULL);
+        return 0;
+      }
+      *p = '\0';
+      *close = '\0';
+      tokens[total++] = reg;
+      tokens[total++] = p == start ? "0" : start;
+      p = close + 1;
+    } else {
+      tokens[total++] = start;
+      if (*p != '\0') {
+        *p++ = '\0';
+      }
+    }
+  }
+}
+
+static void AssembleLine(Assembler* as, char* line) {
+  char* tokens[MAX_TOKENS];
+  char* quote = strchr(line, '"');
+  char* comment = strchr(line, '#');
+  int total;
+  if (comment != NULL && (quote == NULL || comment < quote)) {
+    *comment = '\0';
+    ReadComment(as, comment + 1);
+  }
+  /* Any number of labels may come first. */
+  for (;;) {
+    char* end;
+    while (isspace((unsigned char) *line)) {
+      line++;
+    }
+    end = line;
+    while (*end != '\0' && *end != ':' && *end != '"' && !isspace((unsigned char) *end)) {
+      end++;
+    }
+    if (*end != ':' || end == line) {
+      break;
+    }
+    *end = '\0';
+    DefineLabel(as, line);
+    line = end + 1;
+  }
+  /* Strings are read from the raw line, since they may hold spaces. */
+  size_t nameLength = strcspn(line, " \t");
+  if (nameLength == strlen(".ascii") && strncmp(line, ".ascii", nameLength) == 0) {
+    AssembleString(as, line, 0);
+    return;
+  }
+  if ((nameLength == strlen(".asciiz") && strncmp(line, ".asciiz", nameLength) == 0) ||
+      (nameLength == strlen(".string") && strncmp(line, ".string", nameLength) == 0)) {
+    AssembleString(as, line, 1);
+    return;
+  }
+  total = Tokenize(as, line, tokens);
+  if (total == 0) {
+    return;
+  }
+  if (tokens[0][0] == '.') {
+    AssembleDirective(as, tokens, total);
+  } else {
+    AssembleInstruction(as, tokens, total);
+  }
+}
+
+static void AddReloc(ObjSectionData* section, uint32_t offset, size_t symbol, enum relocType type) {
+  section->relocs = GrowArray(section->relocs, section->relocSize, &section->relocCapacity, sizeof(ObjReloc));
+  section->relocs[section->relocSize].offset = offset;
+  section->relocs[section->relocSize].symbol = symbol;
+  section->relocs[section->relocSize].type = type;
+  section->relocSize++;
+}
+
+/*
+ *  Patches every branch and jump to a label defined in its own section and
+ *  turns the remaining fixups into relocations.
+ */
+static void ResolveFixups(Assembler* as) {
+  ObjectCode* code = as->code;
+  for (size_t i = 0; i < as->fixupSize; i++) {
+    Fixup* fixup = &as->fixups[i];
+    ObjSymbol* symbol = &code->symbols[fixup->symbol];
+    ObjSectionData* section = &code->sections[fixup->section];
+    int isJump = fixup->type == RELOC_BRANCH || fixup->type == RELOC_JAL;
+    as->line = fixup->line;
+    if (!symbol->defined && !symbol->global) {
+      if (strncmp(symbol->name, LOCAL_LABEL_PREFIX, strlen(LOCAL_LABEL_PREFIX)) == 0) {
+        AsmError(as, "Undefined local label", symbol->name);
+      }
+      symbol->global = 1;
+    }
+    if (isJump && symbol->defined && symbol->section == fixup->section) {
+      int32_t offset = (int32_t) (symbol->offset - fixup->offset);
+      int32_t reach = fixup->type == RELOC_BRANCH ? BRANCH_REACH : JAL_REACH;
+      uint32_t word = ReadWord(section->bytes + fixup->offset);
+      if (offset < -reach || offset >= reach) {
+        AsmError(as, "Jump out of range to", symbol->name);
+      } else if (fixup->type == RELOC_BRANCH) {
+        WriteWord(section->bytes + fixup->offset, word | EncodeB(offset, 0, 0, 0, 0));
+      } else {
+        WriteWord(section->bytes + fixup->offset, word | EncodeJ(offset, 0, 0));
+      }
+    } else {
+      AddReloc(section, fixup->offset, fixup->symbol, fixup->type);
+    }
+  }
+}
+
+ObjectCode* AssembleText(const char* text, size_t length, const char* name) {
+  Assembler as = {0};
+  char* copy = malloc(length + 1);
+  char* line;
+  as.code = calloc(1, sizeof(ObjectCode));
+  if (copy == NULL || as.code == NULL) {
+    AllocationFailed();
+  }
+  memcpy(copy, text, length);
+  copy[length] = '\0';
+  as.name = name;
+  as.file = InternString(name);
+  as.section = OBJ_TEXT;
+  line = copy;
+  while (line != NULL) {
+    char* newline = strchr(line, '\n');
+    if (newline != NULL) {
+      *newline = '\0';
+    }
+    as.line++;
+    AssembleLine(&as, line);
+    line = newline != NULL ? newline + 1 : NULL;
+  }
+  ResolveFixups(&as);
+  free(copy);
+  free(as.buckets);
+  free(as.fixups);
+  if (as.errorTotal != 0) {
+    FreeObjectCode(as.code);
+    return NULL;
+  }
+  return as.code;
+}
+
+ObjectCode* AssembleFile(const char* name) {
+  FILE* in = fopen(name, "r");
+  char chunk[DEFAULT_BUFFERSIZE];
+  char* text = NULL;
+  size_t size = 0;
+  size_t read;
+  ObjectCode* code;
+  if (in == NULL) {
+    fprintf(stderr, "Error: Could not open %s for reading.\n", name);
+    return NULL;
+  }
+  while ((read = fread(chunk, 1, sizeof(chunk), in)) != 0) {
+    text = realloc(text, size + read + 1);
+    if (text == NULL) {
+      AllocationFailed();
+    }
+    memcpy(text + size, chunk, read);
+    size += read;
+  }
+  fclose(in);
+  code = AssembleText(text != NULL ? text : "", size, name);
+  free(text);
+  return code;
+}
+
+void FreeObjectCode(ObjectCode* code) {
+  for (int i = 0; i < OBJ_SECTION_TOTAL; i++) {
+    free(code->sections[i].bytes);
+    free(code->sections[i].relocs);
+  }
+  for (size_t i = 0; i < code->symbolSize; i++) {
+    free(code->symbols[i].name);
+  }
+  free(code->symbols);
+  free(code->lines);
+  free(code);
+}
@@ -0,0 +1,110 @@
+/*
+ *  File that holds the assembler behind the machine code backend. It reads
+ *  the venus dialect the compiler and cgen-lib are written in, encodes each
+ *  instruction straight into its R, I, S, B, U or J format word and resolves
+ *  labels through a fixup table once every line has been read. References
+ *  that can not be resolved inside the file become relocations, so the
+ *  result can be written out as an object and linked with other objects.
+ */
+
+#ifndef RV_ASSEMBLER_H
+#define RV_ASSEMBLER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ *  Labels starting with this prefix, like __label__0 and __str__0, are
+ *  private to the file they are defined in. Every other label is exported,
+ *  since venus treats all of the files it is given as one program.
+ */
+#define LOCAL_LABEL_PREFIX "__"
+
+/*
+ *  Start of a comment marking where the instructions after it came from,
+ *  like "# line file.61c:12", which the line table then records in place
+ *  of the line of assembly they are on. A "# line" with nothing after it
+ *  goes back to the lines of assembly.
+ */
+#define LINE_MARKER "line"
+
+enum objSection {
+  OBJ_TEXT, OBJ_DATA,
+  OBJ_SECTION_TOTAL
+};
+
+/*
+ *  Relocation types, numbered as in the RISC-V ELF psABI.
+ */
+enum relocType {
+  RELOC_32 = 1,       /* .word label                                    */
+  RELOC_BRANCH = 16,  /* Conditional branch                             */
+  RELOC_JAL = 17,     /* j and jal                                      */
+  RELOC_HI20 = 26,    /* lui half of la                                 */
+  RELOC_LO12_I = 27   /* addi half of la                                */
+};
+
+typedef struct objSymbol {
+  char* name;
+  int defined;
+  int global;
+  enum objSection section;
+  uint32_t offset;
+} ObjSymbol;
+
+typedef struct objReloc {
+  uint32_t offset;    /* Offset of the word to patch in its section.      */
+  size_t symbol;      /* Index into the symbols of the object.            */
+  enum relocType type;
+} ObjReloc;
+
+typedef struct objSectionData {
+  uint8_t* bytes;
+  size_t size;
+  size_t capacity;
+  ObjReloc* relocs;
+  size_t relocSize;
+  size_t relocCapacity;
+} ObjSectionData;
+
+/*
+ *  Where the instructions from offset up to the next entry in the text came
+ *  from. The file is interned.
+ */
+typedef struct objLine {
+  uint32_t offset;
+  char* file;
+  int line;
+} ObjLine;
+
+/*
+ *  The assembled contents of a file.
+ */
+typedef struct objectCode {
+  ObjSectionData sections[OBJ_SECTION_TOTAL];
+  ObjSymbol* symbols;
+  size_t symbolSize;
+  size_t symbolCapacity;
+  ObjLine* lines;     /* Ordered by offset, for profiling the text.       */
+  size_t lineSize;
+  size_t lineCapacity;
+} ObjectCode;
+
+/*
+ *  Assembles length bytes of text. Reports every error to stderr, using name
+ *  to say where it is, and returns NULL if there were any.
+ */
+ObjectCode* AssembleText(const char* text, size_t length, const char* name);
+
+/*
+ *  Reads the whole file called name and assembles it. Returns NULL after
+ *  reporting to stderr if it could not be read or had errors.
+ */
+ObjectCode* AssembleFile(const char* name);
+
+/*
+ *  Frees the object and everything it owns.
+ */
+void FreeObjectCode(ObjectCode* code);
+
+#endif
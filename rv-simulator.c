@@ -0,0 +1,710 @@
+#include <stdlib.h>
+#include <string.h>
+#include "rv-simulator.h"
+#include "sim-profile.h"
+#include "utils.h"
+
+/* Major opcodes of the instructions we decode. */
+#define OPCODE_LOAD 0x03
+#define OPCODE_OP_IMM 0x13
+#define OPCODE_AUIPC 0x17
+#define OPCODE_STORE 0x23
+#define OPCODE_OP 0x33
+#define OPCODE_LUI 0x37
+#define OPCODE_BRANCH 0x63
+#define OPCODE_JALR 0x67
+#define OPCODE_JAL 0x6f
+#define OPCODE_SYSTEM 0x73
+
+#define FUNCT7_M 0x01
+#define FUNCT7_ALT 0x20
+
+#define REG_ZERO 0
+#define REG_RA 1
+#define REG_SP 2
+#define REG_GP 3
+#define REG_A0 10
+#define REG_A1 11
+#define REG_FILE_SIZE 32
+
+/* The ecalls of venus that cgen-lib makes. */
+#define ECALL_PRINT_INT 1
+#define ECALL_PRINT_STRING 4
+#define ECALL_SBRK 9
+#define ECALL_EXIT 10
+#define ECALL_PRINT_CHAR 11
+#define ECALL_EXIT2 17
+
+/* The stack may be read a little past its top, as venus allows. */
+#define STACK_SLACK 16
+
+/*
+ *  Operations of decoded instructions. auipc is folded into SIM_LUI, since
+ *  the address it is relative to is known once the program is linked.
+ */
+enum simOp {
+  SIM_LUI, SIM_JAL, SIM_JALR,
+  SIM_BEQ, SIM_BNE, SIM_BLT, SIM_BGE, SIM_BLTU, SIM_BGEU,
+  SIM_LB, SIM_LH, SIM_LW, SIM_LBU, SIM_LHU,
+  SIM_SB, SIM_SH, SIM_SW,
+  SIM_ADDI, SIM_SLTI, SIM_SLTIU, SIM_XORI, SIM_ORI, SIM_ANDI,
+  SIM_SLLI, SIM_SRLI, SIM_SRAI,
+  SIM_ADD, SIM_SUB, SIM_SLL, SIM_SLT, SIM_SLTU, SIM_XOR, SIM_SRL, SIM_SRA, SIM_OR, SIM_AND,
+  SIM_MUL, SIM_MULH, SIM_MULHSU, SIM_MULHU, SIM_DIV, SIM_DIVU, SIM_REM, SIM_REMU,
+  SIM_ECALL, SIM_EBREAK, SIM_ILLEGAL
+};
+
+/* Operations of each funct3, for the formats that are chosen by it alone. */
+static const uint8_t branchOps[8] = {
+  SIM_BEQ, SIM_BNE, SIM_ILLEGAL, SIM_ILLEGAL, SIM_BLT, SIM_BGE, SIM_BLTU, SIM_BGEU
+};
+static const uint8_t loadOps[8] = {
+  SIM_LB, SIM_LH, SIM_LW, SIM_ILLEGAL, SIM_LBU, SIM_LHU, SIM_ILLEGAL, SIM_ILLEGAL
+};
+static const uint8_t storeOps[8] = {
+  SIM_SB, SIM_SH, SIM_SW, SIM_ILLEGAL, SIM_ILLEGAL, SIM_ILLEGAL, SIM_ILLEGAL, SIM_ILLEGAL
+};
+static const uint8_t opImmOps[8] = {
+  SIM_ADDI, SIM_SLLI, SIM_SLTI, SIM_SLTIU, SIM_XORI, SIM_SRLI, SIM_ORI, SIM_ANDI
+};
+static const uint8_t opOps[8] = {
+  SIM_ADD, SIM_SLL, SIM_SLT, SIM_SLTU, SIM_XOR, SIM_SRL, SIM_OR, SIM_AND
+};
+static const uint8_t mulOps[8] = {
+  SIM_MUL, SIM_MULH, SIM_MULHSU, SIM_MULHU, SIM_DIV, SIM_DIVU, SIM_REM, SIM_REMU
+};
+
+/* Registers an operation reads, alongside its profileEvent bits. */
+#define USES_RS1 32
+#define USES_RS2 64
+
+static const uint8_t opUses[] = {
+  [SIM_LUI] = 0, [SIM_JAL] = 0, [SIM_JALR] = USES_RS1,
+  [SIM_BEQ] = USES_RS1 | USES_RS2, [SIM_BNE] = USES_RS1 | USES_RS2,
+  [SIM_BLT] = USES_RS1 | USES_RS2, [SIM_BGE] = USES_RS1 | USES_RS2,
+  [SIM_BLTU] = USES_RS1 | USES_RS2, [SIM_BGEU] = USES_RS1 | USES_RS2,
+  [SIM_LB] = USES_RS1 | EVENT_LOAD, [SIM_LH] = USES_RS1 | EVENT_LOAD, [SIM_LW] = USES_RS1 | EVENT_LOAD,
+  [SIM_LBU] = USES_RS1 | EVENT_LOAD, [SIM_LHU] = USES_RS1 | EVENT_LOAD,
+  [SIM_SB] = USES_RS1 | USES_RS2 | EVENT_STORE, [SIM_SH] = USES_RS1 | USES_RS2 | EVENT_STORE,
+  [SIM_SW] = USES_RS1 | USES_RS2 | EVENT_STORE,
+  [SIM_ADDI] = USES_RS1, [SIM_SLTI] = USES_RS1, [SIM_SLTIU] = USES_RS1, [SIM_XORI] = USES_RS1,
+  [SIM_ORI] = USES_RS1, [SIM_ANDI] = USES_RS1, [SIM_SLLI] = USES_RS1, [SIM_SRLI] = USES_RS1,
+  [SIM_SRAI] = USES_RS1,
+  [SIM_ADD] = USES_RS1 | USES_RS2, [SIM_SUB] = USES_RS1 | USES_RS2, [SIM_SLL] = USES_RS1 | USES_RS2,
+  [SIM_SLT] = USES_RS1 | USES_RS2, [SIM_SLTU] = USES_RS1 | USES_RS2, [SIM_XOR] = USES_RS1 | USES_RS2,
+  [SIM_SRL] = USES_RS1 | USES_RS2, [SIM_SRA] = USES_RS1 | USES_RS2, [SIM_OR] = USES_RS1 | USES_RS2,
+  [SIM_AND] = USES_RS1 | USES_RS2,
+  [SIM_MUL] = USES_RS1 | USES_RS2, [SIM_MULH] = USES_RS1 | USES_RS2, [SIM_MULHSU] = USES_RS1 | USES_RS2,
+  [SIM_MULHU] = USES_RS1 | USES_RS2, [SIM_DIV] = USES_RS1 | USES_RS2, [SIM_DIVU] = USES_RS1 | USES_RS2,
+  [SIM_REM] = USES_RS1 | USES_RS2, [SIM_REMU] = USES_RS1 | USES_RS2,
+  [SIM_ECALL] = 0, [SIM_EBREAK] = 0, [SIM_ILLEGAL] = 0
+};
+
+/*
+ *  Where a global label was defined, kept in an open addressed table that
+ *  is at most half full.
+ */
+typedef struct linkSlot {
+  const char* name;
+  uint32_t addr;
+} LinkSlot;
+
+typedef struct linker {
+  SimProgram* program;
+  const char** names;
+  size_t* textBases;  /* Byte offset of each object's text and data.      */
+  size_t* dataBases;
+  LinkSlot* slots;
+  size_t slotTotal;
+  int errorTotal;
+} Linker;
+
+static void LinkError(Linker* linker, size_t object, const char* message, const char* name) {
+  fprintf(stderr, "Error: %s: %s %s.\n", linker->names[object], message, name);
+  linker->errorTotal++;
+}
+
+static void* CheckedCalloc(size_t total, size_t size) {
+  void* result = calloc(total ? total : 1, size);
+  if (result == NULL) {
+    AllocationFailed();
+  }
+  return result;
+}
+
+static uint32_t HashName(const char* name) {
+  uint32_t hash = 2166136261u;
+  for (; *name != '\0'; name++) {
+    hash = (hash ^ (uint8_t) *name) * 16777619u;
+  }
+  return hash;
+}
+
+/*
+ *  Returns the slot holding name, or the empty slot it belongs in.
+ */
+static LinkSlot* FindSlot(Linker* linker, const char* name) {
+  size_t slot = HashName(name) & (linker->slotTotal - 1);
+  while (linker->slots[slot].name != NULL && strcmp(linker->slots[slot].name, name) != 0) {
+    slot = (slot + 1) & (linker->slotTotal - 1);
+  }
+  return &linker->slots[slot];
+}
+
+static uint32_t SymbolAddr(Linker* linker, size_t object, const ObjSymbol* symbol) {
+  if (symbol->section == OBJ_TEXT) {
+    return TEXT_BASE + (uint32_t) linker->textBases[object] + symbol->offset;
+  }
+  return DATA_BASE + (uint32_t) linker->dataBases[object] + symbol->offset;
+}
+
+/*
+ *  Sign extends the low bits bits of value.
+ */
+static int32_t SignExtend(uint32_t value, int bits) {
+  return (int32_t) (value << (32 - bits)) >> (32 - bits);
+}
+
+/*
+ *  Decodes the word at index, which is at the address 4 * index.
+ */
+static SimInstr DecodeWord(uint32_t word, size_t index) {
+  SimInstr instr = {SIM_ILLEGAL, (word >> 7) & 31, (word >> 15) & 31, (word >> 20) & 31, 0};
+  uint32_t funct3 = (word >> 12) & 7;
+  uint32_t funct7 = word >> 25;
+  int32_t offset;
+  switch (word & 0x7f) {
+    case OPCODE_LUI:
+      instr.op = SIM_LUI;
+      instr.imm = (int32_t) (word & 0xfffff000u);
+      break;
+    case OPCODE_AUIPC:
+      instr.op = SIM_LUI;
+      instr.imm = (int32_t) (TEXT_BASE + 4 * (uint32_t) index + (word & 0xfffff000u));
+      break;
+    case OPCODE_JAL:
+      offset = SignExtend(((word >> 31) << 20) | (((word >> 12) & 0xff) << 12) |
+                          (((word >> 20) & 1) << 11) | (((word >> 21) & 0x3ff) << 1), 21);
+      instr.op = SIM_JAL;
+      instr.imm = (int32_t) index + offset / 4;
+      break;
+    case OPCODE_JALR:
+      instr.op = funct3 == 0 ? SIM_JALR : SIM_ILLEGAL;
+      instr.imm = SignExtend(word >> 20, 12);
+      break;
+    case OPCODE_BRANCH:
+      offset = SignExtend(((word >> 31) << 12) | (((word >> 7) & 1) << 11) |
+                          (((word >> 25) & 0x3f) << 5) | (((word >> 8) & 0xf) << 1), 13);
+      instr.op = branchOps[funct3];
+      instr.imm = (int32_t) index + offset / 4;
+      break;
+    case OPCODE_LOAD:
+      instr.op = loadOps[funct3];
+      instr.imm = SignExtend(word >> 20, 12);
+      break;
+    case OPCODE_STORE:
+      instr.op = storeOps[funct3];
+      instr.imm = SignExtend(((word >> 25) << 5) | ((word >> 7) & 31), 12);
+      break;
+    case OPCODE_OP_IMM:
+      instr.op = opImmOps[funct3];
+      instr.imm = SignExtend(word >> 20, 12);
+      if (funct3 == 1 || funct3 == 5) {
+        instr.imm &= 31;
+        if (funct7 == FUNCT7_ALT && funct3 == 5) {
+          instr.op = SIM_SRAI;
+        } else if (funct7 != 0) {
+          instr.op = SIM_ILLEGAL;
+        }
+      }
+      break;
+    case OPCODE_OP:
+      if (funct7 == FUNCT7_M) {
+        instr.op = mulOps[funct3];
+      } else if (funct7 == 0) {
+        instr.op = opOps[funct3];
+      } else if (funct7 == FUNCT7_ALT && funct3 == 0) {
+        instr.op = SIM_SUB;
+      } else if (funct7 == FUNCT7_ALT && funct3 == 5) {
+        instr.op = SIM_SRA;
+      }
+      break;
+    case OPCODE_SYSTEM:
+      if (word == 0x00000073u) {
+        instr.op = SIM_ECALL;
+      } else if (word == 0x00100073u) {
+        instr.op = SIM_EBREAK;
+      }
+      break;
+  }
+  return instr;
+}
+
+/*
+ *  Lays out every section and records where each global label ended up.
+ */
+static void PlaceObjects(Linker* linker, ObjectCode** objects, size_t total) {
+  size_t textSize = 0;
+  size_t dataSize = 0;
+  size_t globalTotal = 0;
+  size_t lineTotal = 0;
+  for (size_t i = 0; i < total; i++) {
+    linker->textBases[i] = textSize;
+    lineTotal += objects[i]->lineSize;
+    linker->dataBases[i] = dataSize;
+    textSize += objects[i]->sections[OBJ_TEXT].size;
+    dataSize += CeilDiv((int) objects[i]->sections[OBJ_DATA].size, WORDSIZE) * WORDSIZE;
+    globalTotal += objects[i]->symbolSize;
+  }
+  linker->slotTotal = INITIAL_CAPACITY;
+  while (linker->slotTotal < 2 * globalTotal) {
+    linker->slotTotal *= 2;
+  }
+  linker->slots = CheckedCalloc(linker->slotTotal, sizeof(LinkSlot));
+  for (size_t i = 0; i < total; i++) {
+    for (size_t j = 0; j < objects[i]->symbolSize; j++) {
+      const ObjSymbol* symbol = &objects[i]->symbols[j];
+      if (!symbol->defined || !symbol->global) {
+        continue;
+      }
+      LinkSlot* slot = FindSlot(linker, symbol->name);
+      if (slot->name != NULL) {
+        LinkError(linker, i, "Duplicate label", symbol->name);
+        continue;
+      }
+      slot->name = symbol->name;
+      slot->addr = SymbolAddr(linker, i, symbol);
+    }
+  }
+  linker->program->textTotal = textSize / WORDSIZE;
+  linker->program->dataSize = dataSize;
+  linker->program->lines = CheckedCalloc(lineTotal, sizeof(SimLine));
+}
+
+/*
+ *  Copies in the sections of object, decoding its text, and applies its
+ *  relocations.
+ */
+static void LinkObject(Linker* linker, ObjectCode* object, size_t index) {
+  SimProgram* program = linker->program;
+  ObjSectionData* text = &object->sections[OBJ_TEXT];
+  ObjSectionData* data = &object->sections[OBJ_DATA];
+  size_t first = linker->textBases[index] / WORDSIZE;
+  for (size_t i = 0; i + WORDSIZE <= text->size; i += WORDSIZE) {
+    uint32_t word = (uint32_t) text->bytes[i] | (uint32_t) text->bytes[i + 1] << 8 |
+                    (uint32_t) text->bytes[i + 2] << 16 | (uint32_t) text->bytes[i + 3] << 24;
+    program->text[first + i / WORDSIZE] = DecodeWord(word, first + i / WORDSIZE);
+  }
+  if (data->size != 0) {
+    memcpy(program->data + linker->dataBases[index], data->bytes, data->size);
+  }
+  for (size_t i = 0; i < object->lineSize; i++) {
+    SimLine* line = &program->lines[program->lineTotal++];
+    line->index = (uint32_t) (first + object->lines[i].offset / WORDSIZE);
+    line->file = object->lines[i].file;
+    line->line = object->lines[i].line;
+  }
+
+  for (int section = 0; section < OBJ_SECTION_TOTAL; section++) {
+    ObjSectionData* contents = &object->sections[section];
+    for (size_t i = 0; i < contents->relocSize; i++) {
+      ObjReloc* reloc = &contents->relocs[i];
+      ObjSymbol* symbol = &object->symbols[reloc->symbol];
+      uint32_t addr;
+      if (symbol->defined) {
+        addr = SymbolAddr(linker, index, symbol);
+      } else {
+        LinkSlot* slot = FindSlot(linker, symbol->name);
+        if (slot->name == NULL) {
+          LinkError(linker, index, "Undefined label", symbol->name);
+          continue;
+        }
+        addr = slot->addr;
+      }
+      if (section == OBJ_DATA) {
+        if (reloc->type != RELOC_32) {
+          LinkError(linker, index, "Instruction relocation in data for", symbol->name);
+          continue;
+        }
+        uint8_t* word = program->data + linker->dataBases[index] + reloc->offset;
+        for (int b = 0; b < WORDSIZE; b++) {
+          word[b] = (uint8_t) (addr >> (8 * b));
+        }
+        continue;
+      }
+      SimInstr* instr = &program->text[first + reloc->offset / WORDSIZE];
+      switch (reloc->type) {
+        case RELOC_BRANCH:
+        case RELOC_JAL:
+          /* Targets outside the text fault when they are jumped to. */
+          instr->imm = addr % WORDSIZE == 0 && addr / WORDSIZE < program->textTotal ? (int32_t) (addr / WORDSIZE) : -1;
+          break;
+        case RELOC_HI20:
+          instr->imm = (int32_t) ((addr + 0x800) & 0xfffff000u);
+          break;
+        case RELOC_LO12_I:
+          instr->imm = SignExtend(addr & 0xfff, 12);
+          break;
+        default:
+          LinkError(linker, index, "Data relocation in text for", symbol->name);
+          break;
+      }
+    }
+  }
+}
+
+static int CompareSymbols(const void* first, const void* second) {
+  const SimSymbol* a = first;
+  const SimSymbol* b = second;
+  return a->addr < b->addr ? -1 : a->addr > b->addr;
+}
+
+/*
+ *  Collects the global labels in the text, sorted by address.
+ */
+static void CollectFunctions(Linker* linker) {
+  SimProgram* program = linker->program;
+  size_t total = 0;
+  for (size_t i = 0; i < linker->slotTotal; i++) {
+    total += linker->slots[i].name != NULL && linker->slots[i].addr < DATA_BASE;
+  }
+  program->symbols = CheckedCalloc(total, sizeof(SimSymbol));
+  for (size_t i = 0; i < linker->slotTotal; i++) {
+    LinkSlot* slot = &linker->slots[i];
+    if (slot->name != NULL && slot->addr < DATA_BASE) {
+      SimSymbol* symbol = &program->symbols[program->symbolTotal++];
+      symbol->name = malloc(strlen(slot->name) + 1);
+      if (symbol->name == NULL) {
+        AllocationFailed();
+      }
+      strcpy(symbol->name, slot->name);
+      symbol->addr = slot->addr;
+    }
+  }
+  qsort(program->symbols, program->symbolTotal, sizeof(SimSymbol), CompareSymbols);
+}
+
+SimProgram* LinkProgram(ObjectCode** objects, const char** names, size_t total) {
+  Linker linker = {0};
+  linker.program = CheckedCalloc(1, sizeof(SimProgram));
+  linker.names = names;
+  linker.textBases = CheckedCalloc(total, sizeof(size_t));
+  linker.dataBases = CheckedCalloc(total, sizeof(size_t));
+  PlaceObjects(&linker, objects, total);
+  linker.program->text = CheckedCalloc(linker.program->textTotal, sizeof(SimInstr));
+  linker.program->data = CheckedCalloc(linker.program->dataSize, 1);
+  for (size_t i = 0; i < total; i++) {
+    LinkObject(&linker, objects[i], i);
+  }
+  LinkSlot* main = FindSlot(&linker, "main");
+  linker.program->entry = main->name != NULL && main->addr < DATA_BASE ? main->addr : TEXT_BASE;
+  CollectFunctions(&linker);
+  free(linker.textBases);
+  free(linker.dataBases);
+  free(linker.slots);
+  if (linker.errorTotal != 0) {
+    FreeSimProgram(linker.program);
+    return NULL;
+  }
+  return linker.program;
+}
+
+const SimSymbol* FindFunction(const SimProgram* program, uint32_t addr) {
+  size_t low = 0;
+  size_t high = program->symbolTotal;
+  /* Finds the first symbol after addr. */
+  while (low < high) {
+    size_t middle = low + (high - low) / 2;
+    if (program->symbols[middle].addr <= addr) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return low != 0 ? &program->symbols[low - 1] : NULL;
+}
+
+typedef struct machine {
+  const SimProgram* program;
+  uint32_t regs[REG_FILE_SIZE];
+  uint8_t* data;      /* Backs DATA_BASE up to DATA_BASE + DATA_SIZE.      */
+  uint8_t* stack;     /* Backs the STACK_SIZE bytes below STACK_TOP.       */
+  uint32_t brk;       /* End of the heap sbrk hands out.                   */
+} Machine;
+
+/*
+ *  Returns the host memory behind the width bytes at addr, or NULL if they
+ *  are not all mapped.
+ */
+static inline uint8_t* Translate(Machine* m, uint32_t addr, uint32_t width) {
+  if (addr - DATA_BASE <= DATA_SIZE - width) {
+    return m->data + (addr - DATA_BASE);
+  }
+  if (addr - (STACK_TOP - STACK_SIZE) <= STACK_SIZE + STACK_SLACK - width) {
+    return m->stack + (addr - (STACK_TOP - STACK_SIZE));
+  }
+  return NULL;
+}
+
+static void Fault(Machine* m, size_t index, const char* message, uint32_t value) {
+  uint32_t pc = TEXT_BASE + WORDSIZE * (uint32_t) index;
+  const SimSymbol* function = FindFunction(m->program, pc);
+  fprintf(stderr, "Error: %s 0x%08x at pc 0x%08x in %s.\n", message, value, pc,
+          function != NULL ? function->name : "the program");
+}
+
+/*
+ *  Counts the instruction at index, which was followed by the one at next.
+ *  loadedReg holds the register the previous instruction loaded, if any.
+ */
+static void ProfileStep(SimProfile* profile, const SimInstr* instr, uint32_t index, uint32_t next,
+                        int* loadedReg) {
+  int uses = opUses[instr->op];
+  int events = uses & (EVENT_LOAD | EVENT_STORE);
+  int cycles = 1;
+  int isJump = instr->op == SIM_JAL || instr->op == SIM_JALR;
+  if (*loadedReg != REG_ZERO && (((uses & USES_RS1) && instr->rs1 == *loadedReg) ||
+                                 ((uses & USES_RS2) && instr->rs2 == *loadedReg))) {
+    cycles += LOAD_USE_STALL;
+  }
+  *loadedReg = events & EVENT_LOAD ? instr->rd : REG_ZERO;
+  if (isJump || next != index + 1) {
+    events |= EVENT_TAKEN;
+    cycles += TAKEN_PENALTY;
+  }
+  if (isJump && instr->rd == REG_RA) {
+    events |= EVENT_CALL;
+  } else if (instr->op == SIM_JALR && instr->rd == REG_ZERO && instr->rs1 == REG_RA) {
+    events |= EVENT_RETURN;
+  }
+  ProfileInstr(profile, index, events, cycles, next);
+}
+
+/*
+ *  Prints the string at addr, returning 0 if it runs into unmapped memory.
+ */
+static int PrintString(Machine* m, uint32_t addr, FILE* out) {
+  for (;;) {
+    uint8_t* byte = Translate(m, addr++, 1);
+    if (byte == NULL) {
+      return 0;
+    }
+    if (*byte == '\0') {
+      return 1;
+    }
+    putc(*byte, out);
+  }
+}
+
+void RunProgram(const SimProgram* program, FILE* out, SimProfile* profile, SimResult* result) {
+  Machine m = {0};
+  uint32_t* x = m.regs;
+  const SimInstr* text = program->text;
+  uint32_t textTotal = (uint32_t) program->textTotal;
+  uint32_t pc = (program->entry - TEXT_BASE) / WORDSIZE;
+  uint64_t count = 0;
+  int loadedReg = REG_ZERO;
+  enum simStatus status = SIM_FAULTED;
+  m.program = program;
+  m.data = CheckedCalloc(DATA_SIZE, 1);
+  m.stack = CheckedCalloc(STACK_SIZE + STACK_SLACK, 1);
+  if (program->dataSize != 0) {
+    memcpy(m.data, program->data, program->dataSize);
+  }
+  m.brk = DATA_BASE + (uint32_t) program->dataSize;
+  x[REG_SP] = STACK_TOP;
+  x[REG_GP] = GP_START;
+  result->exitCode = 0;
+
+  for (;;) {
+    if (pc >= textTotal) {
+      /* Running off the end of the text is a normal exit, a jump past it is not. */
+      if (pc == textTotal) {
+        status = SIM_EXITED;
+      } else {
+        Fault(&m, pc, "Jump outside the text to", TEXT_BASE + WORDSIZE * pc);
+      }
+      break;
+    }
+    const SimInstr* instr = &text[pc];
+    uint32_t a = x[instr->rs1];
+    uint32_t b = x[instr->rs2];
+    uint32_t imm = (uint32_t) instr->imm;
+    uint32_t index = pc;
+    uint8_t* mem;
+    count++;
+    pc++;
+    switch (instr->op) {
+      case SIM_LUI: x[instr->rd] = imm; break;
+      case SIM_JAL:
+        x[instr->rd] = TEXT_BASE + WORDSIZE * pc;
+        pc = imm;
+        break;
+      case SIM_JALR: {
+        uint32_t target = (a + imm) & ~1u;
+        x[instr->rd] = TEXT_BASE + WORDSIZE * pc;
+        if ((target - TEXT_BASE) % WORDSIZE != 0) {
+          Fault(&m, pc - 1, "Misaligned jump to", target);
+          goto done;
+        }
+        pc = (target - TEXT_BASE) / WORDSIZE;
+        break;
+      }
+      case SIM_BEQ: pc = a == b ? imm : pc; break;
+      case SIM_BNE: pc = a != b ? imm : pc; break;
+      case SIM_BLT: pc = (int32_t) a < (int32_t) b ? imm : pc; break;
+      case SIM_BGE: pc = (int32_t) a >= (int32_t) b ? imm : pc; break;
+      case SIM_BLTU: pc = a < b ? imm : pc; break;
+      case SIM_BGEU: pc = a >= b ? imm : pc; break;
+      case SIM_LB:
+      case SIM_LBU:
+        if ((mem = Translate(&m, a + imm, 1)) == NULL) {
+          Fault(&m, pc - 1, "Load from unmapped address", a + imm);
+          goto done;
+        }
+        x[instr->rd] = instr->op == SIM_LB ? (uint32_t) (int8_t) *mem : *mem;
+        break;
+      case SIM_LH:
+      case SIM_LHU: {
+        uint16_t half;
+        if ((mem = Translate(&m, a + imm, 2)) == NULL) {
+          Fault(&m, pc - 1, "Load from unmapped address", a + imm);
+          goto done;
+        }
+        memcpy(&half, mem, 2);
+        x[instr->rd] = instr->op == SIM_LH ? (uint32_t) (int16_t) half : half;
+        break;
+      }
+      case SIM_LW:
+        if ((mem = Translate(&m, a + imm, 4)) == NULL) {
+          Fault(&m, pc - 1, "Load from unmapped address", a + imm);
+          goto done;
+        }
+        memcpy(&x[instr->rd], mem, 4);
+        break;
+      case SIM_SB:
+      case SIM_SH:
+      case SIM_SW: {
+        uint32_t width = instr->op == SIM_SW ? 4 : instr->op == SIM_SH ? 2 : 1;
+        if ((mem = Translate(&m, a + imm, width)) == NULL) {
+          Fault(&m, pc - 1, "Store to unmapped address", a + imm);
+          goto done;
+        }
+        memcpy(mem, &b, width);
+        break;
+      }
+      case SIM_ADDI: x[instr->rd] = a + imm; break;
+      case SIM_SLTI: x[instr->rd] = (int32_t) a < (int32_t) imm; break;
+      case SIM_SLTIU: x[instr->rd] = a < imm; break;
+      case SIM_XORI: x[instr->rd] = a ^ imm; break;
+      case SIM_ORI: x[instr->rd] = a | imm; break;
+      case SIM_ANDI: x[instr->rd] = a & imm; break;
+      case SIM_SLLI: x[instr->rd] = a << imm; break;
+      case SIM_SRLI: x[instr->rd] = a >> imm; break;
+      case SIM_SRAI: x[instr->rd] = (uint32_t) ((int32_t) a >> imm); break;
+      case SIM_ADD: x[instr->rd] = a + b; break;
+      case SIM_SUB: x[instr->rd] = a - b; break;
+      case SIM_SLL: x[instr->rd] = a << (b & 31); break;
+      case SIM_SLT: x[instr->rd] = (int32_t) a < (int32_t) b; break;
+      case SIM_SLTU: x[instr->rd] = a < b; break;
+      case SIM_XOR: x[instr->rd] = a ^ b; break;
+      case SIM_SRL: x[instr->rd] = a >> (b & 31); break;
+      case SIM_SRA: x[instr->rd] = (uint32_t) ((int32_t) a >> (b & 31)); break;
+      case SIM_OR: x[instr->rd] = a | b; break;
+      case SIM_AND: x[instr->rd] = a & b; break;
+      case SIM_MUL: x[instr->rd] = a * b; break;
+      case SIM_MULH: x[instr->rd] = (uint32_t) (((int64_t) (int32_t) a * (int32_t) b) >> 32); break;
+      case SIM_MULHSU: x[instr->rd] = (uint32_t) (((int64_t) (int32_t) a * (int64_t) b) >> 32); break;
+      case SIM_MULHU: x[instr->rd] = (uint32_t) (((uint64_t) a * b) >> 32); break;
+      /* Division by zero and overflow give the results the ISA defines. */
+      case SIM_DIV:
+        if (b == 0) {
+          x[instr->rd] = UINT32_MAX;
+        } else if (a == 0x80000000u && b == UINT32_MAX) {
+          x[instr->rd] = a;
+        } else {
+          x[instr->rd] = (uint32_t) ((int32_t) a / (int32_t) b);
+        }
+        break;
+      case SIM_DIVU: x[instr->rd] = b == 0 ? UINT32_MAX : a / b; break;
+      case SIM_REM:
+        if (b == 0) {
+          x[instr->rd] = a;
+        } else if (a == 0x80000000u && b == UINT32_MAX) {
+          x[instr->rd] = 0;
+        } else {
+          x[instr->rd] = (uint32_t) ((int32_t) a % (int32_t) b);
+        }
+        break;
+      case SIM_REMU: x[instr->rd] = b == 0 ? a : a % b; break;
+      case SIM_ECALL:
+        switch (x[REG_A0]) {
+          case ECALL_PRINT_INT:
+            fprintf(out, "%d", (int32_t) x[REG_A1]);
+            break;
+          case ECALL_PRINT_STRING:
+            if (!PrintString(&m, x[REG_A1], out)) {
+              Fault(&m, pc - 1, "Print from unmapped address", x[REG_A1]);
+              goto done;
+            }
+            break;
+          case ECALL_PRINT_CHAR:
+            putc((int) (x[REG_A1] & 0xff), out);
+            break;
+          case ECALL_SBRK:
+            if (x[REG_A1] > DATA_BASE + DATA_SIZE - m.brk) {
+              Fault(&m, pc - 1, "Heap exhausted asking for", x[REG_A1]);
+              goto done;
+            }
+            x[REG_A0] = m.brk;
+            m.brk += x[REG_A1];
+            break;
+          case ECALL_EXIT:
+            status = SIM_EXITED;
+            break;
+          case ECALL_EXIT2:
+            status = SIM_EXITED;
+            result->exitCode = (int32_t) x[REG_A1];
+            break;
+          default:
+            Fault(&m, pc - 1, "Unsupported ecall", x[REG_A0]);
+            goto done;
+        }
+        break;
+      case SIM_EBREAK:
+        Fault(&m, pc - 1, "Breakpoint", TEXT_BASE + WORDSIZE * (pc - 1));
+        goto done;
+      default:
+        Fault(&m, pc - 1, "Illegal instruction", TEXT_BASE + WORDSIZE * (pc - 1));
+        goto done;
+    }
+    x[REG_ZERO] = 0;
+    if (profile != NULL) {
+      ProfileStep(profile, instr, index, pc, &loadedReg);
+    }
+    /* Only the exit ecalls set the status inside the loop. */
+    if (status == SIM_EXITED) {
+      break;
+    }
+  }
+done:
+  result->status = status;
+  if (status == SIM_EXITED) {
+    fprintf(out, "\nExited with error code %d\n", result->exitCode);
+  }
+  fflush(out);
+  result->instrTotal = count;
+  free(m.data);
+  free(m.stack);
+}
+
+void FreeSimProgram(SimProgram* program) {
+  for (size_t i = 0; i < program->symbolTotal; i++) {
+    free(program->symbols[i].name);
+  }
+  free(program->symbols);
+  free(program->lines);
+  free(program->text);
+  free(program->data);
+  free(program);
+}
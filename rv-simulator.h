@@ -0,0 +1,108 @@
+/*
+ *  File that holds the native RV32IM simulator, which runs the output of
+ *  61ccc without venus. The objects the assembler produces are linked into
+ *  one program laid out the way venus lays it out, with text from address 0
+ *  and data from DATA_BASE, and every instruction is decoded once up front
+ *  so the interpreter only has to dispatch on a small struct. The ecalls
+ *  cgen-lib makes are supported and print exactly what venus prints.
+ */
+
+#ifndef RV_SIMULATOR_H
+#define RV_SIMULATOR_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "rv-assembler.h"
+
+/* Layout of the address space, matching the defaults of venus. */
+#define TEXT_BASE 0x00000000u
+#define DATA_BASE 0x10000000u
+#define DATA_SIZE 0x01000000u
+#define STACK_TOP 0x7ffffff0u
+#define STACK_SIZE 0x01000000u
+#define GP_START 0x10008000u
+
+/*
+ *  An instruction decoded from its machine word. Branch and jump targets
+ *  are stored in imm as the index of the instruction they go to.
+ */
+typedef struct simInstr {
+  uint8_t op;
+  uint8_t rd;
+  uint8_t rs1;
+  uint8_t rs2;
+  int32_t imm;
+} SimInstr;
+
+/*
+ *  A global label in the text, used to say which function a fault
+ *  happened in or an instruction is profiled in.
+ */
+typedef struct simSymbol {
+  char* name;
+  uint32_t addr;
+} SimSymbol;
+
+/*
+ *  Where the instructions from index up to the next entry came from.
+ */
+typedef struct simLine {
+  uint32_t index;
+  char* file;           /* Interned.                                     */
+  int line;
+} SimLine;
+
+typedef struct simProgram {
+  SimInstr* text;
+  size_t textTotal;
+  uint8_t* data;
+  size_t dataSize;
+  SimSymbol* symbols;   /* Sorted by address.                            */
+  size_t symbolTotal;
+  SimLine* lines;       /* Sorted by index.                              */
+  size_t lineTotal;
+  uint32_t entry;       /* Address of main, or TEXT_BASE without one.    */
+} SimProgram;
+
+/* Defined in sim-profile.h. */
+typedef struct simProfile SimProfile;
+
+enum simStatus {
+  SIM_EXITED,         /* Exited through an ecall or ran off the end.     */
+  SIM_FAULTED         /* Stopped on a bad access, jump or ecall.         */
+};
+
+typedef struct simResult {
+  enum simStatus status;
+  int32_t exitCode;   /* Only meaningful when the program exited.         */
+  uint64_t instrTotal;
+} SimResult;
+
+/*
+ *  Links total objects, in order, into a program the way venus links the
+ *  files it is given. Reports undefined and duplicate labels to stderr,
+ *  using names to say which file each object came from, and returns NULL
+ *  if there were any.
+ */
+SimProgram* LinkProgram(ObjectCode** objects, const char** names, size_t total);
+
+/*
+ *  Returns the symbol of the function holding addr, or NULL if it comes
+ *  before every symbol.
+ */
+const SimSymbol* FindFunction(const SimProgram* program, uint32_t addr);
+
+/*
+ *  Runs the program from its entry, writing what it prints to out and the
+ *  "Exited with error code" line venus ends with. Faults are reported to
+ *  stderr along with the function they happened in. Every instruction is
+ *  counted in profile unless it is NULL.
+ */
+void RunProgram(const SimProgram* program, FILE* out, SimProfile* profile, SimResult* result);
+
+/*
+ *  Frees the program and everything it owns.
+ */
+void FreeSimProgram(SimProgram* program);
+
+#endif
@@ -0,0 +1,253 @@
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim-profile.h"
+#include "utils.h"
+
+/* Name of the frame for instructions before every global label. */
+#define UNKNOWN_FUNCTION "[unknown]"
+
+static const char* counterNames[PROFILE_TOTAL] = {
+  [PROFILE_INSTRS] = "instrs",
+  [PROFILE_CYCLES] = "cycles",
+  [PROFILE_LOADS] = "loads",
+  [PROFILE_STORES] = "stores",
+  [PROFILE_TAKEN] = "taken",
+  [PROFILE_CALLS] = "calls",
+};
+
+/*
+ *  Counts summed over a function or line while writing the flat profile.
+ */
+typedef struct profileRow {
+  const char* name;
+  char* file;         /* Interned, or NULL for a function.                */
+  int line;
+  uint64_t counts[PROFILE_TOTAL];
+} ProfileRow;
+
+static void* CheckedCalloc(size_t total, size_t size) {
+  void* result = calloc(total ? total : 1, size);
+  if (result == NULL) {
+    AllocationFailed();
+  }
+  return result;
+}
+
+static const char* FunctionName(const SimProfile* profile, size_t function) {
+  return function == SIZE_MAX ? UNKNOWN_FUNCTION : profile->program->symbols[function].name;
+}
+
+/*
+ *  Returns a new node for function called from parent.
+ */
+static size_t AddNode(SimProfile* profile, size_t function, size_t parent) {
+  if (profile->nodeSize == profile->nodeCapacity) {
+    profile->nodeCapacity = profile->nodeCapacity ? profile->nodeCapacity * 2 : INITIAL_CAPACITY;
+    profile->nodes = realloc(profile->nodes, sizeof(CallNode) * profile->nodeCapacity);
+    if (profile->nodes == NULL) {
+      AllocationFailed();
+    }
+  }
+  CallNode* node = &profile->nodes[profile->nodeSize];
+  node->function = function;
+  node->parent = parent;
+  node->firstChild = SIZE_MAX;
+  node->nextSibling = SIZE_MAX;
+  memset(node->counts, 0, sizeof(node->counts));
+  if (parent != SIZE_MAX) {
+    node->nextSibling = profile->nodes[parent].firstChild;
+    profile->nodes[parent].firstChild = profile->nodeSize;
+  }
+  return profile->nodeSize++;
+}
+
+/*
+ *  Returns the node of function called from the current node, adding it
+ *  the first time it is called from there.
+ */
+static size_t EnterCall(SimProfile* profile, size_t function) {
+  size_t child = profile->nodes[profile->current].firstChild;
+  while (child != SIZE_MAX && profile->nodes[child].function != function) {
+    child = profile->nodes[child].nextSibling;
+  }
+  return child != SIZE_MAX ? child : AddNode(profile, function, profile->current);
+}
+
+SimProfile* NewSimProfile(const SimProgram* program) {
+  SimProfile* profile = CheckedCalloc(1, sizeof(SimProfile));
+  size_t symbol = 0;
+  profile->program = program;
+  profile->counts = CheckedCalloc(program->textTotal, sizeof(profile->counts[0]));
+  profile->functions = CheckedCalloc(program->textTotal, sizeof(size_t));
+  /* Each instruction belongs to the last label at or before it. */
+  for (size_t i = 0; i < program->textTotal; i++) {
+    uint32_t addr = TEXT_BASE + WORDSIZE * (uint32_t) i;
+    while (symbol < program->symbolTotal && program->symbols[symbol].addr <= addr) {
+      symbol++;
+    }
+    profile->functions[i] = symbol != 0 ? symbol - 1 : SIZE_MAX;
+  }
+  size_t entry = (program->entry - TEXT_BASE) / WORDSIZE;
+  profile->current = AddNode(profile, entry < program->textTotal ? profile->functions[entry] : SIZE_MAX, SIZE_MAX);
+  return profile;
+}
+
+static void AddCounts(uint64_t* counts, const uint64_t* amounts) {
+  for (int i = 0; i < PROFILE_TOTAL; i++) {
+    counts[i] += amounts[i];
+  }
+}
+
+void ProfileInstr(SimProfile* profile, uint32_t index, int events, int cycles, uint32_t next) {
+  uint64_t amounts[PROFILE_TOTAL] = {
+    [PROFILE_INSTRS] = 1,
+    [PROFILE_CYCLES] = (uint64_t) cycles,
+    [PROFILE_LOADS] = (events & EVENT_LOAD) != 0,
+    [PROFILE_STORES] = (events & EVENT_STORE) != 0,
+    [PROFILE_TAKEN] = (events & EVENT_TAKEN) != 0,
+    [PROFILE_CALLS] = (events & EVENT_CALL) != 0,
+  };
+  AddCounts(profile->counts[index], amounts);
+  AddCounts(profile->nodes[profile->current].counts, amounts);
+  if (events & EVENT_CALL) {
+    profile->current = EnterCall(profile, next < profile->program->textTotal ? profile->functions[next] : SIZE_MAX);
+  } else if ((events & EVENT_RETURN) && profile->nodes[profile->current].parent != SIZE_MAX) {
+    profile->current = profile->nodes[profile->current].parent;
+  }
+}
+
+/*
+ *  Orders rows from the most cycles to the least, then by name and line.
+ */
+static int CompareRows(const void* first, const void* second) {
+  const ProfileRow* a = first;
+  const ProfileRow* b = second;
+  if (a->counts[PROFILE_CYCLES] != b->counts[PROFILE_CYCLES]) {
+    return a->counts[PROFILE_CYCLES] > b->counts[PROFILE_CYCLES] ? -1 : 1;
+  }
+  int order = strcmp(a->name, b->name);
+  if (order != 0) {
+    return order;
+  }
+  return a->line < b->line ? -1 : a->line > b->line;
+}
+
+static void WriteRows(ProfileRow* rows, size_t total, uint64_t cycles, const char* title, const char* column,
+                      FILE* out) {
+  qsort(rows, total, sizeof(ProfileRow), CompareRows);
+  fprintf(out, "\n%s:\n", title);
+  fprintf(out, "%7s", "%");
+  for (int i = 0; i < PROFILE_TOTAL; i++) {
+    fprintf(out, " %12s", counterNames[i]);
+  }
+  fprintf(out, "  %s\n", column);
+  for (size_t i = 0; i < total && rows[i].counts[PROFILE_INSTRS] != 0; i++) {
+    fprintf(out, "%6.2f%%", cycles ? 100.0 * rows[i].counts[PROFILE_CYCLES] / cycles : 0.0);
+    for (int j = 0; j < PROFILE_TOTAL; j++) {
+      fprintf(out, " %12" PRIu64, rows[i].counts[j]);
+    }
+    if (rows[i].file != NULL) {
+      fprintf(out, "  %s:%d\n", rows[i].file, rows[i].line);
+    } else {
+      fprintf(out, "  %s\n", rows[i].name);
+    }
+  }
+}
+
+/*
+ *  Sums the counts of every run of instructions from the same line into
+ *  one row per line, returning how many rows there are.
+ */
+static size_t SumLines(const SimProfile* profile, ProfileRow* rows) {
+  const SimProgram* program = profile->program;
+  size_t tableSize = INITIAL_CAPACITY;
+  size_t rowTotal = 0;
+  while (tableSize < 2 * program->lineTotal) {
+    tableSize *= 2;
+  }
+  size_t* table = CheckedCalloc(tableSize, sizeof(size_t));
+  memset(table, 0xff, sizeof(size_t) * tableSize);
+  for (size_t i = 0; i < program->lineTotal; i++) {
+    const SimLine* line = &program->lines[i];
+    size_t end = i + 1 < program->lineTotal ? program->lines[i + 1].index : program->textTotal;
+    size_t slot = ((uintptr_t) line->file * 31 + (size_t) line->line) & (tableSize - 1);
+    while (table[slot] != SIZE_MAX && (rows[table[slot]].file != line->file || rows[table[slot]].line != line->line)) {
+      slot = (slot + 1) & (tableSize - 1);
+    }
+    if (table[slot] == SIZE_MAX) {
+      table[slot] = rowTotal;
+      rows[rowTotal].name = line->file;
+      rows[rowTotal].file = line->file;
+      rows[rowTotal++].line = line->line;
+    }
+    for (size_t j = line->index; j < end; j++) {
+      AddCounts(rows[table[slot]].counts, profile->counts[j]);
+    }
+  }
+  free(table);
+  return rowTotal;
+}
+
+void WriteFlatProfile(const SimProfile* profile, FILE* out) {
+  const SimProgram* program = profile->program;
+  size_t functionTotal = program->symbolTotal + 1;
+  size_t rowTotal = functionTotal > program->lineTotal ? functionTotal : program->lineTotal;
+  ProfileRow* rows = CheckedCalloc(rowTotal, sizeof(ProfileRow));
+  ProfileRow total = {0};
+  for (size_t i = 0; i < program->textTotal; i++) {
+    AddCounts(total.counts, profile->counts[i]);
+  }
+  fprintf(out, "Total:");
+  for (int i = 0; i < PROFILE_TOTAL; i++) {
+    fprintf(out, " %s %" PRIu64, counterNames[i], total.counts[i]);
+  }
+  fprintf(out, "\n");
+
+  /* The last row holds everything before the first label. */
+  for (size_t i = 0; i < functionTotal; i++) {
+    rows[i].name = i < program->symbolTotal ? program->symbols[i].name : UNKNOWN_FUNCTION;
+  }
+  for (size_t i = 0; i < profile->nodeSize; i++) {
+    size_t function = profile->nodes[i].function;
+    AddCounts(rows[function != SIZE_MAX ? function : functionTotal - 1].counts, profile->nodes[i].counts);
+  }
+  WriteRows(rows, functionTotal, total.counts[PROFILE_CYCLES], "Functions", "function", out);
+
+  memset(rows, 0, sizeof(ProfileRow) * rowTotal);
+  WriteRows(rows, SumLines(profile, rows), total.counts[PROFILE_CYCLES], "Lines", "line", out);
+  free(rows);
+}
+
+void WriteFoldedStacks(const SimProfile* profile, FILE* out) {
+  size_t* path = NULL;
+  size_t pathCapacity = 0;
+  for (size_t i = 0; i < profile->nodeSize; i++) {
+    size_t depth = 0;
+    if (profile->nodes[i].counts[PROFILE_CYCLES] == 0) {
+      continue;
+    }
+    for (size_t node = i; node != SIZE_MAX; node = profile->nodes[node].parent) {
+      if (depth == pathCapacity) {
+        pathCapacity = pathCapacity ? pathCapacity * 2 : INITIAL_CAPACITY;
+        path = realloc(path, sizeof(size_t) * pathCapacity);
+        if (path == NULL) {
+          AllocationFailed();
+        }
+      }
+      path[depth++] = node;
+    }
+    while (depth-- > 0) {
+      fprintf(out, "%s%c", FunctionName(profile, profile->nodes[path[depth]].function), depth ? ';' : ' ');
+    }
+    fprintf(out, "%" PRIu64 "\n", profile->nodes[i].counts[PROFILE_CYCLES]);
+  }
+  free(path);
+}
+
+void FreeSimProfile(SimProfile* profile) {
+  free(profile->counts);
+  free(profile->functions);
+  free(profile->nodes);
+  free(profile);
+}
@@ -0,0 +1,94 @@
+/*
+ *  File that holds the execution profile 61csim records with --profile or
+ *  --folded. Every instruction the simulator runs is counted against its
+ *  address along with the loads, stores, taken branches and calls it made
+ *  and an estimate of its cycles. The counts are then summed by function
+ *  and by the line each instruction came from, and by call stack in the
+ *  folded format flamegraph.pl reads. For example
+ *
+ *    ./61csim --profile profile.txt --folded stacks.txt out.S
+ *
+ *  Cycles are estimated for the five stage pipeline of the course, which
+ *  forwards results: an instruction takes one cycle, a load stalls the
+ *  next instruction one more if it uses the loaded value, and a taken
+ *  branch or jump flushes the two instructions fetched after it.
+ */
+
+#ifndef SIM_PROFILE_H
+#define SIM_PROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "rv-simulator.h"
+
+#define LOAD_USE_STALL 1
+#define TAKEN_PENALTY 2
+
+enum profileCounter {
+  PROFILE_INSTRS,
+  PROFILE_CYCLES,
+  PROFILE_LOADS,
+  PROFILE_STORES,
+  PROFILE_TAKEN,        /* Branches taken and jumps.                      */
+  PROFILE_CALLS,        /* Calls made, counted where they are made.       */
+  PROFILE_TOTAL
+};
+
+/*
+ *  What an executed instruction did, passed to ProfileInstr.
+ */
+enum profileEvent {
+  EVENT_LOAD = 1,
+  EVENT_STORE = 2,
+  EVENT_TAKEN = 4,
+  EVENT_CALL = 8,     /* A jump that writes ra.                           */
+  EVENT_RETURN = 16   /* jr ra.                                           */
+};
+
+/*
+ *  A function called along one path through the calls, whose counts only
+ *  cover the instructions run while it was the innermost call. Labels
+ *  inside a function, like the _name one its epilogue starts at, count
+ *  towards the function that was called.
+ */
+typedef struct callNode {
+  size_t function;    /* Index into the symbols, or SIZE_MAX if none.     */
+  size_t parent;
+  size_t firstChild;  /* SIZE_MAX if it has called nothing.               */
+  size_t nextSibling;
+  uint64_t counts[PROFILE_TOTAL];
+} CallNode;
+
+struct simProfile {
+  const SimProgram* program;
+  uint64_t (*counts)[PROFILE_TOTAL];  /* Per instruction.                  */
+  size_t* functions;  /* Index of the symbol each instruction is in.      */
+  CallNode* nodes;    /* The first is the function execution starts in.   */
+  size_t nodeSize;
+  size_t nodeCapacity;
+  size_t current;     /* Node of the function running now.                */
+};
+
+SimProfile* NewSimProfile(const SimProgram* program);
+
+/*
+ *  Counts the instruction at index, which did what events holds, took
+ *  cycles cycles and was followed by the one at next.
+ */
+void ProfileInstr(SimProfile* profile, uint32_t index, int events, int cycles, uint32_t next);
+
+/*
+ *  Writes the counts summed by the function called and then by line, each
+ *  from the most cycles to the least.
+ */
+void WriteFlatProfile(const SimProfile* profile, FILE* out);
+
+/*
+ *  Writes a line per call stack that ran, with its frames separated by ;
+ *  and followed by the cycles spent in its innermost frame.
+ */
+void WriteFoldedStacks(const SimProfile* profile, FILE* out);
+
+void FreeSimProfile(SimProfile* profile);
+
+#endif
@@ -0,0 +1,135 @@
+/*
+ *  Wrappers that 61ccc is linked with through the linker's --wrap, so that
+ *  calls into the library's phases and to the allocator pass through here
+ *  for --stats. The library's headers are not in this directory, so the
+ *  declarations below are taken from how its main calls them.
+ */
+
+#include <stdlib.h>
+#include "ast.h"
+#include "cgen.h"
+#include "compile-stats.h"
+#include "dast.h"
+#include "decl.h"
+
+/* A node of the list TokenFile returns, with one token per node. */
+typedef struct tokenList {
+  void* token;
+  struct tokenList* next;
+} TokenList;
+
+TokenList* __real_TokenFile(char* filename);
+AST* __real_ParseTokens(TokenList* tokens, char* filename);
+DAST* __real_DecorateTree(AST* ast, char* filename, Decl** globalDecl);
+int __real_FoldConstants(DAST** dast);
+void __real_GenerateCode(DAST* dast, char* filename, Decl* globalDecl);
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+void __real_free(void* ptr);
+
+static size_t CountASTNodes(AST* ast) {
+  size_t total = 1;
+  for (size_t i = 0; i < ast->size; i++) {
+    total += CountASTNodes(ast->children[i]);
+  }
+  return total;
+}
+
+static size_t CountDASTNodes(DAST* dast) {
+  size_t total = 1;
+  for (size_t i = 0; i < dast->size; i++) {
+    total += CountDASTNodes(dast->children[i]);
+  }
+  return total;
+}
+
+static size_t CountDecls(Decl* scope) {
+  size_t total = scope->childrenSize;
+  for (size_t i = 0; i < scope->childrenSize; i++) {
+    total += CountDecls(scope->children[i]);
+  }
+  return total;
+}
+
+TokenList* __wrap_TokenFile(char* filename) {
+  TokenList* tokens;
+  BeginPhase(PHASE_TOKENIZE);
+  tokens = __real_TokenFile(filename);
+  EndPhase(PHASE_TOKENIZE);
+  if (StatsEnabled()) {
+    for (TokenList* node = tokens; node != NULL; node = node->next) {
+      AddStat(STAT_TOKENS, 1);
+    }
+  }
+  return tokens;
+}
+
+AST* __wrap_ParseTokens(TokenList* tokens, char* filename) {
+  AST* ast;
+  BeginPhase(PHASE_PARSE);
+  ast = __real_ParseTokens(tokens, filename);
+  EndPhase(PHASE_PARSE);
+  if (StatsEnabled() && ast != NULL) {
+    AddStat(STAT_AST_NODES, CountASTNodes(ast));
+  }
+  return ast;
+}
+
+DAST* __wrap_DecorateTree(AST* ast, char* filename, Decl** globalDecl) {
+  DAST* dast;
+  BeginPhase(PHASE_DECORATE);
+  dast = __real_DecorateTree(ast, filename, globalDecl);
+  EndPhase(PHASE_DECORATE);
+  if (StatsEnabled() && dast != NULL) {
+    AddStat(STAT_DAST_NODES, CountDASTNodes(dast));
+  }
+  return dast;
+}
+
+/*
+ *  Only the decorator's calls are wrapped. The folder's calls to itself
+ *  stay inside the library's object file and are not.
+ */
+int __wrap_FoldConstants(DAST** dast) {
+  int result;
+  BeginPhase(PHASE_FOLD);
+  result = __real_FoldConstants(dast);
+  EndPhase(PHASE_FOLD);
+  return result;
+}
+
+void __wrap_GenerateCode(DAST* dast, char* filename, Decl* globalDecl) {
+  if (StatsEnabled() && globalDecl != NULL) {
+    MaxStat(STAT_DECLS, CountDecls(globalDecl));
+  }
+  BeginPhase(PHASE_GENERATE);
+  __real_GenerateCode(dast, filename, globalDecl);
+  EndPhase(PHASE_GENERATE);
+}
+
+/*
+ *  realloc counts as an allocation of its new size, as the block it
+ *  returns may have moved.
+ */
+void* __wrap_malloc(size_t size) {
+  AddAllocation(size);
+  return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+  AddAllocation(count * size);
+  return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+  AddAllocation(size);
+  return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void* ptr) {
+  if (ptr != NULL) {
+    AddFree();
+  }
+  __real_free(ptr);
+}
@@ -0,0 +1,277 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "compile-stats.h"
+#include "string-pool.h"
+#include "utils.h"
+
+#define BYTE_DIRECTIVE ".byte "
+
+typedef struct textLine {
+  const char* start;
+  size_t length;      /* Not counting the newline.                        */
+} TextLine;
+
+/*
+ *  A literal found in the output, laid out as its label line followed by a
+ *  .byte line for each byte up to and including the terminating 0.
+ */
+typedef struct literal {
+  size_t labelLine;
+  uint8_t* bytes;
+  size_t byteTotal;
+  size_t host;        /* Literal whose bytes this one is placed in.       */
+  size_t offset;      /* Where in the host it starts.                     */
+} Literal;
+
+static Literal* literals = NULL;
+
+static void* CheckedMalloc(size_t bytes) {
+  void* result = malloc(bytes ? bytes : 1);
+  if (result == NULL) {
+    AllocationFailed();
+  }
+  return result;
+}
+
+static int LineStartsWith(const TextLine* line, const char* prefix) {
+  size_t length = strlen(prefix);
+  return line->length >= length && strncmp(line->start, prefix, length) == 0;
+}
+
+/*
+ *  Returns if line is .byte followed by a value that fits in a byte, which
+ *  is stored in value.
+ */
+static int ParseByteLine(const TextLine* line, uint8_t* value) {
+  size_t i = strlen(BYTE_DIRECTIVE);
+  long parsed = 0;
+  int negative;
+  if (!LineStartsWith(line, BYTE_DIRECTIVE) || i == line->length) {
+    return 0;
+  }
+  negative = line->start[i] == '-';
+  i += negative;
+  if (i == line->length) {
+    return 0;
+  }
+  for (; i < line->length; i++) {
+    if (line->start[i] < '0' || line->start[i] > '9' || parsed > 255) {
+      return 0;
+    }
+    parsed = parsed * 10 + (line->start[i] - '0');
+  }
+  if (negative ? parsed > 128 : parsed > 255) {
+    return 0;
+  }
+  *value = (uint8_t) (negative ? -parsed : parsed);
+  return 1;
+}
+
+/*
+ *  Reads the literal whose label is on line index, returning 0 if the lines
+ *  there are not exactly what GenerateString emits.
+ */
+static int ParseLiteral(const TextLine* lines, size_t lineTotal, size_t index, Literal* literal) {
+  const TextLine* label = &lines[index];
+  size_t end = index + 1;
+  uint8_t value = 1;
+  if (!LineStartsWith(label, STRING_LABEL_PREFIX) || label->start[label->length - 1] != ':' ||
+      memchr(label->start, ' ', label->length) != NULL) {
+    return 0;
+  }
+  while (value != 0 && end < lineTotal && ParseByteLine(&lines[end], &value)) {
+    end++;
+  }
+  /* Bytes after the terminator would belong to something else. */
+  if (value != 0 || (end < lineTotal && LineStartsWith(&lines[end], BYTE_DIRECTIVE))) {
+    return 0;
+  }
+  literal->labelLine = index;
+  literal->byteTotal = end - index - 1;
+  literal->bytes = CheckedMalloc(literal->byteTotal);
+  for (size_t i = 0; i < literal->byteTotal; i++) {
+    ParseByteLine(&lines[index + 1 + i], &literal->bytes[i]);
+  }
+  return 1;
+}
+
+/*
+ *  Returns if a ends with all of b.
+ */
+static int EndsWith(const Literal* a, const Literal* b) {
+  return b->byteTotal <= a->byteTotal &&
+         memcmp(a->bytes + a->byteTotal - b->byteTotal, b->bytes, b->byteTotal) == 0;
+}
+
+/*
+ *  Orders literals by their bytes read backwards, so each literal sorts
+ *  right before the ones that end with it.
+ */
+static int CompareReversed(const void* first, const void* second) {
+  const Literal* a = &literals[*(const size_t*) first];
+  const Literal* b = &literals[*(const size_t*) second];
+  size_t shorter = a->byteTotal < b->byteTotal ? a->byteTotal : b->byteTotal;
+  for (size_t i = 1; i <= shorter; i++) {
+    uint8_t x = a->bytes[a->byteTotal - i];
+    uint8_t y = b->bytes[b->byteTotal - i];
+    if (x != y) {
+      return x < y ? -1 : 1;
+    }
+  }
+  return a->byteTotal < b->byteTotal ? -1 : a->byteTotal > b->byteTotal;
+}
+
+/*
+ *  Orders literals by the host they are placed in and then their offset.
+ */
+static int ComparePlacement(const void* first, const void* second) {
+  const Literal* a = &literals[*(const size_t*) first];
+  const Literal* b = &literals[*(const size_t*) second];
+  if (a->host != b->host) {
+    return a->host < b->host ? -1 : 1;
+  }
+  return a->offset < b->offset ? -1 : a->offset > b->offset;
+}
+
+/*
+ *  Sets the host and offset of every literal and returns how many were
+ *  merged into another one.
+ */
+static size_t MergeLiterals(size_t literalTotal) {
+  size_t* order = CheckedMalloc(sizeof(size_t) * literalTotal);
+  size_t merged = 0;
+  for (size_t i = 0; i < literalTotal; i++) {
+    literals[i].host = i;
+    literals[i].offset = 0;
+    order[i] = i;
+  }
+
+  /* Each literal goes in the longest one after it that ends with it. */
+  qsort(order, literalTotal, sizeof(size_t), CompareReversed);
+  size_t host = order[literalTotal - 1];
+  for (size_t i = literalTotal - 1; i-- > 0;) {
+    Literal* literal = &literals[order[i]];
+    if (EndsWith(&literals[host], literal)) {
+      literal->host = host;
+      literal->offset = literals[host].byteTotal - literal->byteTotal;
+      merged++;
+    } else {
+      host = order[i];
+    }
+  }
+  free(order);
+  return merged;
+}
+
+static void WriteLine(FILE* out, const TextLine* line) {
+  fwrite(line->start, 1, line->length, out);
+  putc('\n', out);
+}
+
+/*
+ *  Writes a host literal with the labels of every literal placed in it,
+ *  which are given in order of offset by placed.
+ */
+static void WriteHost(FILE* out, const TextLine* lines, size_t host, const size_t* placed, size_t placedTotal) {
+  const Literal* literal = &literals[host];
+  for (size_t i = 0; i < literal->byteTotal; i++) {
+    for (; placedTotal > 0 && literals[*placed].offset == i; placed++, placedTotal--) {
+      WriteLine(out, &lines[literals[*placed].labelLine]);
+    }
+    WriteLine(out, &lines[literal->labelLine + 1 + i]);
+  }
+}
+
+char* PoolStringLiterals(const char* text, size_t* size) {
+  size_t lineTotal = 0;
+  size_t literalTotal = 0;
+  TextLine* lines;
+  size_t* placed;
+  char* pooled = NULL;
+  size_t pooledSize = 0;
+  FILE* out;
+
+  for (size_t i = 0; i < *size; i++) {
+    lineTotal += text[i] == '\n';
+  }
+  lines = CheckedMalloc(sizeof(TextLine) * (lineTotal + 1));
+  lineTotal = 0;
+  for (const char* start = text; start < text + *size;) {
+    const char* newline = memchr(start, '\n', text + *size - start);
+    const char* end = newline != NULL ? newline : text + *size;
+    lines[lineTotal].start = start;
+    lines[lineTotal++].length = end - start;
+    start = end + 1;
+  }
+
+  literals = CheckedMalloc(sizeof(Literal) * (lineTotal + 1));
+  for (size_t i = 0; i < lineTotal; i++) {
+    if (ParseLiteral(lines, lineTotal, i, &literals[literalTotal])) {
+      i += literals[literalTotal++].byteTotal;
+    }
+  }
+  size_t merged = literalTotal != 0 ? MergeLiterals(literalTotal) : 0;
+  AddStat(STAT_STRINGS_MERGED, merged);
+  if (merged == 0) {
+    for (size_t i = 0; i < literalTotal; i++) {
+      free(literals[i].bytes);
+    }
+    free(literals);
+    literals = NULL;
+    free(lines);
+    return NULL;
+  }
+
+  /* Literals placed in a host, in order of host then offset. */
+  placed = CheckedMalloc(sizeof(size_t) * literalTotal);
+  size_t placedTotal = 0;
+  for (size_t i = 0; i < literalTotal; i++) {
+    if (literals[i].host != i) {
+      placed[placedTotal++] = i;
+    }
+  }
+  qsort(placed, placedTotal, sizeof(size_t), ComparePlacement);
+
+  out = open_memstream(&pooled, &pooledSize);
+  if (out == NULL) {
+    AllocationFailed();
+  }
+  size_t next = 0;
+  size_t nextPlaced = 0;
+  for (size_t i = 0; i < lineTotal; i++) {
+    if (next < literalTotal && literals[next].labelLine == i) {
+      Literal* literal = &literals[next];
+      if (literal->host == next) {
+        size_t first = nextPlaced;
+        while (first < placedTotal && literals[placed[first]].host < next) {
+          first++;
+        }
+        nextPlaced = first;
+        while (nextPlaced < placedTotal && literals[placed[nextPlaced]].host == next) {
+          nextPlaced++;
+        }
+        WriteLine(out, &lines[i]);
+        WriteHost(out, lines, next, placed + first, nextPlaced - first);
+      }
+      i += literal->byteTotal;
+      next++;
+    } else {
+      WriteLine(out, &lines[i]);
+    }
+  }
+  fclose(out);
+
+  for (size_t i = 0; i < literalTotal; i++) {
+    free(literals[i].bytes);
+  }
+  free(literals);
+  literals = NULL;
+  free(lines);
+  free(placed);
+  *size = pooledSize;
+  return pooled;
+}
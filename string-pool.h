@@ -0,0 +1,30 @@
+/*
+ *  File that holds the pool the string literals of a program are laid out
+ *  through before the output is written. GenerateString gives every literal
+ *  its own __str__ label and run of .byte lines in .data, and GetStringLabel
+ *  already gives identical literals one label. The pool merges each literal
+ *  that is a suffix of a longer one into its tail, so "hello world" and
+ *  "world" take up the space of one string.
+ *
+ *  stringLabelMap and the linear search of it in GetStringLabel belong to
+ *  the prebuilt library, which fills and searches the list from its own
+ *  code, so they cannot be replaced with a hash table from here.
+ */
+
+#ifndef STRING_POOL_H
+#define STRING_POOL_H
+
+#include <stddef.h>
+
+/* Prefix of the labels GenerateStringLabel hands out. */
+#define STRING_LABEL_PREFIX "__str__"
+
+/*
+ *  Returns a copy of the size bytes of assembly in text with its string
+ *  literals merged and stores the size of the copy in size, or returns NULL
+ *  if there was nothing to merge. Anything that does not look exactly like
+ *  the output of GenerateString is left alone.
+ */
+char* PoolStringLiterals(const char* text, size_t* size);
+
+#endif
@@ -1,11 +1,136 @@
 #include "additional-instructions.h"
 #include "instructions.h"
 #include "student-cgen.h"
+#include "cgen-options.h"
+#include "compile-stats.h"
+#include "intern-pool.h"
+#include "linear-ir.h"
+#include "peephole.h"
+#include "register-alloc.h"
+#include "rv-assembler.h"
 #include "cgen.h"
 #include "cgen-helpers.h"
 #include "decorate-builtins.h"
 #include "utils.h"
 
+/*
+ *  Registers used to hold the first operand of a binary expression while the
+ *  second operand is evaluated, in the order they are handed out. The
+ *  remaining registers are all written by other parts of code generation:
+ *  T0 is scratch for ApplyTypeRules and assignments, S2 and S3 hold values
+ *  for ++ and --, and A0 and A1 carry return values.
+ *
+ *  Temporaries come first because they do not need to be saved by the
+ *  function using them. ProcessExprCall preserves any that are live across
+ *  a call.
+ */
+static const enum reg exprRegs[] = {
+  T1, T2, T3, T4, T5, S4, S5, S6, S7, S8, S9, S10, S11
+};
+
+#define EXPR_REG_TOTAL (sizeof(exprRegs) / sizeof(exprRegs[0]))
+
+/*
+ *  Registers a function must preserve for its caller, in the order of their
+ *  slots in the space SaveRegisters reserves.
+ */
+static const enum reg savedRegs[] = {
+  S1, S2, S3, S4, S5, S6, S7, S8, S9, S10, S11, RA
+};
+
+#define SAVED_REG_TOTAL (sizeof(savedRegs) / sizeof(savedRegs[0]))
+#define SAVED_BYTES ((int) (SAVED_REG_TOTAL * WORDSIZE))
+
+/*
+ *  Bitmask indexed by enum reg of the registers in exprRegs that currently
+ *  hold a value.
+ */
+static uint32_t liveExprRegs = 0;
+
+/*
+ *  Returns an unused register from exprRegs and marks it live, or X0 if
+ *  every register is holding a value.
+ */
+static enum reg AllocateExprReg() {
+  for (size_t i = 0; i < EXPR_REG_TOTAL; i++) {
+    if (!(liveExprRegs & (1u << exprRegs[i]))) {
+      liveExprRegs |= 1u << exprRegs[i];
+      return exprRegs[i];
+    }
+  }
+  return X0;
+}
+
+/*
+ *  Marks a register returned by AllocateExprReg as free again.
+ */
+static void FreeExprReg(enum reg r) {
+  liveExprRegs &= ~(1u << r);
+}
+
+/*
+ *  Returns if a register is a temporary that is live and therefore must be
+ *  preserved by the caller across a function call.
+ */
+static int IsLiveTempReg(enum reg r) {
+  return r >= T1 && r <= T5 && (liveExprRegs & (1u << r));
+}
+
+/*
+ *  Returns a new local label from the intern pool, which the IR keeps its
+ *  labels in anyway, so handlers can pass it around without freeing it.
+ */
+static char* NewLocalLabel() {
+  char* label = GenerateLocalLabel();
+  char* pooled = InternString(label);
+  free(label);
+  return pooled;
+}
+
+/*
+ *  Source position of the last line marker emitted with --line-info, or a
+ *  NULL file before the first one in a function.
+ */
+static char* markedFile = NULL;
+static int markedLine = 0;
+
+/*
+ *  With --line-info emits a LINE_MARKER comment saying the code after it
+ *  comes from line linenum of filename, unless that is already marked.
+ */
+static void MarkSourceLine(char* filename, int linenum) {
+  if (!GetCGenOptions()->lineInfo || filename == NULL || linenum <= 0) {
+    return;
+  }
+  if (markedFile != NULL && markedLine == linenum && strcmp(markedFile, filename) == 0) {
+    return;
+  }
+  size_t size = strlen(LINE_MARKER) + strlen(filename) + 16;
+  char* comment = malloc(size);
+  if (comment == NULL) {
+    AllocationFailed();
+  }
+  snprintf(comment, size, LINE_MARKER " %s:%d", filename, linenum);
+  EmitCOMMENT(comment);
+  free(comment);
+  markedFile = filename;
+  markedLine = linenum;
+}
+
+/*
+ *  Dispatches on child with its line marked, then marks the line of the
+ *  code that follows it again.
+ */
+static void DispatchChild(DAST* child, char* startLabel, char* endLabel, int regBytes) {
+  char* file = markedFile;
+  int line = markedLine;
+  MarkSourceLine(child->filename, child->linenum);
+  Dispatch(child, startLabel, endLabel, regBytes);
+  if (file != NULL) {
+    MarkSourceLine(file, line);
+  }
+}
+
 /*
  *  Code used to generate the negate expression. This is complete and is
  *  included to provide you an example of code generation.
@@ -18,10 +143,11 @@
 void ProcessExprPrefixNegate(DAST* dast,
                              char* startLabel,
                              char* endLabel, int regBytes) {
+  MarkSourceLine(dast->filename, dast->linenum);
   DAST* child1 = dast->children[0];
 
   /* cgen and load arguments */
-  Dispatch(child1, startLabel, endLabel, regBytes);
+  DispatchChild(child1, startLabel, endLabel, regBytes);
   /* Negate by flipping all the bits and add 1. */
   EmitXORI(S1, S1, -1);
   EmitADDI(S1, S1, 1);
@@ -39,6 +165,10 @@ void ProcessExprPrefixNegate(DAST* dast,
  *  You should use the enum values in instructions.h and be sure and restore the
  *  stack to its previous value upon returning from the function
  *
+ *  The first value is kept in a register from exprRegs so nested expressions
+ *  do not touch memory. Only once every register in the pool is in use does
+ *  it fall back to pushing the value on the stack and reloading it into A0.
+ *
  *   Hint: When using lw/sw the argument order is Reg, imm, Reg and it matches
  *
  *   lw register immediate(register)
@@ -48,20 +178,28 @@ enum reg SetupBinaryInvariant(DAST* dast, char* startLabel, char* endLabel, int
   DAST* child2 = dast->children[1];
   /* STUDENT CODE GOES HERE. */
 
-  EmitADDI(SP, SP, -4);
-
-  Dispatch(child1, startLabel, endLabel, regBytes);
-  EmitSW(S1, 0, SP);
-  Dispatch(child2, startLabel, endLabel, regBytes);
-  EmitLW(A0, 0, SP);
-
-  EmitADDI(SP, SP, 4);
+  DispatchChild(child1, startLabel, endLabel, regBytes);
+  enum reg firstReg = AllocateExprReg();
+  if (firstReg != X0) {
+    /* Hold the first value in a free register while the second is built. */
+    EmitMV(firstReg, S1);
+    DispatchChild(child2, startLabel, endLabel, regBytes);
+    FreeExprReg(firstReg);
+  } else {
+    /* The register pool is exhausted so spill to the stack. */
+    EmitADDI(SP, SP, -4);
+    EmitSW(S1, 0, SP);
+    DispatchChild(child2, startLabel, endLabel, regBytes);
+    EmitLW(A0, 0, SP);
+    EmitADDI(SP, SP, 4);
+    firstReg = A0;
+  }
 
   ApplyTypeRules(dast, S1);
   /*
    *  Replace this return value with the register you load the first arg into.
    */
-  return A0;
+  return firstReg;
 }
 
 /*
@@ -73,6 +211,7 @@ enum reg SetupBinaryInvariant(DAST* dast, char* startLabel, char* endLabel, int
 void ProcessExprBinaryBitAnd(DAST* dast,
                              char* startLabel,
                              char* endLabel, int regBytes) {
+  MarkSourceLine(dast->filename, dast->linenum);
 
   DAST* child1 = dast->children[0];
   DAST* child2 = dast->children[1];
@@ -95,6 +234,7 @@ void ProcessExprBinaryBitAnd(DAST* dast,
 void ProcessExprBinaryBitOr(DAST* dast,
                             char* startLabel,
                             char* endLabel, int regBytes) {
+  MarkSourceLine(dast->filename, dast->linenum);
 
   DAST* child1 = dast->children[0];
   DAST* child2 = dast->children[1];
@@ -117,6 +257,7 @@ void ProcessExprBinaryBitOr(DAST* dast,
 void ProcessExprBinaryBitXor(DAST* dast,
                              char* startLabel,
                              char* endLabel, int regBytes) {
+  MarkSourceLine(dast->filename, dast->linenum);
 
   DAST* child1 = dast->children[0];
   DAST* child2 = dast->children[1];
@@ -131,8 +272,9 @@ void ProcessExprBinaryBitXor(DAST* dast,
 }
 
 /*
- *  Function used to handle code generation for all && expressions. As with all
- *  binary expressions it relies on the binary invariant completed in part 1.
+ *  Function used to handle code generation for all && expressions. Unlike the
+ *  other binary expressions it does not use the binary invariant, because the
+ *  second operand is only evaluated when the first one is true.
  *
  *  An operand is considered to have a true value if it is nonzero and a false
  *  value if it is 0.
@@ -145,31 +287,28 @@ void ProcessExprBinaryBitXor(DAST* dast,
 void ProcessExprBinaryLogicAnd(DAST* dast,
                                char* startLabel,
                                char* endLabel, int regBytes) {
+  MarkSourceLine(dast->filename, dast->linenum);
 
-  /* First apply our invariant. */
-  enum reg firstReg = SetupBinaryInvariant (dast, startLabel, endLabel, regBytes);
+  DAST* child1 = dast->children[0];
+  DAST* child2 = dast->children[1];
   /* STUDENT CODE HERE. */
-  char* false_label = GenerateLocalLabel();
-  char* end_label   = GenerateLocalLabel();
-
-  EmitBEQ(firstReg, X0, false_label);
-  EmitBEQ(S1, X0, false_label);
-  EmitADDI(S1, X0, 1);
-  EmitJ(end_label);
+  char* end_label = NewLocalLabel();
 
-  EmitLABEL(false_label);
-  EmitADD(S1, X0, X0);
+  /* A false first operand is already the 0 result. */
+  DispatchChild(child1, startLabel, endLabel, regBytes);
+  EmitBEQ(S1, X0, end_label);
+  DispatchChild(child2, startLabel, endLabel, regBytes);
+  EmitSNEZ(S1, S1);
 
   EmitLABEL(end_label);
 
   ApplyTypeRules(dast, S1);
-  free(false_label);
-  free(end_label);
 }
 
 /*
- *  Function used to handle code generation for all || expressions. As with all
- *  binary expressions it relies on the binary invariant completed in part 1.
+ *  Function used to handle code generation for all || expressions. Unlike the
+ *  other binary expressions it does not use the binary invariant, because the
+ *  second operand is only evaluated when the first one is false.
  *
  *  An operand is considered to have a true value if it is nonzero and a false
  *  value if it is 0.
@@ -182,31 +321,22 @@ void ProcessExprBinaryLogicAnd(DAST* dast,
 void ProcessExprBinaryLogicOr(DAST* dast,
                               char* startLabel,
                               char* endLabel, int regBytes) {
+  MarkSourceLine(dast->filename, dast->linenum);
 
-  /* First apply our invariant. */
-  enum reg firstReg = SetupBinaryInvariant (dast, startLabel, endLabel, regBytes);
+  DAST* child1 = dast->children[0];
+  DAST* child2 = dast->children[1];
   /* STUDENT CODE HERE. */
+  char* end_label = NewLocalLabel();
 
-  char* success_label = GenerateLocalLabel();
-  char* false_label = GenerateLocalLabel();
-  char* end_label   = GenerateLocalLabel();
-
-  EmitBNE(firstReg, X0, success_label);
-  EmitBNE(S1, X0, success_label);
-
-  EmitLABEL(false_label);
-  EmitADD(S1, X0, X0);
-  EmitJ(end_label);
-
-  EmitLABEL(success_label);
-  EmitADDI(S1, X0, 1);
+  DispatchChild(child1, startLabel, endLabel, regBytes);
+  EmitSNEZ(S1, S1);
+  EmitBNE(S1, X0, end_label);
+  DispatchChild(child2, startLabel, endLabel, regBytes);
+  EmitSNEZ(S1, S1);
 
   EmitLABEL(end_label);
 
   ApplyTypeRules(dast, S1);
-  free(success_label);
-  free(false_label);
-  free(end_label);
 }
 
 /*
@@ -224,6 +354,7 @@ void ProcessExprBinaryLogicOr(DAST* dast,
 void ProcessExprBinaryEq(DAST* dast,
                          char* startLabel,
                          char* endLabel, int regBytes) {
+  MarkSourceLine(dast->filename, dast->linenum);
 
   DAST* child1 = dast->children[0];
   DAST* child2 = dast->children[1];
@@ -232,24 +363,9 @@ void ProcessExprBinaryEq(DAST* dast,
   /* Make sure type sizes match. */
   MatchSizes (child1, firstReg, child2, S1);
   /* STUDENT CODE HERE. */
-  //Decl* child1_type = dast->children[0]->typeDecl;
-  //Decl* child2_type = dast->children[1]->typeDecl;
-
-  char* false_label = GenerateLocalLabel();
-  char* end_label   = GenerateLocalLabel();
-
-  //EmitBNE(child1_type, child2_type, false_label);
-  EmitBNE(firstReg, S1, false_label);
-  EmitADDI(S1, X0, 1);
-  EmitJ(end_label);
-
-  EmitLABEL(false_label);
-  EmitADD(S1, X0, X0);
-
-  EmitLABEL(end_label);
+  EmitXOR(S1, firstReg, S1);
+  EmitSEQZ(S1, S1);
   ApplyTypeRules(dast, S1);
-  free(false_label);
-  free(end_label);
 }
 
 /*
@@ -267,6 +383,7 @@ void ProcessExprBinaryEq(DAST* dast,
 void ProcessExprBinaryNotEq(DAST* dast,
                             char* startLabel,
                             char* endLabel, int regBytes) {
+  MarkSourceLine(dast->filename, dast->linenum);
 
   DAST* child1 = dast->children[0];
   DAST* child2 = dast->children[1];
@@ -276,24 +393,39 @@ void ProcessExprBinaryNotEq(DAST* dast,
   MatchSizes (child1, firstReg, child2, S1);
 
   /* STUDENT CODE HERE. */
-  //Decl* child1_type = dast->children[0]->typeDecl;
-  //Decl* child2_type = dast->children[1]->typeDecl;
-
-  char* true_label = GenerateLocalLabel();
-  char* end_label   = GenerateLocalLabel();
-
-  //EmitBNE(child1_type, child2_type, true_label);
-  EmitBNE(firstReg, S1, true_label);
-  EmitADD(S1, X0, X0);
-  EmitJ(end_label);
+  EmitXOR(S1, firstReg, S1);
+  EmitSNEZ(S1, S1);
+  ApplyTypeRules(dast, S1);
+}
 
-  EmitLABEL(true_label);
-  EmitADDI(S1, X0, 1);
+/*
+ *  Returns k if value is 2 to the k, otherwise -1.
+ */
+static int ExactLog2(int value) {
+  for (int k = 0; k < 31; k++) {
+    if (value == 1 << k) {
+      return k;
+    }
+  }
+  return -1;
+}
 
-  EmitLABEL(end_label);
-  ApplyTypeRules(dast, S1);
-  free(true_label);
-  free(end_label);
+/*
+ *  Scales the index of pointer arithmetic by dataSize and returns the
+ *  register holding the result. Sizes that are powers of two are scaled
+ *  with a shift and a size of 1 needs no scaling at all.
+ */
+static enum reg EmitScaleIndex(enum reg index, int dataSize) {
+  int shift = ExactLog2(dataSize);
+  if (shift == 0) {
+    return index;
+  } else if (shift > 0) {
+    EmitSLLI(A1, index, shift);
+  } else {
+    EmitADDI(A1, X0, dataSize);
+    EmitMUL(A1, A1, index);
+  }
+  return A1;
 }
 
 /*
@@ -319,6 +451,7 @@ void ProcessExprBinaryNotEq(DAST* dast,
 void ProcessExprBinaryAdd(DAST* dast,
                           char* startLabel,
                           char* endLabel, int regBytes) {
+  MarkSourceLine(dast->filename, dast->linenum);
 
   DAST* child1   = dast->children[0];
   int c1PtrTotal = child1->typeDeclArrCount + child1->typeDeclPtrCount;
@@ -332,16 +465,10 @@ void ProcessExprBinaryAdd(DAST* dast,
 
   if (c1PtrTotal > 0) { /* child 1 is the pointer, meaning S1 is an int */
     int dataSize = child1->typeDecl->dataSize;
-    EmitADD(T0, X0, S1);
-    EmitADDI(T1, X0, dataSize);
-    EmitMUL(T1, T1, T0);
-    EmitADD(S1, firstReg, T1);
+    EmitADD(S1, firstReg, EmitScaleIndex(S1, dataSize));
   } else if (c2PtrTotal > 0) { /* child 2 is the pointer, meaning A0 is an int */
     int dataSize = child2->typeDecl->dataSize;
-    EmitADD(T0, X0, firstReg);
-    EmitADDI(T1, X0, dataSize);
-    EmitMUL(T1, T1, T0);
-    EmitADD(S1, S1, T1);
+    EmitADD(S1, S1, EmitScaleIndex(firstReg, dataSize));
   } else {  /* normal addition */
     EmitADD(S1, S1, firstReg);
   }
@@ -380,6 +507,7 @@ void ProcessExprBinaryAdd(DAST* dast,
 void ProcessExprBinarySub(DAST* dast,
                           char* startLabel,
                           char* endLabel, int regBytes) {
+  MarkSourceLine(dast->filename, dast->linenum);
 
   DAST* child1   = dast->children[0];
   int c1PtrTotal = child1->typeDeclArrCount + child1->typeDeclPtrCount;
@@ -392,21 +520,22 @@ void ProcessExprBinarySub(DAST* dast,
   /* STUDENT CODE HERE. */
   if (c1PtrTotal > 0 && c2PtrTotal == 0) { /* child 1 is the pointer, S1 is an int */
     int dataSize = child1->typeDecl->dataSize;
-    EmitADD(T0, X0, S1);
-    EmitADDI(T1, X0, dataSize);
-    EmitMUL(T1, T1, T0);
-    EmitSUB(S1, firstReg, T1);
+    EmitSUB(S1, firstReg, EmitScaleIndex(S1, dataSize));
   } else if (c2PtrTotal > 0 && c1PtrTotal == 0) { /* child 2 is the pointer, A0 is an int */
     int dataSize = child2->typeDecl->dataSize;
-    EmitADD(T0, X0, firstReg);
-    EmitADDI(T1, X0, dataSize);
-    EmitMUL(T1, T1, T0);
-    EmitSUB(S1, S1, T1);
+    EmitSUB(S1, S1, EmitScaleIndex(firstReg, dataSize));
   } else if (c2PtrTotal > 0 && c1PtrTotal > 0) { /* A0 and S1 are pointers */
     int dataSize = child1->typeDecl->dataSize;
-    EmitADDI(T0, X0, dataSize);
+    int shift = ExactLog2(dataSize);
     EmitSUB(S1, firstReg, S1);
-    EmitDIV(S1, S1, T0);
+    /* The distance is a multiple of dataSize so shifting is exact. */
+    if (shift > 0) {
+      EmitSRAI(S1, S1, shift);
+    } else if (shift < 0) {
+      /* The peephole pass turns this into a multiply by reciprocal. */
+      EmitADDI(T0, X0, dataSize);
+      EmitDIV(S1, S1, T0);
+    }
   } else {  /* normal addition */
     EmitSUB(S1, firstReg, S1);
   }
@@ -414,6 +543,57 @@ void ProcessExprBinarySub(DAST* dast,
   ApplyTypeRules (dast, S1);
 }
 
+/*
+ *  Returns if a comparison between child1 and child2 is signed. Pointer
+ *  comparisons are unsigned, otherwise the signedness of the highest
+ *  priority operand type is used (see ProcessExprBinaryGTEq).
+ */
+static int IsSignedCompare(DAST* child1, int c1PtrTotal, DAST* child2, int c2PtrTotal) {
+  Decl* child1_type = child1->typeDecl;
+  Decl* child2_type = child2->typeDecl;
+  if (c1PtrTotal > 0 && c2PtrTotal > 0) { /* we are working with pointers */
+    return 0;
+  } else if (child1_type == uintType || child2_type == uintType) { /* if highest priority, unsigned */
+    return 0;
+  } else if (child1_type == intType || child2_type == intType) { /* if second highest priority, signed */
+    return 1;
+  } else if (child1_type == ucharType || child2_type == ucharType) { /* if third highest priority, unsigned */
+    return 0;
+  } else { /* either 4th lowest priority or lowest priority, call it signed either way*/
+    return 1;
+  }
+}
+
+/*
+ *  Sets S1 to 1 if lhs < rhs and to 0 otherwise, without branching.
+ */
+static void EmitLessThan(enum reg lhs, enum reg rhs, int isSigned) {
+  if (isSigned) {
+    EmitSLT(S1, lhs, rhs);
+  } else {
+    EmitSLTU(S1, lhs, rhs);
+  }
+}
+
+/*
+ *  Branches to label when whether lhs < rhs equals branchIf.
+ */
+static void EmitBranchLessThan(enum reg lhs, enum reg rhs, int branchIf, int isSigned, char* label) {
+  if (isSigned) {
+    if (branchIf) {
+      EmitBLT(lhs, rhs, label);
+    } else {
+      EmitBGE(lhs, rhs, label);
+    }
+  } else {
+    if (branchIf) {
+      EmitBLTU(lhs, rhs, label);
+    } else {
+      EmitBGEU(lhs, rhs, label);
+    }
+  }
+}
+
 /*
  *  Function used to handle code generation for all >= expressions. As with all
  *  binary expressions it relies on the binary invariant completed in part 1.
@@ -456,6 +636,7 @@ void ProcessExprBinarySub(DAST* dast,
 void ProcessExprBinaryGTEq(DAST* dast,
                            char* startLabel,
                            char* endLabel, int regBytes) {
+  MarkSourceLine(dast->filename, dast->linenum);
 
   DAST* child1   = dast->children[0];
   int c1PtrTotal = child1->typeDeclArrCount + child1->typeDeclPtrCount;
@@ -467,83 +648,9 @@ void ProcessExprBinaryGTEq(DAST* dast,
   MatchSizes (child1, firstReg, child2, S1);
 
   /* STUDENT CODE HERE. */
-
-  //Decl* child1_type = dast->children[0]->typeDecl;
-  //Decl* child2_type = dast->children[1]->typeDecl;
-
-  if (c1PtrTotal > 0 && c2PtrTotal > 0) { /* we are working with pointers */
-    char* trueLabel  = GenerateLocalLabel();
-    char* falseLabel = GenerateLocalLabel();
-    char* endLabel   = GenerateLocalLabel();
-    EmitBEQ(firstReg, S1, trueLabel);
-
-    EmitSLTU(S1, S1, firstReg);
-    EmitBEQ(S1, X0, falseLabel);
-    EmitJ(trueLabel);
-
-    EmitLABEL(falseLabel);
-    EmitADD(S1, X0, X0);
-    EmitJ(endLabel);
-
-    EmitLABEL(trueLabel);
-    EmitADDI(S1, X0, 1);
-
-    EmitLABEL(endLabel);
-    free(trueLabel);
-    free(falseLabel);
-    free(endLabel);
-  } else {
-    char* trueLabel = GenerateLocalLabel();
-    char* falseLabel = GenerateLocalLabel();
-    char* endLabel   = GenerateLocalLabel();
-    int highest; /* true for signed, false for unsigned */
-    Decl* child1_type = child1->typeDecl;
-    Decl* child2_type = child2->typeDecl;
-
-    if (child1_type == uintType || child2_type == uintType) { /* if highest priority, unsigned */
-      highest = 0;
-    } else if (child1_type == intType || child2_type == intType) { /* if second highest priority, signed */
-      highest = 1;
-    } else if (child1_type == ucharType || child2_type == ucharType) { /* if third highest priority, unsigned */
-      highest = 0;
-    } else { /* either 4th lowest priority or lowest priority, call it signed either way*/
-      highest = 1;
-    }
-    if (highest) {
-      EmitBEQ(firstReg, S1, trueLabel);
-
-      EmitSLT(S1, S1, firstReg);
-      EmitBEQ(S1, X0, falseLabel);
-      EmitJ(trueLabel);
-
-      EmitLABEL(falseLabel);
-      EmitADD(S1, X0, X0);
-      EmitJ(endLabel);
-
-      EmitLABEL(trueLabel);
-      EmitADDI(S1, X0, 1);
-
-      EmitLABEL(endLabel);
-    } else {
-      EmitBEQ(firstReg, S1, trueLabel);
-
-      EmitSLTU(S1, S1, firstReg);
-      EmitBEQ(S1, X0, falseLabel);
-      EmitJ(trueLabel);
-
-      EmitLABEL(falseLabel);
-      EmitADD(S1, X0, X0);
-      EmitJ(endLabel);
-
-      EmitLABEL(trueLabel);
-      EmitADDI(S1, X0, 1);
-
-      EmitLABEL(endLabel);
-    }
-    free(trueLabel);
-    free(falseLabel);
-    free(endLabel);
-  }
+  /* x >= y is !(x < y). */
+  EmitLessThan(firstReg, S1, IsSignedCompare(child1, c1PtrTotal, child2, c2PtrTotal));
+  EmitXORI(S1, S1, 1);
   ApplyTypeRules(dast, S1);
 }
 
@@ -589,6 +696,7 @@ void ProcessExprBinaryGTEq(DAST* dast,
 void ProcessExprBinaryGT(DAST* dast,
                          char* startLabel,
                          char* endLabel, int regBytes) {
+  MarkSourceLine(dast->filename, dast->linenum);
 
   DAST* child1   = dast->children[0];
   int c1PtrTotal = child1->typeDeclArrCount + child1->typeDeclPtrCount;
@@ -599,77 +707,7 @@ void ProcessExprBinaryGT(DAST* dast,
   /* Make sure type sizes match. */
   MatchSizes (child1, firstReg, child2, S1);
   /* STUDENT CODE HERE. */
-  //Decl* child1_type = dast->children[0]->typeDecl;
-  //Decl* child2_type = dast->children[1]->typeDecl;
-
-  if (c1PtrTotal > 0 && c2PtrTotal > 0) { /* we are working with pointers */
-    char* trueLabel  = GenerateLocalLabel();
-    char* falseLabel = GenerateLocalLabel();
-    char* endLabel   = GenerateLocalLabel();
-
-    EmitSLTU(S1, S1, firstReg);
-    EmitBEQ(S1, X0, falseLabel);
-    EmitJ(trueLabel);
-
-    EmitLABEL(falseLabel);
-    EmitADD(S1, X0, X0);
-    EmitJ(endLabel);
-
-    EmitLABEL(trueLabel);
-    EmitADDI(S1, X0, 1);
-
-    EmitLABEL(endLabel);
-    free(trueLabel);
-    free(falseLabel);
-    free(endLabel);
-  } else {
-    char* trueLabel = GenerateLocalLabel();
-    char* falseLabel = GenerateLocalLabel();
-    char* endLabel   = GenerateLocalLabel();
-    int highest; /* true for signed, false for unsigned */
-    Decl* child1_type = child1->typeDecl;
-    Decl* child2_type = child2->typeDecl;
-
-    if (child1_type == uintType || child2_type == uintType) { /* if highest priority, unsigned */
-      highest = 0;
-    } else if (child1_type == intType || child2_type == intType) { /* if second highest priority, signed */
-      highest = 1;
-    } else if (child1_type == ucharType || child2_type == ucharType) { /* if third highest priority, unsigned */
-      highest = 0;
-    } else { /* either 4th lowest priority or lowest priority, call it signed either way*/
-      highest = 1;
-    }
-    if (highest) {
-      EmitSLT(S1, S1, firstReg);
-      EmitBEQ(S1, X0, falseLabel);
-      EmitJ(trueLabel);
-
-      EmitLABEL(trueLabel);
-      EmitADDI(S1, X0, 1);
-      EmitJ(endLabel);
-
-      EmitLABEL(falseLabel);
-      EmitADD(S1, X0, X0);
-
-      EmitLABEL(endLabel);
-    } else {
-      EmitSLTU(S1, S1, firstReg);
-      EmitBEQ(S1, X0, falseLabel);
-      EmitJ(trueLabel);
-
-      EmitLABEL(falseLabel);
-      EmitADD(S1, X0, X0);
-      EmitJ(endLabel);
-
-      EmitLABEL(trueLabel);
-      EmitADDI(S1, X0, 1);
-
-      EmitLABEL(endLabel);
-    }
-    free(trueLabel);
-    free(falseLabel);
-    free(endLabel);
-  }
+  EmitLessThan(S1, firstReg, IsSignedCompare(child1, c1PtrTotal, child2, c2PtrTotal));
   ApplyTypeRules(dast, S1);
 }
 
@@ -715,6 +753,7 @@ void ProcessExprBinaryGT(DAST* dast,
 void ProcessExprBinaryLT(DAST* dast,
                          char* startLabel,
                          char* endLabel, int regBytes) {
+  MarkSourceLine(dast->filename, dast->linenum);
 
   DAST* child1   = dast->children[0];
   int c1PtrTotal = child1->typeDeclArrCount + child1->typeDeclPtrCount;
@@ -725,78 +764,7 @@ void ProcessExprBinaryLT(DAST* dast,
   /* Make sure type sizes match. */
   MatchSizes (child1, firstReg, child2, S1);
   /* STUDENT CODE HERE. */
-  //Decl* child1_type = dast->children[0]->typeDecl;
-  //Decl* child2_type = dast->children[1]->typeDecl;
-
-  if (c1PtrTotal > 0 && c2PtrTotal > 0) { /* we are working with pointers */
-    char* trueLabel  = GenerateLocalLabel();
-    char* falseLabel = GenerateLocalLabel();
-    char* endLabel   = GenerateLocalLabel();
-
-    EmitSLTU(S1, firstReg, S1);
-    EmitBEQ(S1, X0, falseLabel);
-    EmitJ(trueLabel);
-
-    EmitLABEL(falseLabel);
-    EmitADD(S1, X0, X0);
-    EmitJ(endLabel);
-
-    EmitLABEL(trueLabel);
-    EmitADDI(S1, X0, 1);
-
-    EmitLABEL(endLabel);
-    free(trueLabel);
-    free(falseLabel);
-    free(endLabel);
-  } else {
-    char* trueLabel = GenerateLocalLabel();
-    char* falseLabel = GenerateLocalLabel();
-    char* endLabel   = GenerateLocalLabel();
-    int highest; /* true for signed, false for unsigned */
-    Decl* child1_type = child1->typeDecl;
-    Decl* child2_type = child2->typeDecl;
-
-    if (child1_type == uintType || child2_type == uintType) { /* if highest priority, unsigned */
-      highest = 0;
-    } else if (child1_type == intType || child2_type == intType) { /* if second highest priority, signed */
-      highest = 1;
-    } else if (child1_type == ucharType || child2_type == ucharType) { /* if third highest priority, unsigned */
-      highest = 0;
-    } else { /* either 4th lowest priority or lowest priority, call it signed either way*/
-      highest = 1;
-    }
-    if (highest) {
-      EmitSLT(S1, firstReg, S1);
-      EmitBEQ(S1, X0, falseLabel);
-      EmitJ(trueLabel);
-
-      EmitLABEL(falseLabel);
-      EmitADD(S1, X0, X0);
-      EmitJ(endLabel);
-
-      EmitLABEL(trueLabel);
-      EmitADDI(S1, X0, 1);
-
-      EmitLABEL(endLabel);
-    } else {
-
-      EmitSLTU(S1, firstReg, S1);
-      EmitBEQ(S1, X0, falseLabel);
-      EmitJ(trueLabel);
-
-      EmitLABEL(falseLabel);
-      EmitADD(S1, X0, X0);
-      EmitJ(endLabel);
-
-      EmitLABEL(trueLabel);
-      EmitADDI(S1, X0, 1);
-
-      EmitLABEL(endLabel);
-    }
-    free(trueLabel);
-    free(falseLabel);
-    free(endLabel);
-  }
+  EmitLessThan(firstReg, S1, IsSignedCompare(child1, c1PtrTotal, child2, c2PtrTotal));
   ApplyTypeRules(dast, S1);
 }
 
@@ -842,6 +810,7 @@ void ProcessExprBinaryLT(DAST* dast,
 void ProcessExprBinaryLTEq(DAST* dast,
                            char* startLabel,
                            char* endLabel, int regBytes) {
+  MarkSourceLine(dast->filename, dast->linenum);
 
   DAST* child1   = dast->children[0];
   int c1PtrTotal = child1->typeDeclArrCount + child1->typeDeclPtrCount;
@@ -853,83 +822,9 @@ void ProcessExprBinaryLTEq(DAST* dast,
   MatchSizes (child1, firstReg, child2, S1);
 
   /* STUDENT CODE HERE. */
-
-  //Decl* child1_type = dast->children[0]->typeDecl;
-  //Decl* child2_type = dast->children[1]->typeDecl;
-
-  if (c1PtrTotal > 0 && c2PtrTotal > 0) { /* we are working with pointers */
-    char* trueLabel  = GenerateLocalLabel();
-    char* falseLabel = GenerateLocalLabel();
-    char* endLabel   = GenerateLocalLabel();
-    EmitBEQ(firstReg, S1, trueLabel);
-
-    EmitSLTU(S1, firstReg, S1);
-    EmitBEQ(S1, X0, falseLabel);
-    EmitJ(trueLabel);
-
-    EmitLABEL(falseLabel);
-    EmitADD(S1, X0, X0);
-    EmitJ(endLabel);
-
-    EmitLABEL(trueLabel);
-    EmitADDI(S1, X0, 1);
-
-    EmitLABEL(endLabel);
-    free(trueLabel);
-    free(falseLabel);
-    free(endLabel);
-  } else {
-    char* trueLabel = GenerateLocalLabel();
-    char* falseLabel = GenerateLocalLabel();
-    char* endLabel   = GenerateLocalLabel();
-    int highest; /* true for signed, false for unsigned */
-    Decl* child1_type = child1->typeDecl;
-    Decl* child2_type = child2->typeDecl;
-
-    if (child1_type == uintType || child2_type == uintType) { /* if highest priority, unsigned */
-      highest = 0;
-    } else if (child1_type == intType || child2_type == intType) { /* if second highest priority, signed */
-      highest = 1;
-    } else if (child1_type == ucharType || child2_type == ucharType) { /* if third highest priority, unsigned */
-      highest = 0;
-    } else { /* either 4th lowest priority or lowest priority, call it signed either way*/
-      highest = 1;
-    }
-    if (highest) {
-      EmitBEQ(firstReg, S1, trueLabel);
-
-      EmitSLT(S1, firstReg, S1);
-      EmitBEQ(S1, X0, falseLabel);
-      EmitJ(trueLabel);
-
-      EmitLABEL(falseLabel);
-      EmitADD(S1, X0, X0);
-      EmitJ(endLabel);
-
-      EmitLABEL(trueLabel);
-      EmitADDI(S1, X0, 1);
-
-      EmitLABEL(endLabel);
-    } else {
-      EmitBEQ(firstReg, S1, trueLabel);
-
-      EmitSLTU(S1, firstReg, S1);
-      EmitBEQ(S1, X0, falseLabel);
-      EmitJ(trueLabel);
-
-      EmitLABEL(falseLabel);
-      EmitADD(S1, X0, X0);
-      EmitJ(endLabel);
-
-      EmitLABEL(trueLabel);
-      EmitADDI(S1, X0, 1);
-
-      EmitLABEL(endLabel);
-    }
-    free(trueLabel);
-    free(falseLabel);
-    free(endLabel);
-  }
+  /* x <= y is !(y < x). */
+  EmitLessThan(S1, firstReg, IsSignedCompare(child1, c1PtrTotal, child2, c2PtrTotal));
+  EmitXORI(S1, S1, 1);
   ApplyTypeRules(dast, S1);
 }
 
@@ -938,17 +833,40 @@ void ProcessExprBinaryLTEq(DAST* dast,
  *  allocate space for the arguments, places the arguments on the stack and
  *  then switches control to the function it calls. On return it moves the
  *  output to our S1, our invariant register and restores the stack to its
- *  previous state.
+ *  previous state. Temporaries holding operands of an enclosing binary
+ *  expression are saved before the arguments and reloaded after the call.
+ *  With --register-args the stack space is still allocated but the first
+ *  ARG_REG_TOTAL arguments are passed in a0-a7 instead.
  *
  *  To determine where to place arugments you should use the values in offsets
  *  and to determine how large of a value to store (either word or byte) you
  *  should use the results in sizes.
  */
 void ProcessExprCall(DAST* dast, char* startLabel, char* endLabel, int regBytes) {
+  MarkSourceLine(dast->filename, dast->linenum);
   DAST* funcID    = dast->children[0];
   DAST* params    = dast->children[1];
   char* funcLabel = funcID->data.identifier;
   int decr        = 0;
+  int savedBytes  = 0;
+  int argRegs     = 0;
+  enum reg heldRegs[ARG_REG_TOTAL];
+  /* Temporaries holding operands of enclosing expressions must survive. */
+  for (enum reg r = T1; r <= T5; r++) {
+    if (IsLiveTempReg(r)) {
+      savedBytes += 4;
+    }
+  }
+  if (savedBytes > 0) {
+    int offset = 0;
+    EmitADDI(SP, SP, -1 * savedBytes);
+    for (enum reg r = T1; r <= T5; r++) {
+      if (IsLiveTempReg(r)) {
+        EmitSW(r, offset, SP);
+        offset += 4;
+      }
+    }
+  }
   /* move stack for all children, if they exist */
   if (params->size > 0) {
 
@@ -963,29 +881,64 @@ void ProcessExprCall(DAST* dast, char* startLabel, char* endLabel, int regBytes)
     }
 
     decr = ComputeArgLocations (funcID->varDecl, offsets, sizes);
+    if (GetCGenOptions()->registerArgs) {
+      argRegs = params->size < ARG_REG_TOTAL ? params->size : ARG_REG_TOTAL;
+    }
     /* Decrement the stack. */
     EmitADDI(SP, SP, -1 * decr);
-    for (int i = 0; i < params->size; i++) {
+    for (int i = 0; i < (int) params->size; i++) {
       /* STUDENT CODE HERE */
-      Dispatch(params->children[i], startLabel, endLabel, regBytes);
+      DispatchChild(params->children[i], startLabel, endLabel, regBytes);
+      /* Hold register arguments until every argument is computed. */
+      if (i < argRegs) {
+        /* Nothing is computed after the last one so it can stay in S1. */
+        heldRegs[i] = i == (int) params->size - 1 ? S1 : AllocateExprReg();
+        if (heldRegs[i] != X0) {
+          if (heldRegs[i] != S1) {
+            EmitMV(heldRegs[i], S1);
+          }
+          continue;
+        }
+      }
       if (sizes[i] == 4) { /* use load/store word */
         EmitSW(S1, offsets[i], SP);
       } else if (sizes[i] == 1) { /* use load/store byte */
         EmitSB(S1, offsets[i], SP);
       }
     }
+    for (int i = 0; i < argRegs; i++) {
+      if (heldRegs[i] != X0) {
+        EmitArgMV(i, heldRegs[i]);
+        FreeExprReg(heldRegs[i]);
+      } else if (sizes[i] == 4) {
+        EmitArgLW(i, offsets[i], SP);
+      } else {
+        EmitArgLB(i, offsets[i], SP);
+      }
+    }
     /* Free the memory. */
     free (offsets);
     free (sizes);
   }
 
   /* STUDENT CODE HERE */
+  EmitCallArgs(decr, argRegs);
   EmitJAL(RA, funcLabel);
   EmitADD(S1, X0, A0);
   /* Restore the stack */
   if (params->size > 0) {
     EmitADDI(SP, SP, decr);
   }
+  if (savedBytes > 0) {
+    int offset = 0;
+    for (enum reg r = T1; r <= T5; r++) {
+      if (IsLiveTempReg(r)) {
+        EmitLW(r, offset, SP);
+        offset += 4;
+      }
+    }
+    EmitADDI(SP, SP, savedBytes);
+  }
   ApplyTypeRules(dast, S1);
 }
 
@@ -1008,20 +961,56 @@ void ProcessExprCall(DAST* dast, char* startLabel, char* endLabel, int regBytes)
 size_t SaveRegisters() {
   /* STUDENT CODE HERE */
   /* Replace me with number of bytes the SP moves. */
-  EmitADDI(SP, SP, -48);
-  EmitSW(S1, 0, SP);
-  EmitSW(S2, 4, SP);
-  EmitSW(S3, 8, SP);
-  EmitSW(S4, 12, SP);
-  EmitSW(S5, 16, SP);
-  EmitSW(S6, 20, SP);
-  EmitSW(S7, 24, SP);
-  EmitSW(S8, 28, SP);
-  EmitSW(S9, 32, SP);
-  EmitSW(S10, 36, SP);
-  EmitSW(S11, 40, SP);
-  EmitSW(RA, 44, SP);
-  return 48;
+  /*
+   * Which registers need saving is only known once the body has been
+   * generated, so the stores are emitted by RestoreRegisters. The space
+   * for all of them is always reserved to keep the frame layout fixed.
+   */
+  BeginPhase(PHASE_CODEGEN);
+  BeginFunctionIR();
+  markedFile = NULL;
+  return SAVED_BYTES;
+}
+
+/*
+ *  With --register-args the caller still reserves stack space for every
+ *  argument but passes the first ones in a0-a7. Stores those into their
+ *  stack slots at the start of body so the rest of code generation can keep
+ *  addressing parameters from the frame pointer. The register allocator
+ *  turns the stores into moves for parameters it keeps in registers.
+ */
+static void StoreArgRegisters(IRList* body) {
+  Decl* block = IRFunctionBlock(body);
+  Decl* params[ARG_REG_TOTAL];
+  int paramTotal = 0;
+  if (block == NULL) {
+    return;
+  }
+  /* Parameters are ordered by their offsets. */
+  for (size_t i = 0; i < block->childrenSize; i++) {
+    Decl* child = block->children[i];
+    if (child->group != DECL_VAR || child->offset < 0) {
+      continue;
+    }
+    int position = paramTotal;
+    while (position > 0 && params[position - 1]->offset > child->offset) {
+      if (position < ARG_REG_TOTAL) {
+        params[position] = params[position - 1];
+      }
+      position--;
+    }
+    if (position < ARG_REG_TOTAL) {
+      params[position] = child;
+    }
+    if (paramTotal < ARG_REG_TOTAL) {
+      paramTotal++;
+    }
+  }
+  for (int i = paramTotal - 1; i >= 0; i--) {
+    IRInstr store = {params[i]->dataSize == 1 ? IR_SB : IR_SW, NO_REG, FP, A0 + i,
+                     params[i]->offset + WORDSIZE, NULL, -1, 0};
+    InsertIR(body, 0, store);
+  }
 }
 
 /*
@@ -1031,19 +1020,149 @@ size_t SaveRegisters() {
  */
 void RestoreRegisters() {
   /* STUDENT CODE HERE */
-  EmitLW(RA, 44, SP);
-  EmitLW(S11, 40, SP);
-  EmitLW(S10, 36, SP);
-  EmitLW(S9, 32, SP);
-  EmitLW(S8, 28, SP);
-  EmitLW(S7, 24, SP);
-  EmitLW(S6, 20, SP);
-  EmitLW(S5, 16, SP);
-  EmitLW(S4, 12, SP);
-  EmitLW(S3, 8, SP);
-  EmitLW(S2, 4, SP);
-  EmitLW(S1, 0, SP);
-  EmitADDI(SP, SP, 48);
+  IRList* body = EndFunctionIR();
+  EndPhase(PHASE_CODEGEN);
+  AddStat(STAT_FUNCTIONS, 1);
+  size_t parsed = CountIRInstrs(body);
+  AddStat(STAT_IR_PARSED, parsed);
+  MaxStat(STAT_LARGEST_BODY, parsed);
+  BeginPhase(PHASE_REGISTER_ALLOC);
+  if (GetCGenOptions()->registerArgs) {
+    StoreArgRegisters(body);
+  }
+  AllocateRegisters(body, SAVED_BYTES);
+  EndPhase(PHASE_REGISTER_ALLOC);
+  if (!GetCGenOptions()->noPeephole) {
+    BeginPhase(PHASE_PEEPHOLE);
+    RunPeephole(body);
+    EndPhase(PHASE_PEEPHOLE);
+  }
+  AddStat(STAT_IR_EMITTED, CountIRInstrs(body));
+  BeginPhase(PHASE_PRINT);
+  uint32_t saved = WrittenRegisters(body);
+  char* name = IRFunctionName(body);
+  Decl* block = IRFunctionBlock(body);
+  Decl* function = block != NULL ? block->parent : NULL;
+  /* Saving and restoring registers counts towards the function's line. */
+  if (function != NULL) {
+    markedFile = NULL;
+    MarkSourceLine(function->filename, function->linenum);
+  }
+  /* main exits with an ecall instead of returning so it saves nothing. */
+  if (name != NULL && strcmp(name, "main") == 0) {
+    saved = 0;
+  }
+  EmitADDI(SP, SP, -SAVED_BYTES);
+  for (size_t i = 0; i < SAVED_REG_TOTAL; i++) {
+    if (saved & (1u << savedRegs[i])) {
+      EmitSW(savedRegs[i], i * WORDSIZE, SP);
+    }
+  }
+  PrintIR(body);
+  FreeIR(body);
+  EndPhase(PHASE_PRINT);
+  if (function != NULL) {
+    markedFile = NULL;
+    MarkSourceLine(function->filename, function->linenum);
+  }
+  for (size_t i = SAVED_REG_TOTAL; i-- > 0;) {
+    if (saved & (1u << savedRegs[i])) {
+      EmitLW(savedRegs[i], i * WORDSIZE, SP);
+    }
+  }
+  EmitADDI(SP, SP, SAVED_BYTES);
+  /* The rest of the epilogue is not generated here so goes unmarked. */
+  if (GetCGenOptions()->lineInfo) {
+    EmitCOMMENT(LINE_MARKER);
+    markedFile = NULL;
+  }
+}
+
+/*
+ *  Generates code for the condition of an if or while that branches to
+ *  target when the truth of the condition equals branchIf and falls through
+ *  otherwise. Comparisons branch on their operands directly, && and || branch
+ *  straight to the final targets and constants are decided here, so none of
+ *  them produce a 0 or 1 in S1 first.
+ */
+static void ProcessCondition(DAST* dast, char* target, int branchIf,
+                             char* startLabel, char* endLabel, int regBytes) {
+  DAST* child1 = dast->size > 0 ? dast->children[0] : NULL;
+  DAST* child2 = dast->size > 1 ? dast->children[1] : NULL;
+  switch (dast->type) {
+    case NODETYPE_CONSTANT_TRUE:
+    case NODETYPE_CONSTANT_FALSE:
+    case NODETYPE_CONSTANT_NULL:
+    case NODETYPE_CONSTANT_INTEGER:
+      if ((dast->type == NODETYPE_CONSTANT_TRUE
+           || (dast->type == NODETYPE_CONSTANT_INTEGER && dast->data.integer != 0)) == branchIf) {
+        EmitJ(target);
+      }
+      return;
+    case NODETYPE_EXPR_PREFIX_NOTNOT:
+      ProcessCondition(child1, target, !branchIf, startLabel, endLabel, regBytes);
+      return;
+    case NODETYPE_EXPR_BINARY_ANDAND:
+    case NODETYPE_EXPR_BINARY_OROR:
+      /*
+       *  Both operands branch straight to the final targets. When the first
+       *  operand decides the result the other way it skips the second one.
+       */
+      if ((dast->type == NODETYPE_EXPR_BINARY_OROR) == branchIf) {
+        ProcessCondition(child1, target, branchIf, startLabel, endLabel, regBytes);
+        ProcessCondition(child2, target, branchIf, startLabel, endLabel, regBytes);
+      } else {
+        char* skipLabel = NewLocalLabel();
+        ProcessCondition(child1, skipLabel, !branchIf, startLabel, endLabel, regBytes);
+        ProcessCondition(child2, target, branchIf, startLabel, endLabel, regBytes);
+        EmitLABEL(skipLabel);
+      }
+      return;
+    case NODETYPE_EXPR_BINARY_EQUAL:
+    case NODETYPE_EXPR_BINARY_NOTEQUAL:
+    case NODETYPE_EXPR_BINARY_GREATEREQUAL:
+    case NODETYPE_EXPR_BINARY_GREATER:
+    case NODETYPE_EXPR_BINARY_LESSEQUAL:
+    case NODETYPE_EXPR_BINARY_LESS:
+      break;
+    default:
+      DispatchChild(dast, startLabel, endLabel, regBytes);
+      if (branchIf) {
+        EmitBNE(S1, X0, target);
+      } else {
+        EmitBEQ(S1, X0, target);
+      }
+      return;
+  }
+  int c1PtrTotal = child1->typeDeclArrCount + child1->typeDeclPtrCount;
+  int c2PtrTotal = child2->typeDeclArrCount + child2->typeDeclPtrCount;
+  enum reg firstReg = SetupBinaryInvariant(dast, startLabel, endLabel, regBytes);
+  MatchSizes(child1, firstReg, child2, S1);
+  int isSigned = IsSignedCompare(child1, c1PtrTotal, child2, c2PtrTotal);
+  switch (dast->type) {
+    case NODETYPE_EXPR_BINARY_NOTEQUAL:
+      branchIf = !branchIf;
+      /* Fall through */
+    case NODETYPE_EXPR_BINARY_EQUAL:
+      if (branchIf) {
+        EmitBEQ(firstReg, S1, target);
+      } else {
+        EmitBNE(firstReg, S1, target);
+      }
+      break;
+    case NODETYPE_EXPR_BINARY_LESSEQUAL:  /* x <= y is !(y < x). */
+      branchIf = !branchIf;
+      /* Fall through */
+    case NODETYPE_EXPR_BINARY_GREATER:
+      EmitBranchLessThan(S1, firstReg, branchIf, isSigned, target);
+      break;
+    case NODETYPE_EXPR_BINARY_GREATEREQUAL:  /* x >= y is !(x < y). */
+      branchIf = !branchIf;
+      /* Fall through */
+    default:
+      EmitBranchLessThan(firstReg, S1, branchIf, isSigned, target);
+      break;
+  }
 }
 
 /*
@@ -1054,8 +1173,9 @@ void RestoreRegisters() {
  *  ends of loops.
  */
 void ProcessIfElse(DAST* dast, char* startLabel, char* endLabel, int regBytes) {
-  char* condEnd   = GenerateLocalLabel();
-  char* elseStart = GenerateLocalLabel();
+  MarkSourceLine(dast->filename, dast->linenum);
+  char* condEnd   = NewLocalLabel();
+  char* elseStart = NewLocalLabel();
   DAST* condition = dast->children[0];
   DAST* ifBody    = dast->children[1];
   DAST* elseBody  = NULL;
@@ -1064,22 +1184,17 @@ void ProcessIfElse(DAST* dast, char* startLabel, char* endLabel, int regBytes) {
   }
   /* STUDENT CODE HERE. */
   if (elseBody == NULL) { /* no else body */
-    Dispatch(condition, startLabel, endLabel, regBytes);
-    EmitBEQ(S1, X0, condEnd);
-    Dispatch(ifBody, startLabel, endLabel, regBytes);
+    ProcessCondition(condition, condEnd, 0, startLabel, endLabel, regBytes);
+    DispatchChild(ifBody, startLabel, endLabel, regBytes);
     EmitLABEL(condEnd);
   } else {
-    Dispatch(condition, startLabel, endLabel, regBytes);
-    EmitBEQ(S1, X0, elseStart);
-    Dispatch(ifBody, startLabel, endLabel, regBytes);
+    ProcessCondition(condition, elseStart, 0, startLabel, endLabel, regBytes);
+    DispatchChild(ifBody, startLabel, endLabel, regBytes);
     EmitJ(condEnd);
     EmitLABEL(elseStart);
-    Dispatch(elseBody, startLabel, endLabel, regBytes);
+    DispatchChild(elseBody, startLabel, endLabel, regBytes);
     EmitLABEL(condEnd);
   }
-  /* Free the labels used. */
-  free (condEnd);
-  free (elseStart);
   ApplyTypeRules(dast, S1);
 }
 
@@ -1092,20 +1207,23 @@ void ProcessIfElse(DAST* dast, char* startLabel, char* endLabel, int regBytes) {
  *  used at the end of the loop.
  */
 void ProcessWhile(DAST* dast, char* startLabel, char* endLabel, int regBytes) {
-  char* startWhile = GenerateLocalLabel();
-  char* endWhile   = GenerateLocalLabel();
+  MarkSourceLine(dast->filename, dast->linenum);
+  char* startWhile = NewLocalLabel();
+  char* endWhile   = NewLocalLabel();
+  char* bodyWhile  = NewLocalLabel();
   DAST* condition  = dast->children[0];
   DAST* whileBody  = dast->children[1];
 
   /* STUDENT CODE HERE. */
-  EmitLABEL(startWhile);
-  Dispatch(condition, startLabel, endLabel, regBytes);
-  EmitBEQ(S1, X0, endWhile);
-  Dispatch(whileBody, startWhile, endWhile, regBytes);
+  /*
+   *  The condition is placed after the body so each iteration takes a single
+   *  branch back to the body instead of a branch out and a jump back.
+   */
   EmitJ(startWhile);
+  EmitLABEL(bodyWhile);
+  DispatchChild(whileBody, startWhile, endWhile, regBytes);
+  EmitLABEL(startWhile);
+  ProcessCondition(condition, bodyWhile, 1, startLabel, endLabel, regBytes);
   EmitLABEL(endWhile);
-  /* Free the labels used. */
-  free (startWhile);
-  free (endWhile);
   ApplyTypeRules(dast, S1);
 }
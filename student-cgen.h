@@ -29,7 +29,8 @@ void ProcessExprPrefixNegate(DAST* dast,
  *  Helper function used to ease maintaining the our latest value in S1 invariant
  *  for binary expression. It returns an enum value which contains the value of
  *  the register used to hold a value the first of the two expresions,
- *  (the second is defined to be in s1).
+ *  (the second is defined to be in s1). The returned register is only valid
+ *  until the next call to this function.
  *
  *  You should use the enum values in instructions.h
  */
@@ -0,0 +1,18 @@
+/*
+ *  Definitions of the functions in utils.h for 61cas and 61csim. 61ccc gets
+ *  them from the 61Ccc-notcgen library, which the tools do not link so that
+ *  they build from this directory alone.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "utils.h"
+
+void AllocationFailed() {
+  fprintf(stderr, "Error: Memory allocation failed.\n");
+  exit(1);
+}
+
+int CeilDiv(int dividend, int divisor) {
+  return (dividend + divisor - 1) / divisor;
+}